@@ -0,0 +1,51 @@
+#!/bin/sh
+# Measures the assembler throughput on a generated source.
+#
+# Usage: ./bench/basm_throughput.sh [lines]
+#
+# The source consists of `%bind` constants and labels, and ends with a
+# block of instructions that refer to them through deferred operands.
+# A program holds at most BM_PROGRAM_CAPACITY (1024) instructions, so the
+# block is always 1000 instructions and `lines` only grows the bindings
+# and labels: the number measures the parsing and the name lookups, not
+# the translation of a million instructions.
+
+set -e
+
+LINES=${1:-1000000}
+BASM=${BASM:-./basm}
+WORKDIR=${TMPDIR:-/tmp}/basm_throughput.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+awk -v lines="$LINES" 'BEGIN {
+    refs = 1000
+    for (i = 0; i < lines - refs; ++i) {
+        if (i % 2 == 0) {
+            printf "%%bind c%d %d\n", i, i
+        } else {
+            printf "l%d:\n", i
+        }
+    }
+    for (i = 0; i < refs - 1; ++i) {
+        k = int(i * (lines - refs) / refs)
+        if (k % 2 == 0) {
+            printf "    push c%d ; constant\n", k
+        } else {
+            printf "    jmp l%d\n", k
+        }
+    }
+    printf "    halt\n"
+}' > "$WORKDIR/gen.basm"
+
+echo "lines: $(wc -l < "$WORKDIR/gen.basm"), bytes: $(wc -c < "$WORKDIR/gen.basm")"
+
+start=$(date +%s.%N)
+"$BASM" "$WORKDIR/gen.basm" "$WORKDIR/gen.bm"
+end=$(date +%s.%N)
+
+awk -v start="$start" -v end="$end" -v lines="$LINES" 'BEGIN {
+    elapsed = end - start
+    printf "time: %.3fs, throughput: %.0f lines/s\n", elapsed, lines / elapsed
+}'
@@ -0,0 +1,137 @@
+#!/bin/sh
+# Compares the sharded concurrent map against a Swiss table behind one
+# mutex while more and more threads hammer a shared key/value cache.
+#
+# Usage: ./bench/conctab_contention.sh [max-threads] [operations-per-thread]
+#
+# Every thread works over the same set of keys with one of the mixes:
+#   sets:     90% gets and 10% sets
+#   deletes:  80% gets, 10% sets and 10% deletes, so the removed entries
+#             go through the epoch based reclamation
+#   buffered: 90% gets and 10% sets through the per-thread insert buffers,
+#             the locked swisstab does plain sets
+
+set -e
+
+THREADS=${1:-$(nproc 2>/dev/null || echo 4)}
+OPERATIONS=${2:-1000000}
+CC=${CC:-cc}
+WORKDIR=${TMPDIR:-/tmp}/conctab_contention.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+cat > "$WORKDIR/contention.c" <<END
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#include "conctab.h"
+#include "swisstab.h"
+
+#define KEYS 65536
+
+enum { MIX_SETS, MIX_DELETES, MIX_BUFFERED, MIXES_COUNT };
+static const char *mix_names[MIXES_COUNT] = {"sets", "deletes", "buffered"};
+
+static ConcTab *conctab;
+static SwissTab *swisstab;
+static mtx_t swisstab_lock;
+static long operations;
+static int mix;
+
+static unsigned next(unsigned *state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+static int run_conctab(void *arg)
+{
+    unsigned state = (unsigned) (size_t) arg;
+    ConcTabThread *thread = join_conctab(conctab);
+    value_t value;
+    for (long i = 0; i < operations; ++i) {
+        int key = (int) (next(&state) % KEYS);
+        unsigned op = next(&state) % 10;
+        if (op == 0 && mix == MIX_BUFFERED) {
+            buffer_conctab(thread, decimal(key), decimal(key));
+        } else if (op == 0) {
+            set_conctab(thread, decimal(key), decimal(key));
+        } else if (op == 1 && mix == MIX_DELETES) {
+            del_conctab(thread, decimal(key));
+        } else {
+            get_conctab(thread, decimal(key), &value);
+        }
+    }
+    flush_conctab(thread);
+    leave_conctab(thread);
+    return 0;
+}
+
+static int run_swisstab(void *arg)
+{
+    unsigned state = (unsigned) (size_t) arg;
+    for (long i = 0; i < operations; ++i) {
+        int key = (int) (next(&state) % KEYS);
+        unsigned op = next(&state) % 10;
+        mtx_lock(&swisstab_lock);
+        if (op == 0) {
+            set_swisstab(swisstab, decimal(key), decimal(key));
+        } else if (op == 1 && mix == MIX_DELETES) {
+            del_swisstab(swisstab, decimal(key));
+        } else {
+            get_swisstab(swisstab, decimal(key));
+        }
+        mtx_unlock(&swisstab_lock);
+    }
+    return 0;
+}
+
+static double measure(thrd_start_t run, int threads)
+{
+    thrd_t ids[threads];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < threads; ++i) {
+        thrd_create(&ids[i], run, (void *) (size_t) (i + 1));
+    }
+    for (int i = 0; i < threads; ++i) {
+        thrd_join(ids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    int threads = atoi(argv[1]);
+    operations = atol(argv[2]);
+
+    conctab = new_conctab(0, DECIMAL_TYPE, DECIMAL_TYPE);
+    swisstab = new_swisstab(KEYS, DECIMAL_TYPE, DECIMAL_TYPE);
+    mtx_init(&swisstab_lock, mtx_plain);
+
+    for (mix = 0; mix < MIXES_COUNT; ++mix) {
+        for (int n = 1; n <= threads; ++n) {
+            double sharded = measure(run_conctab, n);
+            double locked = measure(run_swisstab, n);
+            printf("%s, %d threads: conctab %.0f ops/s, locked swisstab %.0f ops/s\n",
+                   mix_names[mix], n,
+                   (double) operations * n / sharded, (double) operations * n / locked);
+        }
+    }
+
+    free_conctab(conctab);
+    free_swisstab(swisstab);
+    return 0;
+}
+END
+
+"$CC" -O2 -std=c11 -pthread -I./src/exclib -o "$WORKDIR/contention" \
+    "$WORKDIR/contention.c" \
+    ./src/exclib/conctab.c ./src/exclib/swisstab.c ./src/exclib/type.c
+
+"$WORKDIR/contention" "$THREADS" "$OPERATIONS"
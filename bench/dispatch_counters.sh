@@ -0,0 +1,96 @@
+#!/bin/sh
+# Reads the hardware counters of the host (bme -perf) for a switch in the
+# guest, once as a jmp_table and once as a chain of eq/jmp_if.
+#
+# Usage: ./bench/dispatch_counters.sh [iterations]
+#
+# Every iteration picks one of four cases by the lowest bits of the
+# counter. Where the kernel does not let bme read the counters only the
+# time is reported.
+
+set -e
+
+ITERATIONS=${1:-10000000}
+BASM=${BASM:-./basm}
+BME=${BME:-./bme}
+WORKDIR=${TMPDIR:-/tmp}/dispatch_counters.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+generate() {
+    cat <<END
+%table ops op_0 op_1 op_2 op_3
+    push 0
+    push $ITERATIONS
+loop:
+    dup 0
+    push 3
+    andb
+    dup 0
+END
+    cat
+    cat <<END
+op_0:
+    drop
+    swap 1
+    push 1
+    plusi
+    swap 1
+    jmp next
+op_1:
+    drop
+    swap 1
+    push 3
+    plusi
+    swap 1
+    jmp next
+op_2:
+    drop
+    swap 1
+    push 5
+    xor
+    swap 1
+    jmp next
+op_3:
+    drop
+    swap 1
+    push 1
+    shl
+    swap 1
+next:
+    push 1
+    minusi
+    dup 0
+    push 0
+    eq
+    not
+    jmp_if loop
+    halt
+END
+}
+
+generate > "$WORKDIR/table.basm" <<END
+    jmp_table ops
+END
+
+generate > "$WORKDIR/chain.basm" <<END
+    push 0
+    eq
+    jmp_if op_0
+    dup 0
+    push 1
+    eq
+    jmp_if op_1
+    dup 0
+    push 2
+    eq
+    jmp_if op_2
+    jmp op_3
+END
+
+for variant in table chain; do
+    "$BASM" "$WORKDIR/$variant.basm" "$WORKDIR/$variant.bm" > /dev/null
+    echo "$variant:"
+    "$BME" -perf -i "$WORKDIR/$variant.bm" 2>&1
+done
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Compares the memory accesses checked against BM_MEMORY_CAPACITY (bme)
+# with the ones caught by the guard pages (bme-guard).
+#
+# Usage: ./bench/guard_memory.sh [iterations]
+#
+# The program keeps copying a word of the memory to the next one, so
+# every iteration is a read64 and a write64.
+
+set -e
+
+ITERATIONS=${1:-10000000}
+BASM=${BASM:-./basm}
+WORKDIR=${TMPDIR:-/tmp}/guard_memory.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+cat > "$WORKDIR/copy.basm" <<END
+    push $ITERATIONS
+loop:
+    dup 0
+    push 4095
+    andb
+    push 3
+    shl
+    dup 0
+    read64
+    push 1
+    plusi
+    swap 1
+    push 8
+    plusi
+    swap 1
+    write64
+    push 1
+    minusi
+    dup 0
+    push 0
+    eq
+    not
+    jmp_if loop
+    halt
+END
+"$BASM" "$WORKDIR/copy.basm" "$WORKDIR/copy.bm" > /dev/null
+
+run() {
+    start=$(date +%s.%N)
+    "$2" -i "$WORKDIR/copy.bm"
+    end=$(date +%s.%N)
+
+    awk -v name="$1" -v start="$start" -v end="$end" -v iterations="$ITERATIONS" 'BEGIN {
+        elapsed = end - start
+        printf "%s: %.3fs, %.0f iterations/s\n", name, elapsed, iterations / elapsed
+    }'
+}
+
+run checked "${BME:-./bme}"
+run guarded "${BME_GUARD:-./bme-guard}"
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Compares the guest heap natives against the malloc based ones on an
+# allocation heavy loop.
+#
+# Usage: ./bench/heap_alloc.sh [iterations]
+#
+# Every iteration allocates a few small blocks and a large one and frees
+# them in a different order than they were allocated.
+
+set -e
+
+ITERATIONS=${1:-1000000}
+BASM=${BASM:-./basm}
+BME=${BME:-./bme}
+WORKDIR=${TMPDIR:-/tmp}/heap_alloc.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+generate() {
+    cat <<END
+%include "./examples/natives.hasm"
+    push $ITERATIONS
+loop:
+    push 24
+    native $1
+    push 200
+    native $1
+    push 2000
+    native $1
+    push 64
+    native $1
+    native $2
+    swap 1
+    native $2
+    native $2
+    native $2
+    push 1
+    minusi
+    dup 0
+    push 0
+    eq
+    not
+    jmp_if loop
+    halt
+END
+}
+
+run() {
+    generate "$2" "$3" > "$WORKDIR/$1.basm"
+    "$BASM" "$WORKDIR/$1.basm" "$WORKDIR/$1.bm" > /dev/null
+
+    start=$(date +%s.%N)
+    "$BME" -i "$WORKDIR/$1.bm"
+    end=$(date +%s.%N)
+
+    awk -v name="$1" -v start="$start" -v end="$end" -v iterations="$ITERATIONS" 'BEGIN {
+        elapsed = end - start
+        printf "%s: %.3fs, %.0f allocations/s\n", name, elapsed, iterations * 4 / elapsed
+    }'
+}
+
+run malloc alloc free
+run heap heap_alloc heap_free
@@ -0,0 +1,77 @@
+#!/bin/sh
+# Compares the buffered output of the print natives against the
+# unbuffered one (`bme -u`), which is a write(2) per printed number.
+#
+# Usage: ./bench/print_fib.sh [count]
+#
+# Both programs print the first `count` Fibonacci numbers, one with
+# print_u64 (wrapping around 2^64) and the other one with print_f64 where
+# every step is scaled down by the golden ratio to stay away from inf.
+
+set -e
+
+COUNT=${1:-1000000}
+BASM=${BASM:-./basm}
+BME=${BME:-./bme}
+WORKDIR=${TMPDIR:-/tmp}/print_fib.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# NOTE: `generate <zero> <one> <plus> <print>`
+generate() {
+    cat <<END
+%include "$PWD/examples/natives.hasm"
+    push $1
+    push $2
+    push $COUNT
+loop:
+    dup 2
+    native $4
+    swap 2
+    dup 1
+    $3
+    swap 1
+    swap 2
+    push 1
+    minusi
+    dup 0
+    push 0
+    eq
+    not
+    jmp_if loop
+    halt
+END
+}
+
+# NOTE: `run <name> <bme flags>`
+run() {
+    name=$1
+    shift
+
+    start=$(date +%s.%N)
+    "$BME" -i "$WORKDIR/$program.bm" "$@" > "$WORKDIR/$program.$name.out"
+    end=$(date +%s.%N)
+
+    awk -v name="$program $name" -v start="$start" -v end="$end" -v count="$COUNT" 'BEGIN {
+        elapsed = end - start
+        printf "%s: %.3fs, %.0f lines/s\n", name, elapsed, count / elapsed
+    }'
+}
+
+bench() {
+    program=$1
+    shift
+
+    generate "$@" > "$WORKDIR/$program.basm"
+    "$BASM" "$WORKDIR/$program.basm" "$WORKDIR/$program.bm" > /dev/null
+
+    run buffered
+    run unbuffered -u
+    cmp "$WORKDIR/$program.buffered.out" "$WORKDIR/$program.unbuffered.out"
+}
+
+bench fib_u64 0 1 plusi print_u64
+bench fib_f64 0.0 1.0 "plusf
+    push 0.6180339887498949
+    multf" print_f64
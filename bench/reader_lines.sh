@@ -0,0 +1,71 @@
+#!/bin/sh
+# Measures how fast a program can split its stdin into lines with the
+# reader natives, next to `wc -l` on the same input.
+#
+# Usage: ./bench/reader_lines.sh [lines]
+
+set -e
+
+LINES=${1:-2000000}
+BASM=${BASM:-./basm}
+BME=${BME:-./bme}
+WORKDIR=${TMPDIR:-/tmp}/reader_lines.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+awk -v lines="$LINES" 'BEGIN {
+    for (i = 0; i < lines; ++i) {
+        printf "%d the quick brown fox jumps over the lazy dog %d\n", i, i * 7
+    }
+}' > "$WORKDIR/input.txt"
+
+cat > "$WORKDIR/lines.basm" <<END
+%include "$PWD/examples/natives.hasm"
+   push 0
+   push 0
+   push 4096
+   push 524288
+   native reader_open
+   push 0
+next:
+   dup 1
+   push 10
+   native reader_split
+   swap 2
+   drop
+   drop
+   not
+   jmp_if done
+   push 1
+   plusi
+   jmp next
+done:
+   native print_u64
+   halt
+END
+"$BASM" "$WORKDIR/lines.basm" "$WORKDIR/lines.bm" > /dev/null
+
+size=$(wc -c < "$WORKDIR/input.txt")
+
+run() {
+    name=$1
+    shift
+
+    start=$(date +%s.%N)
+    lines=$("$@" < "$WORKDIR/input.txt")
+    end=$(date +%s.%N)
+
+    if [ "$lines" -ne "$LINES" ]; then
+        echo "$name: expected $LINES lines but got $lines" >&2
+        exit 1
+    fi
+
+    awk -v name="$name" -v start="$start" -v end="$end" -v size="$size" 'BEGIN {
+        elapsed = end - start
+        printf "%s: %.3fs, %.1f MB/s\n", name, elapsed, size / elapsed / 1000000
+    }'
+}
+
+run bme "$BME" -i "$WORKDIR/lines.bm"
+run wc wc -l
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Compares running the setup of a program every time against restoring
+# a snapshot that was taken right after it.
+#
+# Usage: ./bench/snapshot_startup.sh [rounds]
+#
+# The setup fills a table of 60000 words `rounds` times, then the
+# program takes the snapshot and prints one entry of the table.
+
+set -e
+
+ROUNDS=${1:-50}
+BASM=${BASM:-./basm}
+BME=${BME:-./bme}
+WORKDIR=${TMPDIR:-/tmp}/snapshot_startup.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+cat > "$WORKDIR/setup.basm" <<END
+%include "$PWD/examples/natives.hasm"
+%bind path "$WORKDIR/setup.bms"
+%bind TABLE 65536
+    push $ROUNDS
+round:
+    push 0
+fill:
+    dup 0
+    push 8
+    multi
+    push TABLE
+    plusi
+    dup 1
+    dup 0
+    multi
+    write64
+    push 1
+    plusi
+    dup 0
+    push 60000
+    eq
+    not
+    jmp_if fill
+    drop
+    push 1
+    minusi
+    dup 0
+    push 0
+    eq
+    not
+    jmp_if round
+    drop
+    push path
+    push $(printf '%s' "$WORKDIR/setup.bms" | wc -c)
+    native snapshot
+    drop
+    push TABLE
+    push 479992
+    plusi
+    read64
+    native print_u64
+    halt
+END
+"$BASM" "$WORKDIR/setup.basm" "$WORKDIR/setup.bm" > /dev/null
+
+# NOTE: `run <name> <bme flags>`
+run() {
+    name=$1
+    shift
+
+    start=$(date +%s.%N)
+    "$BME" "$@" > "$WORKDIR/$name.out"
+    end=$(date +%s.%N)
+
+    awk -v name="$name" -v start="$start" -v end="$end" 'BEGIN {
+        printf "%s: %.3fms\n", name, (end - start) * 1000
+    }'
+}
+
+run setup -i "$WORKDIR/setup.bm"
+run restore -r "$WORKDIR/setup.bms"
+cmp "$WORKDIR/setup.out" "$WORKDIR/restore.out"
+echo "snapshot: $(wc -c < "$WORKDIR/setup.bms") bytes"
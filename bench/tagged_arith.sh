@@ -0,0 +1,61 @@
+#!/bin/sh
+# Compares the arithmetic on tagged values against the raw integer one.
+#
+# Usage: ./bench/tagged_arith.sh [iterations]
+#
+# Both programs run the same loop that sums the counter into an
+# accumulator, one with plusi/minusi on raw integers and the other one
+# with plusv/minusv on NaN-boxed integers.
+
+set -e
+
+ITERATIONS=${1:-10000000}
+BASM=${BASM:-./basm}
+BME=${BME:-./bme}
+WORKDIR=${TMPDIR:-/tmp}/tagged_arith.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# NOTE: `generate <name> <plus> <minus> <box> <zero> <one>`
+generate() {
+    cat <<END
+    push 0
+    $4
+    push $ITERATIONS
+    $4
+loop:
+    swap 1
+    dup 1
+    $2
+    swap 1
+    push $6
+    $3
+    dup 0
+    push $5
+    eq
+    not
+    jmp_if loop
+    halt
+fallback:
+    halt
+END
+}
+
+run() {
+    generate "$@" > "$WORKDIR/$1.basm"
+    "$BASM" "$WORKDIR/$1.basm" "$WORKDIR/$1.bm" > /dev/null
+
+    start=$(date +%s.%N)
+    "$BME" -i "$WORKDIR/$1.bm"
+    end=$(date +%s.%N)
+
+    awk -v name="$1" -v start="$start" -v end="$end" -v iterations="$ITERATIONS" 'BEGIN {
+        elapsed = end - start
+        printf "%s: %.3fs, %.0f iterations/s\n", name, elapsed, iterations / elapsed
+    }'
+}
+
+run raw plusi minusi nop 0 1
+# NOTE: 0xFFF9 << 48 is the tag of the integers
+run tagged "plusv fallback" "minusv fallback" boxi 18444773748872577024 18444773748872577025
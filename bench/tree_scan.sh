@@ -0,0 +1,298 @@
+#!/bin/sh
+# Checks the exclib Tree against a plain array and measures the bulk load,
+# the lookups and the range scans of a big one.
+#
+# Usage: ./bench/tree_scan.sh [keys] [operations]
+#
+# The check runs random set/del/get/in/seek/next and load_tree on a small
+# key space against the array and fails on the first difference. The bench
+# then fills a tree of `keys` keys once with set_tree in a random order and
+# once with load_tree, and runs `operations` lookups and 100 key scans on
+# both. Where the kernel lets us, the cache references and misses of the
+# host are counted for every phase.
+
+set -e
+
+KEYS=${1:-1000000}
+OPERATIONS=${2:-1000000}
+CC=${CC:-cc}
+WORKDIR=${TMPDIR:-/tmp}/tree_scan.$$
+
+mkdir -p "$WORKDIR"
+trap 'rm -rf "$WORKDIR"' EXIT
+
+cat > "$WORKDIR/tree_scan.c" <<'END'
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <linux/perf_event.h>
+#endif
+
+#include "tree.h"
+
+#define CHECK_KEYS 512
+#define CHECK_ROUNDS 200000
+#define SCAN 100
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "FAILED: %s at round %ld\n", #cond, round);   \
+            exit(1);                                                       \
+        }                                                                  \
+    } while (0)
+
+static unsigned next(unsigned *state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+static long round = 0;
+
+// NOTE: the tree has to hold exactly the keys of `present` with their
+// values, a scan from any key has to meet them in order
+static void check_tree(Tree *tree, const _Bool *present, const double *values,
+                       TreeCursor *cursor, unsigned *state)
+{
+    size_t size = 0;
+    for (int key = 0; key < CHECK_KEYS; ++key) {
+        size += present[key];
+    }
+    CHECK(size_tree(tree) == size);
+
+    int from = (int) (next(state) % (CHECK_KEYS + 1));
+    seek_tree_cursor(cursor, decimal(from));
+    value_t key;
+    value_t value;
+    for (int expected = from; ; ++expected) {
+        while (expected < CHECK_KEYS && !present[expected]) {
+            expected += 1;
+        }
+        if (expected == CHECK_KEYS) {
+            CHECK(!next_tree_cursor(cursor, &key, &value));
+            break;
+        }
+        CHECK(next_tree_cursor(cursor, &key, &value));
+        CHECK(key.decimal == expected);
+        CHECK(value.real == values[expected]);
+    }
+}
+
+static void check(void)
+{
+    static _Bool present[CHECK_KEYS];
+    static double values[CHECK_KEYS];
+    static void *keys[CHECK_KEYS];
+    static void *loaded[CHECK_KEYS];
+    unsigned state = 69;
+
+    Tree *tree = new_tree(DECIMAL_TYPE, REAL_TYPE);
+    TreeCursor *cursor = new_tree_cursor(tree);
+    for (round = 0; round < CHECK_ROUNDS; ++round) {
+        const int key = (int) (next(&state) % CHECK_KEYS);
+        switch (next(&state) % 8) {
+        case 0:
+        case 1:
+        case 2:
+            values[key] = (double) round + 0.5;
+            present[key] = 1;
+            set_tree(tree, decimal(key), real(values[key]));
+            break;
+        case 3:
+        case 4:
+            del_tree(tree, decimal(key));
+            present[key] = 0;
+            break;
+        case 5:
+            CHECK(in_tree(tree, decimal(key)) == present[key]);
+            if (present[key]) {
+                CHECK(get_tree(tree, decimal(key)).real == values[key]);
+            }
+            break;
+        case 6:
+            check_tree(tree, present, values, cursor, &state);
+            break;
+        case 7:
+            // NOTE: the same contents bulk loaded into a fresh tree
+            if (next(&state) % 64 == 0) {
+                size_t size = 0;
+                for (int k = 0; k < CHECK_KEYS; ++k) {
+                    if (present[k]) {
+                        keys[size] = decimal(k);
+                        loaded[size] = real(values[k]);
+                        size += 1;
+                    }
+                }
+                free_tree_cursor(cursor);
+                free_tree(tree);
+                tree = new_tree(DECIMAL_TYPE, REAL_TYPE);
+                CHECK(load_tree(tree, keys, loaded, size) == 0);
+                CHECK(size == 0 || load_tree(tree, keys, loaded, size) == -1);
+                cursor = new_tree_cursor(tree);
+            }
+            break;
+        }
+    }
+    check_tree(tree, present, values, cursor, &state);
+
+    // NOTE: the keys have to be strictly ascending
+    Tree *unsorted = new_tree(DECIMAL_TYPE, REAL_TYPE);
+    void *bad[] = {decimal(1), decimal(3), decimal(2)};
+    void *bad_values[] = {real(1.0), real(3.0), real(2.0)};
+    CHECK(load_tree(unsorted, bad, bad_values, 3) == -1);
+    free_tree(unsorted);
+
+    free_tree_cursor(cursor);
+    free_tree(tree);
+    printf("check: OK\n");
+}
+
+typedef struct {
+    int fds[2];
+    struct timespec started;
+} Phase;
+
+static void phase_start(Phase *phase)
+{
+    phase->fds[0] = phase->fds[1] = -1;
+#ifdef __linux__
+    static const uint64_t configs[2] = {
+        PERF_COUNT_HW_CACHE_REFERENCES,
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+    for (size_t i = 0; i < 2; ++i) {
+        struct perf_event_attr attr = {0};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        phase->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &phase->started);
+}
+
+static void phase_stop(Phase *phase, const char *name, long operations)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed = (double) (now.tv_sec - phase->started.tv_sec)
+        + (double) (now.tv_nsec - phase->started.tv_nsec) * 1e-9;
+
+    uint64_t counts[2] = {0};
+    _Bool counted = 1;
+    for (size_t i = 0; i < 2; ++i) {
+        if (phase->fds[i] < 0 || read(phase->fds[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i])) {
+            counted = 0;
+        }
+        if (phase->fds[i] >= 0) {
+            close(phase->fds[i]);
+        }
+    }
+
+    printf("%-16s %8.1fns/op", name, elapsed * 1e9 / (double) operations);
+    if (counted && counts[0] > 0) {
+        printf("  %6.2f cache misses/op, %5.1f%% of the references hit",
+               (double) counts[1] / (double) operations,
+               100.0 - (double) counts[1] * 100.0 / (double) counts[0]);
+    }
+    printf("\n");
+}
+
+static void bench(Tree *tree, const char *name, long keys, long operations)
+{
+    char label[64];
+    unsigned state = 420;
+    Phase phase;
+
+    snprintf(label, sizeof(label), "%s get", name);
+    double sum = 0.0;
+    phase_start(&phase);
+    for (long i = 0; i < operations; ++i) {
+        sum += get_tree(tree, decimal((int32_t) (next(&state) % (unsigned) keys))).real;
+    }
+    phase_stop(&phase, label, operations);
+
+    snprintf(label, sizeof(label), "%s scan", name);
+    TreeCursor *cursor = new_tree_cursor(tree);
+    const long scans = operations / SCAN;
+    phase_start(&phase);
+    for (long i = 0; i < scans; ++i) {
+        seek_tree_cursor(cursor, decimal((int32_t) (next(&state) % (unsigned) keys)));
+        value_t value;
+        for (int j = 0; j < SCAN && next_tree_cursor(cursor, NULL, &value); ++j) {
+            sum += value.real;
+        }
+    }
+    phase_stop(&phase, label, scans * SCAN);
+    free_tree_cursor(cursor);
+
+    // NOTE: keeps the lookups from being thrown away
+    if (sum < 0.0) {
+        printf("%f\n", sum);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    const long keys = atol(argv[1]);
+    const long operations = atol(argv[2]);
+
+    check();
+
+    void **sorted = malloc(sizeof(void*) * (size_t) keys);
+    void **values = malloc(sizeof(void*) * (size_t) keys);
+    int32_t *shuffled = malloc(sizeof(int32_t) * (size_t) keys);
+    for (long i = 0; i < keys; ++i) {
+        sorted[i] = decimal((int32_t) i);
+        values[i] = real((double) i);
+        shuffled[i] = (int32_t) i;
+    }
+    unsigned state = 1337;
+    for (long i = keys - 1; i > 0; --i) {
+        const long j = (long) (next(&state) % (unsigned) (i + 1));
+        const int32_t t = shuffled[i];
+        shuffled[i] = shuffled[j];
+        shuffled[j] = t;
+    }
+
+    Phase phase;
+    Tree *inserted = new_tree(DECIMAL_TYPE, REAL_TYPE);
+    phase_start(&phase);
+    for (long i = 0; i < keys; ++i) {
+        set_tree(inserted, decimal(shuffled[i]), real((double) shuffled[i]));
+    }
+    phase_stop(&phase, "set_tree", keys);
+
+    Tree *loaded = new_tree(DECIMAL_TYPE, REAL_TYPE);
+    phase_start(&phase);
+    load_tree(loaded, sorted, values, (size_t) keys);
+    phase_stop(&phase, "load_tree", keys);
+
+    bench(inserted, "inserted", keys, operations);
+    bench(loaded, "loaded", keys, operations);
+
+    free_tree(inserted);
+    free_tree(loaded);
+    free(shuffled);
+    free(values);
+    free(sorted);
+    return 0;
+}
+END
+
+"$CC" -O2 -std=c11 -I./src/exclib -o "$WORKDIR/tree_scan" \
+    "$WORKDIR/tree_scan.c" ./src/exclib/tree.c ./src/exclib/type.c
+
+"$WORKDIR/tree_scan" "$KEYS" "$OPERATIONS"
@@ -0,0 +1,135 @@
+// An embedder of libbm, run by `make check` on examples/libbm_host.basm:
+// several VMs on threads share one cache, a corrupt program has to come
+// back as an error and a budget has to stop the program where it is.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "libbm.h"
+
+#define THREADS 4
+
+#define CHECK(cond)                                                  \
+    do {                                                             \
+        if (!(cond)) {                                               \
+            fprintf(stderr, "%s:%d: FAILED: %s\n",                   \
+                    __FILE__, __LINE__, #cond);                      \
+            exit(1);                                                 \
+        }                                                            \
+    } while (0)
+
+static const char *program_path = NULL;
+static Libbm_Cache *cache = NULL;
+
+static Bm *guest_create(uint64_t id)
+{
+    Bm *bm = libbm_create();
+    CHECK(bm != NULL);
+    CHECK(libbm_push_native(bm, libbm_cache_get) == ERR_OK);
+    CHECK(libbm_push_native(bm, libbm_cache_set) == ERR_OK);
+    CHECK(libbm_push_native(bm, libbm_cache_del) == ERR_OK);
+    CHECK(libbm_load_file(bm, program_path) == ERR_OK);
+    CHECK(libbm_cache_join(bm, cache) == ERR_OK);
+    CHECK(libbm_stack_push(bm, id) == ERR_OK);
+    return bm;
+}
+
+// NOTE: what the guest leaves on the stack, id to the 8th power
+static void guest_check_result(Bm *bm, uint64_t id)
+{
+    uint64_t result = 0;
+    CHECK(libbm_halted(bm));
+    CHECK(libbm_stack_size(bm) == 1);
+    CHECK(libbm_stack_peek(bm, 0, &result) == ERR_OK);
+    CHECK(result == id * id * id * id * id * id * id * id);
+
+    // NOTE: the only call_indirect of the guest goes to `square` 3 times
+    size_t indirect = 0;
+    for (uint64_t ip = 0; ip < 1024; ++ip) {
+        uint64_t target = 0, hits = 0, misses = 0;
+        if (libbm_inline_cache(bm, ip, &target, &hits, &misses) == ERR_OK) {
+            CHECK(hits == 2 && misses == 1);
+            indirect += 1;
+        }
+    }
+    CHECK(indirect == 1);
+}
+
+static int guest_run(void *arg)
+{
+    const uint64_t id = (uint64_t) (size_t) arg;
+    Bm *bm = guest_create(id);
+    CHECK(libbm_execute(bm, -1) == ERR_OK);
+    guest_check_result(bm, id);
+    libbm_destroy(bm);
+    return 0;
+}
+
+static void check_corrupt(void)
+{
+    Bm *bm = libbm_create();
+    CHECK(bm != NULL);
+
+    CHECK(libbm_load_buffer(bm, "corrupt", 7) == ERR_INVALID_FILE);
+
+    FILE *f = fopen(program_path, "rb");
+    CHECK(f != NULL);
+    static uint8_t data[64 * 1024];
+    const size_t size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    CHECK(size > 0 && size < sizeof(data));
+
+    // NOTE: the program cut in the middle of its sections
+    CHECK(libbm_load_buffer(bm, data, size - 1) == ERR_INVALID_FILE);
+    // NOTE: the magic of the file is broken
+    data[0] ^= 0xFF;
+    CHECK(libbm_load_buffer(bm, data, size) == ERR_INVALID_FILE);
+
+    libbm_destroy(bm);
+}
+
+static void check_budget(void)
+{
+    Bm *bm = guest_create(3);
+
+    CHECK(libbm_execute(bm, 100) == ERR_OK);
+    CHECK(!libbm_halted(bm));
+    CHECK(libbm_ip(bm) > 0);
+
+    size_t rounds = 1;
+    while (!libbm_halted(bm)) {
+        CHECK(libbm_execute(bm, 1000) == ERR_OK);
+        rounds += 1;
+    }
+    CHECK(rounds > 2);
+    guest_check_result(bm, 3);
+
+    libbm_destroy(bm);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <libbm_host.bm>\n", argv[0]);
+        return 1;
+    }
+    program_path = argv[1];
+
+    cache = libbm_cache_create();
+    CHECK(cache != NULL);
+
+    check_corrupt();
+    check_budget();
+
+    thrd_t threads[THREADS];
+    for (size_t i = 0; i < THREADS; ++i) {
+        CHECK(thrd_create(&threads[i], guest_run, (void *) (i + 1)) == thrd_success);
+    }
+    for (size_t i = 0; i < THREADS; ++i) {
+        CHECK(thrd_join(threads[i], NULL) == thrd_success);
+    }
+
+    libbm_cache_destroy(cache);
+    return 0;
+}
@@ -14,29 +14,109 @@ static char *shift(int *argc, char ***argv)
 
 static void usage(FILE *stream, const char *program)
 {
-    fprintf(stream, "Usage: %s <input.basm> <output.bm>\n", program);
+    fprintf(stream, "Usage: %s [-O|-O2] [-v] [-c] [-I <include-path>] [-cache <dir>] [-profile <input.bmp>] <input.basm> <output.bm|output.bmo>\n", program);
 }
 
 int main(int argc, char **argv)
 {
     const char *program = shift(&argc, &argv);
+    const char *input_file_path = NULL;
+    const char *output_file_path = NULL;
+    const char *profile_file_path = NULL;
+    int optimize = 0;
+    bool verbose = false;
 
-    if (argc == 0) {
+    while (argc > 0) {
+        const char *arg = shift(&argc, &argv);
+
+        if (strcmp(arg, "-O") == 0) {
+            optimize = 1;
+        } else if (strcmp(arg, "-O2") == 0) {
+            optimize = 2;
+        } else if (strcmp(arg, "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(arg, "-c") == 0) {
+            basm.relocatable = true;
+        } else if (strcmp(arg, "-I") == 0 ||
+                   strcmp(arg, "-cache") == 0 ||
+                   strcmp(arg, "-profile") == 0) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: No argument is provided for flag `%s`\n", arg);
+                exit(1);
+            }
+
+            if (strcmp(arg, "-I") == 0) {
+                if (basm.include_paths_size >= BASM_INCLUDE_PATHS_CAPACITY) {
+                    fprintf(stderr, "ERROR: Too many include paths\n");
+                    exit(1);
+                }
+                basm_add_include_path(&basm, shift(&argc, &argv));
+            } else if (strcmp(arg, "-cache") == 0) {
+                basm.cache_dir = shift(&argc, &argv);
+            } else {
+                profile_file_path = shift(&argc, &argv);
+            }
+        } else if (strcmp(arg, "-h") == 0) {
+            usage(stdout, program);
+            exit(0);
+        } else if (input_file_path == NULL) {
+            input_file_path = arg;
+        } else if (output_file_path == NULL) {
+            output_file_path = arg;
+        } else {
+            usage(stderr, program);
+            fprintf(stderr, "ERROR: unexpected argument `%s`\n", arg);
+            exit(1);
+        }
+    }
+
+    if (input_file_path == NULL) {
         usage(stderr, program);
         fprintf(stderr, "ERROR: expected input\n");
         exit(1);
     }
-    const char *input_file_path = shift(&argc, &argv);
 
-    if (argc == 0) {
+    if (output_file_path == NULL) {
         usage(stderr, program);
         fprintf(stderr, "ERROR: expected output\n");
         exit(1);
     }
-    const char *output_file_path = shift(&argc, &argv);
 
     basm_translate_source(&basm, sv_from_cstr(input_file_path), 0);
-    basm_save_to_file(&basm, output_file_path);
+
+    if (optimize > 0) {
+        const uint64_t original_size = basm.program_size;
+        basm_optimize(&basm, optimize);
+        if (verbose) {
+            fprintf(stderr, "INFO: optimizer: %" PRIu64 " -> %" PRIu64 " instructions\n",
+                    original_size, basm.program_size);
+        }
+    }
+
+    // NOTE: the profile is recorded by `bme -p` on the program that was
+    // built with the same flags, but without the profile
+    if (profile_file_path != NULL) {
+        basm_layout(&basm, basm_load_profile(&basm, profile_file_path));
+    }
+
+    if (basm.relocatable) {
+        basm_save_object_to_file(&basm, output_file_path);
+    } else {
+        basm_save_to_file(&basm, output_file_path);
+    }
+
+    if (verbose) {
+        fprintf(stderr, "INFO: %" PRIu64 " instructions, %zu bytes of memory\n",
+                basm.program_size, basm.memory_size);
+        fprintf(stderr, "INFO: peak memory usage %zu bytes\n", basm_memory_usage(&basm));
+        if (basm.cache_dir != NULL) {
+            fprintf(stderr, "INFO: include cache: %zu hits, %zu misses\n",
+                    basm.cache_hits, basm.cache_misses);
+        }
+    }
+
+    basm_free(&basm);
 
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,12 @@
 #ifndef BM_H_
 #define BM_H_
 
+// NOTE: sigaction() and sigsetjmp() of the guarded memory and mkstemp()
+// of the caches are POSIX
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +16,37 @@
 #include <errno.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <time.h>
+
+// NOTE: the output, the windows, the readers, the snapshots and the
+// guarded memory of the VM need a POSIX host. Without one bm.h is still
+// the whole assembler and disassembler, the output goes through stdio
+// and the rest fails with ERR_ILLEGAL_OPERAND.
+#if !defined(BM_POSIX) && (defined(__unix__) || defined(__APPLE__))
+#  define BM_POSIX
+#endif
+
+#if defined(BM_GUARD_MEMORY) && !defined(BM_POSIX)
+#  error "BM_GUARD_MEMORY needs a POSIX host"
+#endif
+
+#ifdef BM_POSIX
+#  include <unistd.h>
+#  include <sys/uio.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <pthread.h>
+#endif
+#ifdef BM_GUARD_MEMORY
+#  include <signal.h>
+#  include <setjmp.h>
+#endif
+
+#include "./libbm.h"
+#ifdef BM_CACHE
+#  include "./exclib/conctab.h"
+#endif
 
 #if defined(__GNUC__) || defined(__clang__)
 #  define PACKED __attribute__((packed))
@@ -21,14 +58,47 @@
 #define BM_STACK_CAPACITY 1024
 #define BM_PROGRAM_CAPACITY 1024
 #define BM_NATIVES_CAPACITY 1024
-#define BM_MEMORY_CAPACITY (640 * 1000)
+#define BM_MEMORY_CAPACITY (640 * 1024)
+#define BM_MEMORY_ALIGNMENT 4096
+#define BM_WINDOWS_CAPACITY 16
+#define BM_RETURNS_CAPACITY 1024
+#define BM_FRAMES_CAPACITY 1024
+#define BM_LOCALS_CAPACITY 4096
+
+// NOTE: with BM_GUARD_MEMORY the memory is a 4GiB reservation of the
+// address space where only the first BM_MEMORY_CAPACITY bytes are
+// accessible. read*/write* truncate the address to 32 bits and do not
+// check it at all, an access past the end faults on the inaccessible
+// pages right after it and the SIGSEGV handler turns it into
+// ERR_ILLEGAL_MEMORY_ACCESS. The addresses wrap around at 4GiB.
+#ifdef BM_GUARD_MEMORY
+#  define BM_GUARD_RESERVED ((1ULL << 32) + BM_MEMORY_ALIGNMENT)
+#  define BM_MEMORY_ADDR(addr) ((Memory_Addr) (uint32_t) (addr))
+#  define BM_MEMORY_IN_BOUNDS(addr, size) true
+static_assert(BM_MEMORY_CAPACITY % BM_MEMORY_ALIGNMENT == 0,
+              "The guard pages have to start right at the end of the memory");
+#else
+#  define BM_MEMORY_ADDR(addr) (addr)
+#  define BM_MEMORY_IN_BOUNDS(addr, size) ((addr) < BM_MEMORY_CAPACITY - ((size) - 1))
+#endif
+#define BM_READERS_CAPACITY 16
 
-#define BASM_BINDINGS_CAPACITY 1024
-#define BASM_DEFERRED_OPERANDS_CAPACITY 1024
+#define BASM_BINDINGS_INIT_CAPACITY 1024
+#define BASM_DEFERRED_OPERANDS_INIT_CAPACITY 1024
+#define BASM_LITERAL_MAX_LENGTH 128
 #define BASM_COMMENT_SYMBOL ';'
 #define BASM_PP_SYMBOL '%'
 #define BASM_MAX_INCLUDE_LEVEL 69
-#define BASM_ARENA_CAPACITY (1000 * 1000 * 1000)
+#define BASM_INCLUDE_PATHS_CAPACITY 64
+#define BASM_UNIT_INIT_CAPACITY 256
+#define BASM_EXPORTS_INIT_CAPACITY 64
+#define BASM_ARENA_REGION_CAPACITY (64 * 1024)
+#define BASM_PROGRAM_INIT_CAPACITY 256
+#define BASM_MEMORY_INIT_CAPACITY 1024
+#define BASM_OPT_MAX_JUMP_THREADING 16
+#define BASM_OPT_INLINE_MAX_SIZE 16
+#define BASM_OPT_STACK_WINDOW 16
+#define INST_HASH_CAPACITY 256
 
 typedef struct {
     size_t count;
@@ -43,19 +113,8 @@ String_View sv_trim_right(String_View sv);
 String_View sv_trim(String_View sv);
 String_View sv_chop_by_delim(String_View *sv, char delim);
 bool sv_eq(String_View a, String_View b);
-
-typedef enum {
-    ERR_OK = 0,
-    ERR_STACK_OVERFLOW,
-    ERR_STACK_UNDERFLOW,
-    ERR_ILLEGAL_INST,
-    ERR_ILLEGAL_INST_ACCESS,
-    ERR_ILLEGAL_OPERAND,
-    ERR_ILLEGAL_MEMORY_ACCESS,
-    ERR_DIV_BY_ZERO,
-} Err;
-
-const char *err_as_cstr(Err err);
+uint64_t sv_hash(String_View sv);
+bool sv_parse_u64(String_View sv, uint64_t *output);
 
 // TODO(#38): comparison instruction set is not complete
 // TODO(#39): there is no operations for converting integer->float/float->interger
@@ -96,11 +155,34 @@ typedef enum {
     INST_WRITE16,
     INST_WRITE32,
     INST_WRITE64,
+    INST_TCALL,
+    INST_PLUSV,
+    INST_MINUSV,
+    INST_MULTV,
+    INST_DIVV,
+    INST_JMP_INT,
+    INST_JMP_FLOAT,
+    INST_JMP_REF,
+    INST_BOXI,
+    INST_BOXP,
+    INST_UNBOX,
+    INST_CALLF,
+    INST_RETF,
+    INST_ENTER,
+    INST_LEAVE,
+    INST_LOADL,
+    INST_STOREL,
+    INST_CALL_INDIRECT,
+    INST_JMP_TABLE,
     NUMBER_OF_INSTS,
 } Inst_Type;
 
 const char *inst_name(Inst_Type type);
 bool inst_has_operand(Inst_Type type);
+bool inst_has_addr_operand(Inst_Type type);
+// NOTE: the arithmetic on tagged values calls its operand on a type mismatch
+bool inst_is_value_arith(Inst_Type type);
+bool inst_is_type_test(Inst_Type type);
 bool inst_by_name(String_View name, Inst_Type *output);
 
 typedef uint64_t Inst_Addr;
@@ -126,31 +208,326 @@ typedef struct {
     Word operand;
 } Inst;
 
-typedef struct Bm Bm;
+// NOTE: the guest heap lives in the VM memory right after the memory
+// section of the program. Every block is preceded by an 8 byte header
+// with the capacity of the block and the flags below. Small blocks are
+// rounded up to one of the size classes and recycled through a free list
+// per class. Large blocks are kept in a single address ordered free list
+// and coalesced with their free neighbours. Free lists are linked through
+// the first 8 bytes of the blocks themselves, 0 terminates them.
+#define BM_HEAP_SIZE_CLASSES 12
+#define BM_HEAP_HEADER_SIZE 8
+#define BM_HEAP_ALIGNMENT 8
+#define BM_HEAP_USED 1
+#define BM_HEAP_LARGE 2
+#define BM_HEAP_FLAGS (BM_HEAP_ALIGNMENT - 1)
+
+typedef struct {
+    Memory_Addr start;
+    Memory_Addr top;
+    Memory_Addr small[BM_HEAP_SIZE_CLASSES];
+    Memory_Addr large;
+} Bm_Heap;
+
+// NOTE: the garbage collected objects live in the guest heap as well.
+// A word is a reference to an object if its upper 16 bits are
+// BM_GC_REF_TAG, the lower 48 bits are the address of the object. The
+// collector is precise: every tagged word on the data stack, in the
+// locals of the frames, in the memory section of the program, in the
+// blocks of heap_alloc and inside of the objects is a reference and
+// nothing else is. Both collections
+// start from the same roots. The object is preceded by a header with its
+// size and flags. New objects are bump allocated in the nursery and promoted
+// to the old generation by the first minor collection they survive. The
+// old objects are linked into a list through the word before their
+// header and are collected by mark and sweep. `write64` of a reference
+// marks the card of the address it writes to, so a minor collection only
+// has to scan the dirty cards to find the old objects pointing into the
+// nursery.
+#define BM_GC_REF_TAG 0xFFFAULL
+#define BM_GC_REF_SHIFT 48
+#define BM_GC_ADDR_MASK ((1ULL << BM_GC_REF_SHIFT) - 1)
+#define BM_GC_NURSERY_SIZE (64 * 1024)
+#define BM_GC_CARD_SIZE 512
+#define BM_GC_GRAY_CAPACITY 1024
+#define BM_GC_MAJOR_THRESHOLD (128 * 1024)
+#define BM_GC_HEADER_SIZE 8
+#define BM_GC_MARK 1
+#define BM_GC_FORWARDED 2
+#define BM_GC_OLD 4
+#define BM_GC_FLAGS 7
+
+typedef struct {
+    bool ready;
+    Memory_Addr nursery;
+    Memory_Addr nursery_top;
+    Memory_Addr nursery_end;
+
+    Memory_Addr old;
+    uint64_t old_size;
+    uint64_t old_count;
+    uint64_t major_threshold;
+
+    // NOTE: one bit per word of the memory, set where an object starts.
+    // Tagged words that do not point at an object are not followed.
+    uint8_t objects[BM_MEMORY_CAPACITY / 64 + 1];
+    uint8_t cards[BM_MEMORY_CAPACITY / BM_GC_CARD_SIZE + 1];
+
+    Memory_Addr gray[BM_GC_GRAY_CAPACITY];
+    size_t gray_size;
+    bool gray_overflow;
+
+    struct timespec started;
+    uint64_t allocated_objects;
+    uint64_t allocated_bytes;
+    uint64_t promoted_bytes;
+    uint64_t freed_bytes;
+    uint64_t minor_count;
+    uint64_t major_count;
+    uint64_t pause_total_ns;
+    uint64_t pause_max_ns;
+} Bm_Gc;
+
+#define BM_OUTPUT_CAPACITY (64 * 1024)
+// NOTE: the same numbers on every host, STDOUT_FILENO is POSIX
+#define BM_OUTPUT_STDOUT 1
+#define BM_OUTPUT_STDERR 2
+
+// NOTE: the natives print into this buffer instead of the stdio streams,
+// it is written out to `fd` when it fills up and when the program is done
+typedef struct {
+    // bm_output_init() was called, the loads keep the fd it set and go to
+    // the standard output otherwise
+    bool ready;
+    int fd;
+    // flushed after every piece of output, for the interactive programs
+    bool unbuffered;
+    size_t size;
+    char data[BM_OUTPUT_CAPACITY];
+} Bm_Output;
+
+// NOTE: a window maps a region of a host file right into the bm memory,
+// so read8..read64 go straight to the page cache. The windows have to
+// start at a page boundary of the host, the memory is aligned so that
+// the multiples of BM_MEMORY_ALIGNMENT are fine on the usual 4K pages.
+typedef enum {
+    // the file is opened read only, the writes to the window stay in the
+    // memory like with BM_WINDOW_PRIVATE
+    BM_WINDOW_READ = 0,
+    // the writes stay in the memory and never reach the file
+    BM_WINDOW_PRIVATE,
+    // the writes reach the file, bm_window_sync() waits for them
+    BM_WINDOW_SHARED,
+    BM_WINDOW_MODES_COUNT,
+} Bm_Window_Mode;
 
-typedef Err (*Bm_Native)(Bm*);
+typedef struct {
+    Memory_Addr addr;
+    // the mapped size rounded up to the pages, 0 when the slot is free
+    uint64_t size;
+    Bm_Window_Mode mode;
+} Bm_Window;
+
+// NOTE: a reader fills a buffer in the bm memory with big read(2) calls
+// and hands out the records in it as addresses, nothing is copied but
+// the unfinished record that is moved to the beginning of the buffer
+// before the next refill. A record longer than the buffer is cut at the
+// capacity of the buffer.
+typedef struct {
+    bool used;
+    bool eof;
+    int fd;
+    Memory_Addr buffer;
+    uint64_t capacity;
+    // the unread bytes are [buffer + begin, buffer + end)
+    uint64_t begin;
+    uint64_t end;
+} Bm_Reader;
+
+// NOTE: how bm_reader_split() ended the record it handed out
+typedef enum {
+    // the input is over, there is no record
+    BM_SPLIT_EOF = 0,
+    // the record ended with the delimiter
+    BM_SPLIT_DELIM,
+    // the record did not fit into the buffer and was cut at its capacity,
+    // the rest of it comes with the next split
+    BM_SPLIT_TRUNCATED,
+    // the last record of the input that came without the delimiter
+    BM_SPLIT_LAST,
+} Bm_Split_Status;
+
+// NOTE: the target that an indirect instruction went to the last time.
+// The interpreter only keeps it up to date, the engines that compile the
+// program may speculate that the instruction goes there again and check
+// the actual target against it. A site that changes its target all the
+// time has a lot of misses and should not be speculated on.
+typedef struct {
+    Inst_Addr target;
+    uint64_t hits;
+    uint64_t misses;
+} Bm_Inline_Cache;
+
+// NOTE: the tagged values NaN-box everything into a single Word. A double
+// is stored as is, except that every NaN is turned into the canonical one.
+// The rest of the values hide in the NaN space that is left: their upper
+// 16 bits are a tag and the lower 48 bits are the payload. The references
+// of the garbage collector are tagged values as well.
+#define BM_VALUE_TAG_SHIFT 48
+#define BM_VALUE_PAYLOAD_MASK ((1ULL << BM_VALUE_TAG_SHIFT) - 1)
+#define BM_VALUE_TAG_INT 0xFFF9ULL
+#define BM_VALUE_TAG_REF BM_GC_REF_TAG
+#define BM_VALUE_TAG_PTR 0xFFFBULL
+#define BM_VALUE_TAG_IMM 0xFFFCULL
+#define BM_VALUE_CANONICAL_NAN 0x7FF8000000000000ULL
+#define BM_VALUE_INT_MIN (-(1LL << 47))
+#define BM_VALUE_INT_MAX ((1LL << 47) - 1)
+#define BM_VALUE_NIL   (BM_VALUE_TAG_IMM << BM_VALUE_TAG_SHIFT)
+#define BM_VALUE_FALSE (BM_VALUE_NIL | 1)
+#define BM_VALUE_TRUE  (BM_VALUE_NIL | 2)
+
+// NOTE: integers that do not fit into 48 bits become doubles
+Word bm_value_int(int64_t i);
+Word bm_value_float(double f);
+Word bm_value_ptr(Memory_Addr addr);
+uint64_t bm_value_tag(Word value);
+bool bm_value_is_float(Word value);
+int64_t bm_value_as_int(Word value);
+void bm_value_print(FILE *stream, Word value);
 
 struct Bm {
     Word stack[BM_STACK_CAPACITY];
     uint64_t stack_size;
 
+    // NOTE: `callf` and `retf` keep the return addresses here instead of
+    // the stack. `enter` starts a frame of locals on top of `locals` and
+    // remembers where it begins in `frames`, `loadl` and `storel` address
+    // the locals of the innermost frame.
+    Inst_Addr returns[BM_RETURNS_CAPACITY];
+    uint64_t returns_size;
+    uint64_t frames[BM_FRAMES_CAPACITY];
+    uint64_t frames_size;
+    Word locals[BM_LOCALS_CAPACITY];
+    uint64_t locals_size;
+
     Inst program[BM_PROGRAM_CAPACITY];
     uint64_t program_size;
     Inst_Addr ip;
+    // NOTE: one per instruction, only the ones of `call_indirect` and
+    // `jmp_table` are ever used
+    Bm_Inline_Cache caches[BM_PROGRAM_CAPACITY];
 
     Bm_Native natives[BM_NATIVES_CAPACITY];
     size_t natives_size;
 
-    uint8_t memory[BM_MEMORY_CAPACITY];
+#ifdef BM_GUARD_MEMORY
+    uint8_t *memory;
+#else
+    _Alignas(BM_MEMORY_ALIGNMENT) uint8_t memory[BM_MEMORY_CAPACITY];
+#endif
+    Bm_Heap heap;
+    Bm_Gc gc;
+    Bm_Output output;
+    Bm_Window windows[BM_WINDOWS_CAPACITY];
+    Bm_Reader readers[BM_READERS_CAPACITY];
+
+    // NOTE: the NUL terminated copy of the last key, see bm_string_key()
+    char *key;
+    size_t key_capacity;
+    // NOTE: the handle of the VM on the shared cache, NULL until it joins
+    struct ConcTabThread *cache;
 
     bool halt;
 };
 
 Err bm_execute_inst(Bm *bm);
 Err bm_execute_program(Bm *bm, int limit);
+// NOTE: executes at most `*budget` instructions and takes the executed
+// ones off of it. A fault of the guarded memory leaves it as it was.
+Err bm_execute_budget(Bm *bm, uint64_t *budget);
 void bm_push_native(Bm *bm, Bm_Native native);
 void bm_dump_stack(FILE *stream, const Bm *bm);
+// NOTE: reports the errors and exits, for the tools
 void bm_load_program_from_file(Bm *bm, const char *file_path);
+// NOTE: see libbm_load_buffer()
+Err bm_load_program_from_memory(Bm *bm, const void *data, size_t size);
+// NOTE: does nothing unless the memory is guarded, then it reserves the
+// memory and installs the SIGSEGV handler. Loading a program calls it on
+// its own.
+Err bm_memory_init(Bm *bm);
+// Unmaps the windows, closes the readers and gives the guarded memory back
+void bm_release(Bm *bm);
+
+// Copies a string of the bm memory into a NUL terminated key of the exclib
+// tables. The key belongs to the VM and stays valid until the next call.
+Err bm_string_key(Bm *bm, Memory_Addr addr, uint64_t count, void **key);
+
+#ifdef BM_CACHE
+// NOTE: the cache of the natives is shared by all the VMs of the process.
+// Every VM joins it on a handle of its own, so the VMs may run on different
+// threads, and leaves it in bm_release(). The keys are strings of the bm
+// memory, the values are whole words.
+Err bm_cache_join(Bm *bm, ConcTab *cache);
+// NOTE: `addr count -> value`
+Err bm_cache_get(Bm *bm);
+// NOTE: `value addr count ->`
+Err bm_cache_set(Bm *bm);
+// NOTE: `addr count ->`
+Err bm_cache_del(Bm *bm);
+#endif
+
+void bm_heap_init(Bm *bm, Memory_Addr start);
+// NOTE: the heap functions return 0 as the address when the heap is
+// exhausted, the same way malloc() returns NULL
+Err bm_heap_alloc(Bm *bm, uint64_t size, Memory_Addr *output);
+Err bm_heap_free(Bm *bm, Memory_Addr addr);
+Err bm_heap_realloc(Bm *bm, Memory_Addr addr, uint64_t size, Memory_Addr *output);
+
+// NOTE: allocates a zeroed object of `size` bytes and returns a tagged
+// reference to it, collecting garbage when the nursery is full
+Err bm_gc_alloc(Bm *bm, uint64_t size, Word *output);
+Err bm_gc_collect(Bm *bm);
+void bm_gc_dump_stats(FILE *stream, const Bm *bm);
+
+// NOTE: drops whatever is buffered, flush it first
+void bm_output_init(Bm *bm, int fd, bool unbuffered);
+// NOTE: writes out what the previous program left in the buffer before a
+// new one is loaded, the output stays where it was
+Err bm_output_restart(Bm *bm);
+// always false without POSIX
+bool bm_output_is_terminal(int fd);
+Err bm_output_flush(Bm *bm);
+Err bm_output_write(Bm *bm, const void *data, size_t size);
+Err bm_output_u64(Bm *bm, uint64_t x);
+Err bm_output_i64(Bm *bm, int64_t x);
+// NOTE: prints exactly what printf("%lf") would
+Err bm_output_f64(Bm *bm, double x);
+// the same as bm_value_print() but into the output
+Err bm_output_value(Bm *bm, Word value);
+
+// NOTE: maps `size` bytes of the file starting at `offset` to `addr`. The
+// window is cut at the end of the file and `mapped` is the amount of the
+// bytes that made it, 0 when the file could not be mapped at all (errno
+// tells why). The bytes of the last page past the end of the file are 0.
+Err bm_window_map(Bm *bm, Memory_Addr addr, const char *file_path,
+                  uint64_t offset, uint64_t size, Bm_Window_Mode mode,
+                  uint64_t *mapped);
+Err bm_window_sync(Bm *bm, Memory_Addr addr);
+// the memory under the window is zeroed
+Err bm_window_unmap(Bm *bm, Memory_Addr addr);
+
+// NOTE: the reader takes over the fd and closes it in bm_reader_close().
+// The readers are numbered from 1 so 0 is never a valid one.
+Err bm_reader_open(Bm *bm, int fd, Memory_Addr buffer, uint64_t capacity, uint64_t *reader);
+// NOTE: finds the next record that ends with `delim`, the delimiter is
+// not a part of it. `status` tells how the record ended and is
+// BM_SPLIT_EOF once the input is over.
+Err bm_reader_split(Bm *bm, uint64_t reader, uint8_t delim,
+                    Memory_Addr *addr, uint64_t *count, Bm_Split_Status *status);
+// NOTE: all of the bytes that are buffered, refilling the buffer if there
+// are none. `count` is 0 once the input is over.
+Err bm_reader_read(Bm *bm, uint64_t reader, Memory_Addr *addr, uint64_t *count);
+Err bm_reader_close(Bm *bm, uint64_t reader);
 
 #define BM_FILE_MAGIC 0x4D42
 #define BM_FILE_VERSION 1
@@ -163,46 +540,314 @@ typedef struct {
     uint64_t memory_capacity;
 } PACKED Bm_File_Meta;
 
+// NOTE: checks what can be checked without running the program: the
+// instructions exist, the jumps land inside of the program and the
+// natives are pushed. `at` is the first instruction that is wrong.
+Err bm_verify_program(const Bm *bm, Inst_Addr *at);
+// NOTE: loads and verifies the program, reports the errors and exits, for
+// the tools
+void bm_prepare_program(Bm *bm, const char *file_path);
+
+#define BM_SNAPSHOT_MAGIC 0x5342
+#define BM_SNAPSHOT_VERSION 2
+
+// NOTE: a snapshot is the whole state of the VM: the program, the ip, the
+// stack, the returns and the frames, the heap and the garbage collector, and the pages of the memory
+// that are not zero. The pages are stored at page aligned offsets of the
+// file, so restoring maps them instead of reading them. The windows are
+// saved as plain memory, the readers and whatever the natives keep in the
+// host memory (the blocks of `alloc`, the maps) are not saved at all.
+typedef struct {
+    uint16_t magic;
+    uint16_t version;
+    // NOTE: the sizes of the saved structures, the snapshot can only be
+    // restored by a VM that lays them out the same way
+    uint64_t layout;
+    uint64_t natives_size;
+    uint64_t program_size;
+    uint64_t ip;
+    uint8_t halt;
+    uint64_t stack_size;
+    uint64_t returns_size;
+    uint64_t frames_size;
+    uint64_t locals_size;
+    uint64_t extents_size;
+} PACKED Bm_Snapshot_Meta;
+
+// NOTE: `pages` pages of the memory starting at `page` are at `offset`
+typedef struct {
+    uint32_t page;
+    uint32_t pages;
+    uint64_t offset;
+} PACKED Bm_Snapshot_Extent;
+
+// NOTE: flushes the output first so it is not printed again by the
+// restored VM
+Err bm_snapshot_save(Bm *bm, const char *file_path);
+// NOTE: the natives have to be pushed already, the same amount of them
+Err bm_snapshot_restore(Bm *bm, const char *file_path);
+
+#define BM_PROFILE_MAGIC 0x5042
+#define BM_PROFILE_VERSION 1
+
+typedef struct {
+    uint16_t magic;
+    uint16_t version;
+    uint64_t program_size;
+    // NOTE: the profile only makes sense for exactly the same program
+    uint64_t program_hash;
+} PACKED Bm_Profile_Meta;
+
+// NOTE: how many times the instruction was executed and how many times
+// it transferred the control anywhere but the next instruction
+typedef struct {
+    uint64_t count;
+    uint64_t taken;
+} PACKED Bm_Profile_Entry;
+
+uint64_t bm_program_hash(const Inst *program, uint64_t program_size);
+void bm_save_profile_to_file(const Bm *bm, const Bm_Profile_Entry *profile, const char *file_path);
+
+typedef enum {
+    BINDING_CONST = 0,
+    BINDING_LABEL,
+    BINDING_MEMORY,
+} Binding_Kind;
+
 typedef struct {
+    Binding_Kind kind;
     String_View name;
     Word value;
 } Binding;
 
+// NOTE: https://en.wikipedia.org/wiki/Region-based_memory_management
+typedef struct Region Region;
+
+struct Region {
+    Region *next;
+    size_t size;
+    size_t capacity;
+    char data[];
+};
+
+typedef struct {
+    Region *first;
+    Region *last;
+    // NOTE: the amount of memory the regions occupy, which is the peak
+    // usage since regions are only given back by arena_free
+    size_t capacity;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+typedef struct {
+    uint64_t hash;
+    // NOTE: index of the binding plus one, 0 marks an empty slot
+    size_t index;
+} Binding_Slot;
+
 typedef struct {
     Inst_Addr addr;
     String_View name;
 } Deferred_Operand;
 
+typedef enum {
+    BASM_ENTRY_BIND = 0,
+    BASM_ENTRY_LABEL,
+    BASM_ENTRY_INCLUDE,
+    BASM_ENTRY_INST,
+    BASM_ENTRY_EXPORT,
+    BASM_ENTRY_TABLE,
+} Basm_Entry_Kind;
+
+typedef enum {
+    BASM_OPERAND_NONE = 0,
+    BASM_OPERAND_NUMBER,
+    BASM_OPERAND_STRING,
+    BASM_OPERAND_NAME,
+} Basm_Operand_Kind;
+
+// NOTE: a statement of a source file that is already parsed but not
+// yet placed in the program
+typedef struct {
+    Basm_Entry_Kind kind;
+    Basm_Operand_Kind operand_kind;
+    Inst_Type inst_type;
+    int line;
+    // NOTE: name of the binding, the label or the export, path of the include
+    String_View name;
+    // NOTE: contents of the string literal or name of the deferred operand,
+    // the labels of the jump table separated by spaces
+    String_View operand;
+    Word value;
+} Basm_Entry;
+
 typedef struct {
-    Binding bindings[BASM_BINDINGS_CAPACITY];
+    Basm_Entry *entries;
+    size_t size;
+    size_t capacity;
+} Basm_Unit;
+
+#define BM_OBJECT_MAGIC 0x4F42
+#define BM_OBJECT_VERSION 1
+
+typedef enum {
+    // NOTE: the operand is an instruction address of the object
+    RELOC_CODE = 0,
+    // NOTE: the operand is an address in the memory section of the object
+    RELOC_MEMORY,
+    // NOTE: the operand is the value of a symbol exported by another object
+    RELOC_SYMBOL,
+    // NOTE: the word at `addr` of the memory section is an instruction
+    // address of the object, an entry of a jump table
+    RELOC_TABLE,
+} Reloc_Kind;
+
+typedef enum {
+    SYMBOL_EXPORT = 0,
+    SYMBOL_IMPORT,
+} Symbol_Type;
+
+typedef struct {
+    uint16_t magic;
+    uint16_t version;
+    uint64_t program_size;
+    uint64_t memory_size;
+    uint64_t memory_capacity;
+    uint64_t symbols_size;
+    uint64_t relocs_size;
+    uint64_t strings_size;
+} PACKED Bm_Object_Meta;
+
+typedef struct {
+    uint8_t type;
+    // NOTE: Binding_Kind of the exported symbols
+    uint8_t kind;
+    uint64_t value;
+    uint64_t name_offset;
+    uint64_t name_count;
+} PACKED Bm_Object_Symbol;
+
+typedef struct {
+    uint8_t kind;
+    uint64_t addr;
+    // NOTE: index of the imported symbol for RELOC_SYMBOL
+    uint64_t symbol;
+} PACKED Bm_Object_Reloc;
+
+#define BASM_UNIT_MAGIC 0x554D
+#define BASM_UNIT_VERSION 3
+#define BASM_UNIT_CACHE_EXT ".bmu"
+
+typedef struct {
+    uint16_t magic;
+    uint16_t version;
+    // NOTE: the instruction set and the kinds of the entries the unit was
+    // parsed with, the parsed entries are just numbers without them
+    uint64_t layout;
+    uint64_t hash;
+    uint64_t entries_size;
+    uint64_t strings_size;
+} PACKED Basm_Unit_File_Meta;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t operand_kind;
+    uint16_t inst_type;
+    uint32_t line;
+    uint64_t value;
+    uint64_t name_offset;
+    uint64_t name_count;
+    uint64_t operand_offset;
+    uint64_t operand_count;
+} PACKED Basm_Unit_File_Entry;
+
+typedef struct {
+    Binding *bindings;
     size_t bindings_size;
+    size_t bindings_capacity;
+
+    // NOTE: open addressing hash index into `bindings`
+    Binding_Slot *bindings_slots;
+    size_t bindings_slots_capacity;
 
-    Deferred_Operand deferred_operands[BASM_DEFERRED_OPERANDS_CAPACITY];
+    Deferred_Operand *deferred_operands;
     size_t deferred_operands_size;
+    size_t deferred_operands_capacity;
 
-    Inst program[BM_PROGRAM_CAPACITY];
+    Inst *program;
     uint64_t program_size;
+    size_t program_allocated;
 
-    uint8_t memory[BM_MEMORY_CAPACITY];
+    uint8_t *memory;
     size_t memory_size;
     size_t memory_capacity;
+    size_t memory_allocated;
+
+    // NOTE: instructions with a string literal operand, which points
+    // into the memory section
+    Inst_Addr *memory_operands;
+    size_t memory_operands_size;
+    size_t memory_operands_capacity;
+
+    String_View *exports;
+    size_t exports_size;
+    size_t exports_capacity;
+
+    // NOTE: the entries of the jump tables, `addr` is the offset of the
+    // entry in the memory section and `name` is the label it jumps to
+    Deferred_Operand *table_slots;
+    size_t table_slots_size;
+    size_t table_slots_capacity;
+
+    // NOTE: names that are not bound anywhere are left to the linker
+    // instead of being reported as errors
+    bool relocatable;
+
+    const char *include_paths[BASM_INCLUDE_PATHS_CAPACITY];
+    size_t include_paths_size;
 
-    // NOTE: https://en.wikipedia.org/wiki/Region-based_memory_management
-    char arena[BASM_ARENA_CAPACITY];
-    size_t arena_size;
+    // NOTE: directory of the pre-parsed include units, NULL disables the cache
+    const char *cache_dir;
+    size_t cache_hits;
+    size_t cache_misses;
+
+    Arena arena;
 } Basm;
 
 void *basm_alloc(Basm *basm, size_t size);
+void basm_reset(Basm *basm);
+void basm_free(Basm *basm);
+size_t basm_memory_usage(const Basm *basm);
+Inst *basm_push_inst(Basm *basm, Inst_Type type);
 String_View basm_slurp_file(Basm *basm, String_View file_path);
+const Binding *basm_find_binding(const Basm *basm, String_View name);
 bool basm_resolve_binding(const Basm *basm, String_View name, Word *output);
-bool basm_bind_value(Basm *basm, String_View name, Word word);
+bool basm_bind_value(Basm *basm, String_View name, Word word, Binding_Kind kind);
 void basm_push_deferred_operand(Basm *basm, Inst_Addr addr, String_View name);
+void basm_push_memory_operand(Basm *basm, Inst_Addr addr);
+void basm_push_export(Basm *basm, String_View name);
+void basm_push_table_slot(Basm *basm, Memory_Addr addr, String_View name);
+bool basm_parse_number(String_View sv, Word *output);
 bool basm_translate_literal(Basm *basm, String_View sv, Word *output);
 void basm_save_to_file(Basm *basm, const char *output_file_path);
+void basm_save_object_to_file(Basm *basm, const char *output_file_path);
 Word basm_push_string_to_memory(Basm *basm, String_View sv);
 void basm_translate_source(Basm *basm,
                            String_View input_file_path,
                            size_t level);
+void basm_parse_unit(String_View input_file_path, String_View source, Basm_Unit *unit);
+void basm_translate_unit(Basm *basm, String_View input_file_path,
+                         const Basm_Unit *unit, size_t level);
+String_View basm_resolve_include(Basm *basm, String_View file_path);
+void basm_add_include_path(Basm *basm, const char *include_path);
+bool basm_load_unit(Basm *basm, const char *file_path, uint64_t hash, Basm_Unit *unit);
+void basm_save_unit(Basm *basm, const char *file_path, uint64_t hash, const Basm_Unit *unit);
+void basm_optimize(Basm *basm, int level);
+Bm_Profile_Entry *basm_load_profile(Basm *basm, const char *file_path);
+void basm_layout(Basm *basm, const Bm_Profile_Entry *profile);
 
 #endif  // BM_H_
 
@@ -268,22 +913,121 @@ bool inst_has_operand(Inst_Type type)
     case INST_WRITE16: return false;
     case INST_WRITE32: return false;
     case INST_WRITE64: return false;
+    case INST_TCALL:   return true;
+    case INST_PLUSV:   return true;
+    case INST_MINUSV:  return true;
+    case INST_MULTV:   return true;
+    case INST_DIVV:    return true;
+    case INST_JMP_INT: return true;
+    case INST_JMP_FLOAT: return true;
+    case INST_JMP_REF: return true;
+    case INST_BOXI:    return false;
+    case INST_BOXP:    return false;
+    case INST_UNBOX:   return false;
+    case INST_CALLF:   return true;
+    case INST_RETF:    return false;
+    case INST_ENTER:   return true;
+    case INST_LEAVE:   return false;
+    case INST_LOADL:   return true;
+    case INST_STOREL:  return true;
+    case INST_CALL_INDIRECT: return false;
+    case INST_JMP_TABLE: return true;
     case NUMBER_OF_INSTS:
     default: assert(false && "inst_has_operand: unreachable");
         exit(1);
     }
 }
 
-bool inst_by_name(String_View name, Inst_Type *output)
+bool inst_has_addr_operand(Inst_Type type)
+{
+    return type == INST_JMP || type == INST_JMP_IF || type == INST_CALL || type == INST_TCALL ||
+        type == INST_CALLF || inst_is_value_arith(type) || inst_is_type_test(type);
+}
+
+bool inst_is_value_arith(Inst_Type type)
+{
+    return type == INST_PLUSV || type == INST_MINUSV || type == INST_MULTV || type == INST_DIVV;
+}
+
+bool inst_is_type_test(Inst_Type type)
+{
+    return type == INST_JMP_INT || type == INST_JMP_FLOAT || type == INST_JMP_REF;
+}
+
+// NOTE: the mnemonics are looked up through a perfect hash. The seed is
+// searched once on the first lookup so the table keeps working when new
+// instructions are added. The lookups may come from many threads, the
+// hosts without POSIX only run the single threaded tools.
+#ifdef BM_POSIX
+static pthread_once_t inst_hash_once = PTHREAD_ONCE_INIT;
+#else
+static bool inst_hash_ready = false;
+#endif
+static uint64_t inst_hash_seed = 0;
+static uint8_t inst_hash_table[INST_HASH_CAPACITY];
+static String_View inst_hash_names[NUMBER_OF_INSTS];
+
+static uint64_t inst_hash(uint64_t seed, String_View name)
+{
+    uint64_t hash = seed ^ 14695981039346656037ULL;
+    for (size_t i = 0; i < name.count; ++i) {
+        hash ^= (uint8_t) name.data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash & (INST_HASH_CAPACITY - 1);
+}
+
+static void inst_hash_init(void)
 {
+    static_assert(NUMBER_OF_INSTS < UINT8_MAX, "inst_hash_table stores types in a byte");
+
     for (Inst_Type type = (Inst_Type) 0; type < NUMBER_OF_INSTS; type += 1) {
-        if (sv_eq(sv_from_cstr(inst_name(type)), name)) {
-            *output = type;
-            return true;
+        inst_hash_names[type] = sv_from_cstr(inst_name(type));
+    }
+
+    for (uint64_t seed = 0;; ++seed) {
+        memset(inst_hash_table, 0, sizeof(inst_hash_table));
+
+        bool collision = false;
+        for (Inst_Type type = (Inst_Type) 0; type < NUMBER_OF_INSTS && !collision; type += 1) {
+            uint64_t slot = inst_hash(seed, inst_hash_names[type]);
+            if (inst_hash_table[slot] != 0) {
+                collision = true;
+            } else {
+                inst_hash_table[slot] = (uint8_t) (type + 1);
+            }
+        }
+
+        if (!collision) {
+            inst_hash_seed = seed;
+            break;
         }
     }
+}
 
-    return false;
+bool inst_by_name(String_View name, Inst_Type *output)
+{
+#ifdef BM_POSIX
+    pthread_once(&inst_hash_once, inst_hash_init);
+#else
+    if (!inst_hash_ready) {
+        inst_hash_init();
+        inst_hash_ready = true;
+    }
+#endif
+
+    uint8_t entry = inst_hash_table[inst_hash(inst_hash_seed, name)];
+    if (entry == 0) {
+        return false;
+    }
+
+    Inst_Type type = (Inst_Type) (entry - 1);
+    if (!sv_eq(inst_hash_names[type], name)) {
+        return false;
+    }
+
+    *output = type;
+    return true;
 }
 
 const char *inst_name(Inst_Type type)
@@ -325,6 +1069,25 @@ const char *inst_name(Inst_Type type)
     case INST_WRITE16: return "write16";
     case INST_WRITE32: return "write32";
     case INST_WRITE64: return "write64";
+    case INST_TCALL:   return "tcall";
+    case INST_PLUSV:   return "plusv";
+    case INST_MINUSV:  return "minusv";
+    case INST_MULTV:   return "multv";
+    case INST_DIVV:    return "divv";
+    case INST_JMP_INT: return "jmp_int";
+    case INST_JMP_FLOAT: return "jmp_float";
+    case INST_JMP_REF: return "jmp_ref";
+    case INST_BOXI:    return "boxi";
+    case INST_BOXP:    return "boxp";
+    case INST_UNBOX:   return "unbox";
+    case INST_CALLF:   return "callf";
+    case INST_RETF:    return "retf";
+    case INST_ENTER:   return "enter";
+    case INST_LEAVE:   return "leave";
+    case INST_LOADL:   return "loadl";
+    case INST_STOREL:  return "storel";
+    case INST_CALL_INDIRECT: return "call_indirect";
+    case INST_JMP_TABLE: return "jmp_table";
     case NUMBER_OF_INSTS:
     default: assert(false && "inst_name: unreachable");
         exit(1);
@@ -350,29 +1113,267 @@ const char *err_as_cstr(Err err)
         return "ERR_DIV_BY_ZERO";
     case ERR_ILLEGAL_MEMORY_ACCESS:
         return "ERR_ILLEGAL_MEMORY_ACCESS";
-    default:
-        assert(false && "err_as_cstr: Unreachable");
-        exit(1);
+    case ERR_OUT_OF_MEMORY:
+        return "ERR_OUT_OF_MEMORY";
+    case ERR_OUTPUT:
+        return "ERR_OUTPUT";
+    case ERR_INPUT:
+        return "ERR_INPUT";
+    case ERR_INVALID_FILE:
+        return "ERR_INVALID_FILE";
+    }
+
+    // NOTE: libbm hands the codes to the embedders as plain ints, so any
+    // value may come back here
+    return "ERR_UNKNOWN";
+}
+
+#ifdef BM_GUARD_MEMORY
+// NOTE: where the SIGSEGV handler jumps to when the running VM touches
+// the inaccessible pages of its memory
+static _Thread_local sigjmp_buf *bm_guard_jump = NULL;
+static _Thread_local const Bm *bm_guard_bm = NULL;
+
+static void bm_guard_handler(int sig, siginfo_t *info, void *context)
+{
+    (void) context;
+
+    const uint8_t *addr = info->si_addr;
+    if (bm_guard_jump != NULL &&
+        addr >= bm_guard_bm->memory &&
+        addr < bm_guard_bm->memory + BM_GUARD_RESERVED) {
+        siglongjmp(*bm_guard_jump, 1);
+    }
+
+    // NOTE: not our fault, the access is retried without the handler and
+    // the process crashes the usual way
+    signal(sig, SIG_DFL);
+}
+
+// Executes either the program or a single instruction when `budget` is
+// NULL with the fault handler armed. The ip is left at the faulted
+// instruction.
+static Err bm_guard_run(Bm *bm, uint64_t *budget)
+{
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 0) != 0) {
+        bm_guard_jump = NULL;
+        bm_guard_bm = NULL;
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    bm_guard_jump = &jump;
+    bm_guard_bm = bm;
+    const Err err = budget != NULL ? bm_execute_budget(bm, budget) : bm_execute_inst(bm);
+    bm_guard_jump = NULL;
+    bm_guard_bm = NULL;
+
+    return err;
+}
+
+static pthread_once_t bm_guard_once = PTHREAD_ONCE_INIT;
+static bool bm_guard_installed = false;
+
+static void bm_guard_install(void)
+{
+    struct sigaction action = {0};
+    action.sa_sigaction = bm_guard_handler;
+    // NOTE: the handler never returns to the faulted access, it jumps
+    // out, so SIGSEGV must not stay blocked
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    bm_guard_installed = sigaction(SIGSEGV, &action, NULL) == 0;
+}
+
+Err bm_memory_init(Bm *bm)
+{
+    if (bm->memory != NULL) {
+        return ERR_OK;
+    }
+
+    pthread_once(&bm_guard_once, bm_guard_install);
+    if (!bm_guard_installed) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    // NOTE: a private mapping of /dev/zero is the anonymous memory of POSIX
+    const int fd = open("/dev/zero", O_RDWR);
+    if (fd < 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    void *memory = mmap(NULL, BM_GUARD_RESERVED, PROT_NONE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return ERR_OUT_OF_MEMORY;
     }
+
+    if (mprotect(memory, BM_MEMORY_CAPACITY, PROT_READ | PROT_WRITE) < 0) {
+        munmap(memory, BM_GUARD_RESERVED);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    bm->memory = memory;
+
+    return ERR_OK;
+}
+#else
+Err bm_memory_init(Bm *bm)
+{
+    (void) bm;
+    return ERR_OK;
 }
+#endif
 
 Err bm_execute_program(Bm *bm, int limit)
 {
-    while (limit != 0 && !bm->halt) {
-        Err err = bm_execute_inst(bm);
+    uint64_t budget = limit < 0 ? UINT64_MAX : (uint64_t) limit;
+    return bm_execute_budget(bm, &budget);
+}
+
+Err bm_execute_budget(Bm *bm, uint64_t *budget)
+{
+#ifdef BM_GUARD_MEMORY
+    if (bm_guard_jump == NULL) {
+        return bm_guard_run(bm, budget);
+    }
+#endif
+
+    // NOTE: a local copy, otherwise every instruction would have to store
+    // it back in case it is one of the words the instruction writes to
+    uint64_t left = *budget;
+    Err err = ERR_OK;
+    while (left > 0 && !bm->halt) {
+        err = bm_execute_inst(bm);
         if (err != ERR_OK) {
-            return err;
+            break;
         }
-        if (limit > 0) {
-            --limit;
+        left -= 1;
+    }
+    *budget = left;
+
+    return err;
+}
+
+Word bm_value_int(int64_t i)
+{
+    if (i < BM_VALUE_INT_MIN || i > BM_VALUE_INT_MAX) {
+        return bm_value_float((double) i);
+    }
+    return word_u64((BM_VALUE_TAG_INT << BM_VALUE_TAG_SHIFT) | ((uint64_t) i & BM_VALUE_PAYLOAD_MASK));
+}
+
+Word bm_value_float(double f)
+{
+    return f != f ? word_u64(BM_VALUE_CANONICAL_NAN) : word_f64(f);
+}
+
+Word bm_value_ptr(Memory_Addr addr)
+{
+    return word_u64((BM_VALUE_TAG_PTR << BM_VALUE_TAG_SHIFT) | (addr & BM_VALUE_PAYLOAD_MASK));
+}
+
+// NOTE: 0 for doubles
+uint64_t bm_value_tag(Word value)
+{
+    const uint64_t tag = value.as_u64 >> BM_VALUE_TAG_SHIFT;
+    return tag >= BM_VALUE_TAG_INT ? tag : 0;
+}
+
+bool bm_value_is_float(Word value)
+{
+    return (value.as_u64 >> BM_VALUE_TAG_SHIFT) < BM_VALUE_TAG_INT;
+}
+
+int64_t bm_value_as_int(Word value)
+{
+    const uint64_t payload = value.as_u64 & BM_VALUE_PAYLOAD_MASK;
+    return (int64_t) payload - (int64_t) ((payload >> 47) << 48);
+}
+
+void bm_value_print(FILE *stream, Word value)
+{
+    switch (bm_value_tag(value)) {
+    case 0:
+        fprintf(stream, "%lf\n", value.as_f64);
+        break;
+    case BM_VALUE_TAG_INT:
+        fprintf(stream, "%" PRId64 "\n", bm_value_as_int(value));
+        break;
+    case BM_VALUE_TAG_REF:
+        fprintf(stream, "<ref %" PRIu64 ">\n", (uint64_t) (value.as_u64 & BM_VALUE_PAYLOAD_MASK));
+        break;
+    case BM_VALUE_TAG_PTR:
+        fprintf(stream, "<ptr %" PRIu64 ">\n", (uint64_t) (value.as_u64 & BM_VALUE_PAYLOAD_MASK));
+        break;
+    case BM_VALUE_TAG_IMM:
+        fprintf(stream, "%s\n",
+                value.as_u64 == BM_VALUE_NIL ? "nil" :
+                value.as_u64 == BM_VALUE_FALSE ? "false" :
+                value.as_u64 == BM_VALUE_TRUE ? "true" : "<imm>");
+        break;
+    default:
+        fprintf(stream, "<tag %" PRIX64 ">\n", bm_value_tag(value));
+    }
+}
+
+// NOTE: the fast path of the arithmetic on tagged values. Integers stay
+// integers as long as the result fits, mixing them with doubles gives a
+// double. Everything else is left to the fallback of the instruction.
+static bool bm_value_arith(Inst_Type type, Word a, Word b, Word *output)
+{
+    const uint64_t ta = bm_value_tag(a);
+    const uint64_t tb = bm_value_tag(b);
+
+    if (ta == BM_VALUE_TAG_INT && tb == BM_VALUE_TAG_INT && type != INST_DIVV) {
+        const int64_t x = bm_value_as_int(a);
+        const int64_t y = bm_value_as_int(b);
+        if (type == INST_PLUSV) {
+            *output = bm_value_int(x + y);
+            return true;
+        } else if (type == INST_MINUSV) {
+            *output = bm_value_int(x - y);
+            return true;
         }
+
+        // NOTE: the exact product is only computed once the approximate
+        // one proves it fits into 64 bits
+        const double p = (double) x * (double) y;
+        *output = p > -9e15 && p < 9e15 ? bm_value_int(x * y) : bm_value_float(p);
+        return true;
     }
 
-    return ERR_OK;
+    if ((ta != 0 && ta != BM_VALUE_TAG_INT) || (tb != 0 && tb != BM_VALUE_TAG_INT)) {
+        return false;
+    }
+
+    const double x = ta == 0 ? a.as_f64 : (double) bm_value_as_int(a);
+    const double y = tb == 0 ? b.as_f64 : (double) bm_value_as_int(b);
+    *output = bm_value_float(type == INST_PLUSV ? x + y
+                             : type == INST_MINUSV ? x - y
+                             : type == INST_MULTV ? x * y
+                             : x / y);
+    return true;
+}
+
+static inline void bm_inline_cache_update(Bm_Inline_Cache *cache, Inst_Addr target)
+{
+    if (cache->target == target && cache->hits + cache->misses > 0) {
+        cache->hits += 1;
+    } else {
+        cache->target = target;
+        cache->misses += 1;
+    }
 }
 
 Err bm_execute_inst(Bm *bm)
 {
+#ifdef BM_GUARD_MEMORY
+    if (bm_guard_jump == NULL) {
+        return bm_guard_run(bm, NULL);
+    }
+#endif
+
     if (bm->ip >= bm->program_size) {
         return ERR_ILLEGAL_INST_ACCESS;
     }
@@ -504,7 +1505,7 @@ Err bm_execute_inst(Bm *bm)
         break;
 
     case INST_NATIVE:
-        if (inst.operand.as_u64 > bm->natives_size) {
+        if (inst.operand.as_u64 >= bm->natives_size) {
             return ERR_ILLEGAL_OPERAND;
         }
         const Err err = bm->natives[inst.operand.as_u64](bm);
@@ -653,8 +1654,8 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 1) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 1].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 1].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 1)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         bm->stack[bm->stack_size - 1].as_u64 = bm->memory[addr];
@@ -665,8 +1666,8 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 1) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 1].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY - 1) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 1].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 2)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         bm->stack[bm->stack_size - 1].as_u64 = *(uint16_t*)&bm->memory[addr];
@@ -677,8 +1678,8 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 1) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 1].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY - 3) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 1].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 4)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         bm->stack[bm->stack_size - 1].as_u64 = *(uint32_t*)&bm->memory[addr];
@@ -689,8 +1690,8 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 1) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 1].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY - 7) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 1].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 8)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         bm->stack[bm->stack_size - 1].as_u64 = *(uint64_t*)&bm->memory[addr];
@@ -701,8 +1702,8 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 2) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 2].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 2].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 1)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         bm->memory[addr] = (uint8_t) bm->stack[bm->stack_size - 1].as_u64;
@@ -714,8 +1715,8 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 2) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 2].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY - 1) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 2].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 2)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         *(uint16_t*)&bm->memory[addr] = (uint16_t) bm->stack[bm->stack_size - 1].as_u64;
@@ -727,8 +1728,8 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 2) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 2].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY - 3) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 2].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 4)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         *(uint32_t*)&bm->memory[addr] = (uint32_t) bm->stack[bm->stack_size - 1].as_u64;
@@ -740,30 +1741,237 @@ Err bm_execute_inst(Bm *bm)
         if (bm->stack_size < 2) {
             return ERR_STACK_UNDERFLOW;
         }
-        const Memory_Addr addr = bm->stack[bm->stack_size - 2].as_u64;
-        if (addr >= BM_MEMORY_CAPACITY - 7) {
+        const Memory_Addr addr = BM_MEMORY_ADDR(bm->stack[bm->stack_size - 2].as_u64);
+        if (!BM_MEMORY_IN_BOUNDS(addr, 8)) {
             return ERR_ILLEGAL_MEMORY_ACCESS;
         }
         *(uint64_t*)&bm->memory[addr] = bm->stack[bm->stack_size - 1].as_u64;
+        // NOTE: the write barrier of the garbage collector
+        if ((bm->stack[bm->stack_size - 1].as_u64 >> BM_GC_REF_SHIFT) == BM_GC_REF_TAG) {
+            bm->gc.cards[addr / BM_GC_CARD_SIZE] = 1;
+        }
         bm->stack_size -= 2;
         bm->ip += 1;
     } break;
 
-    case NUMBER_OF_INSTS:
-    default:
-        return ERR_ILLEGAL_INST;
-    }
+    // NOTE: a `call` that reuses the return address of the current call.
+    // The top of the stack says how many arguments lie on top of that
+    // return address. The return address is moved above them, exactly
+    // where `call` would have put a new one.
+    case INST_TCALL: {
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
 
-    return ERR_OK;
-}
+        const uint64_t n = bm->stack[bm->stack_size - 1].as_u64;
+        if (n >= bm->stack_size - 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+        bm->stack_size -= 1;
 
-void bm_push_native(Bm *bm, Bm_Native native)
-{
-    assert(bm->natives_size < BM_NATIVES_CAPACITY);
-    bm->natives[bm->natives_size++] = native;
-}
+        Word *ret = &bm->stack[bm->stack_size - 1 - n];
+        const Word addr = *ret;
+        memmove(ret, ret + 1, sizeof(*ret) * n);
+        bm->stack[bm->stack_size - 1] = addr;
+        bm->ip = inst.operand.as_u64;
+    } break;
 
-void bm_dump_stack(FILE *stream, const Bm *bm)
+    // NOTE: on a type mismatch the operands stay on the stack and the
+    // operand of the instruction is called to deal with them
+    case INST_PLUSV:
+    case INST_MINUSV:
+    case INST_MULTV:
+    case INST_DIVV:
+        if (bm->stack_size < 2) {
+            return ERR_STACK_UNDERFLOW;
+        }
+
+        if (bm_value_arith(inst.type,
+                           bm->stack[bm->stack_size - 2],
+                           bm->stack[bm->stack_size - 1],
+                           &bm->stack[bm->stack_size - 2])) {
+            bm->stack_size -= 1;
+            bm->ip += 1;
+        } else {
+            if (bm->stack_size >= BM_STACK_CAPACITY) {
+                return ERR_STACK_OVERFLOW;
+            }
+            bm->stack[bm->stack_size++].as_u64 = bm->ip + 1;
+            bm->ip = inst.operand.as_u64;
+        }
+        break;
+
+    // NOTE: the type tests leave the value on the stack
+    case INST_JMP_INT:
+    case INST_JMP_FLOAT:
+    case INST_JMP_REF: {
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+
+        const uint64_t tag = bm_value_tag(bm->stack[bm->stack_size - 1]);
+        const bool taken = inst.type == INST_JMP_INT ? tag == BM_VALUE_TAG_INT
+            : inst.type == INST_JMP_FLOAT ? tag == 0
+            : tag == BM_VALUE_TAG_REF;
+        bm->ip = taken ? inst.operand.as_u64 : bm->ip + 1;
+    } break;
+
+    case INST_BOXI:
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+        bm->stack[bm->stack_size - 1] = bm_value_int(bm->stack[bm->stack_size - 1].as_i64);
+        bm->ip += 1;
+        break;
+
+    case INST_BOXP:
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+        bm->stack[bm->stack_size - 1] = bm_value_ptr(bm->stack[bm->stack_size - 1].as_u64);
+        bm->ip += 1;
+        break;
+
+    // NOTE: integers become raw integers, pointers, references and
+    // immediates lose their tag and doubles stay the same
+    case INST_UNBOX: {
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+        Word *value = &bm->stack[bm->stack_size - 1];
+        const uint64_t tag = bm_value_tag(*value);
+        if (tag == BM_VALUE_TAG_INT) {
+            value->as_i64 = bm_value_as_int(*value);
+        } else if (tag != 0) {
+            value->as_u64 &= BM_VALUE_PAYLOAD_MASK;
+        }
+        bm->ip += 1;
+    } break;
+
+    case INST_CALLF:
+        if (bm->returns_size >= BM_RETURNS_CAPACITY) {
+            return ERR_STACK_OVERFLOW;
+        }
+
+        bm->returns[bm->returns_size++] = bm->ip + 1;
+        bm->ip = inst.operand.as_u64;
+        break;
+
+    case INST_RETF:
+        if (bm->returns_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+
+        bm->ip = bm->returns[--bm->returns_size];
+        break;
+
+    // NOTE: the locals of a new frame start zeroed
+    case INST_ENTER:
+        if (bm->frames_size >= BM_FRAMES_CAPACITY ||
+            inst.operand.as_u64 > BM_LOCALS_CAPACITY - bm->locals_size) {
+            return ERR_STACK_OVERFLOW;
+        }
+
+        bm->frames[bm->frames_size++] = bm->locals_size;
+        memset(&bm->locals[bm->locals_size], 0, sizeof(bm->locals[0]) * inst.operand.as_u64);
+        bm->locals_size += inst.operand.as_u64;
+        bm->ip += 1;
+        break;
+
+    case INST_LEAVE:
+        if (bm->frames_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+
+        bm->locals_size = bm->frames[--bm->frames_size];
+        bm->ip += 1;
+        break;
+
+    case INST_LOADL:
+        if (bm->frames_size < 1 ||
+            inst.operand.as_u64 >= bm->locals_size - bm->frames[bm->frames_size - 1]) {
+            return ERR_ILLEGAL_OPERAND;
+        }
+
+        if (bm->stack_size >= BM_STACK_CAPACITY) {
+            return ERR_STACK_OVERFLOW;
+        }
+
+        bm->stack[bm->stack_size++] = bm->locals[bm->frames[bm->frames_size - 1] + inst.operand.as_u64];
+        bm->ip += 1;
+        break;
+
+    case INST_STOREL:
+        if (bm->frames_size < 1 ||
+            inst.operand.as_u64 >= bm->locals_size - bm->frames[bm->frames_size - 1]) {
+            return ERR_ILLEGAL_OPERAND;
+        }
+
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+
+        bm->locals[bm->frames[bm->frames_size - 1] + inst.operand.as_u64] = bm->stack[--bm->stack_size];
+        bm->ip += 1;
+        break;
+
+    // NOTE: a `call` of the address on top of the stack, the return
+    // address takes its place
+    case INST_CALL_INDIRECT: {
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+
+        const Inst_Addr target = bm->stack[bm->stack_size - 1].as_u64;
+        bm->stack[bm->stack_size - 1].as_u64 = bm->ip + 1;
+        bm_inline_cache_update(&bm->caches[bm->ip], target);
+        bm->ip = target;
+    } break;
+
+    // NOTE: the operand points at the table in the memory: the number of
+    // the entries followed by their instruction addresses. An index past
+    // the end of the table falls through to the next instruction.
+    case INST_JMP_TABLE: {
+        if (bm->stack_size < 1) {
+            return ERR_STACK_UNDERFLOW;
+        }
+
+        const Memory_Addr table = inst.operand.as_u64;
+        if (table >= BM_MEMORY_CAPACITY - sizeof(uint64_t)) {
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+
+        uint64_t count = 0;
+        memcpy(&count, &bm->memory[table], sizeof(count));
+        if (count > (BM_MEMORY_CAPACITY - sizeof(uint64_t) - table) / sizeof(Inst_Addr)) {
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+
+        const uint64_t index = bm->stack[--bm->stack_size].as_u64;
+        Inst_Addr target = bm->ip + 1;
+        if (index < count) {
+            memcpy(&target, &bm->memory[table + sizeof(uint64_t) + index * sizeof(Inst_Addr)],
+                   sizeof(target));
+        }
+        bm_inline_cache_update(&bm->caches[bm->ip], target);
+        bm->ip = target;
+    } break;
+
+    case NUMBER_OF_INSTS:
+    default:
+        return ERR_ILLEGAL_INST;
+    }
+
+    return ERR_OK;
+}
+
+void bm_push_native(Bm *bm, Bm_Native native)
+{
+    assert(bm->natives_size < BM_NATIVES_CAPACITY);
+    bm->natives[bm->natives_size++] = native;
+}
+
+void bm_dump_stack(FILE *stream, const Bm *bm)
 {
     fprintf(stream, "Stack:\n");
     if (bm->stack_size > 0) {
@@ -779,446 +1987,5255 @@ void bm_dump_stack(FILE *stream, const Bm *bm)
     }
 }
 
-void bm_load_program_from_file(Bm *bm, const char *file_path)
+static void bm_release_resources(Bm *bm)
 {
-    FILE *f = fopen(file_path, "rb");
-    if (f == NULL) {
-        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
-            file_path, strerror(errno));
-        exit(1);
+    for (size_t i = 0; i < BM_WINDOWS_CAPACITY; ++i) {
+        if (bm->windows[i].size > 0) {
+            bm_window_unmap(bm, bm->windows[i].addr);
+        }
     }
 
-    Bm_File_Meta meta = {0};
+    for (size_t i = 0; i < BM_READERS_CAPACITY; ++i) {
+        if (bm->readers[i].used) {
+            bm_reader_close(bm, i + 1);
+        }
+    }
+}
 
-    size_t n = fread(&meta, sizeof(meta), 1, f);
-    if (n < 1) {
-        fprintf(stderr, "ERROR: Could not read meta data from file `%s`: %s\n",
-                file_path, strerror(errno));
-        exit(1);
+void bm_release(Bm *bm)
+{
+    bm_release_resources(bm);
+#ifdef BM_GUARD_MEMORY
+    if (bm->memory != NULL) {
+        munmap(bm->memory, BM_GUARD_RESERVED);
+        bm->memory = NULL;
     }
+#endif
 
-    if (meta.magic != BM_FILE_MAGIC) {
-        fprintf(stderr,
-                "ERROR: %s does not appear to be a valid BM file. "
-                "Unexpected magic %04X. Expected %04X.\n",
-                file_path,
-                meta.magic, BM_FILE_MAGIC);
-        exit(1);
+    free(bm->key);
+    bm->key = NULL;
+    bm->key_capacity = 0;
+
+#ifdef BM_CACHE
+    if (bm->cache != NULL) {
+        leave_conctab(bm->cache);
+        bm->cache = NULL;
     }
+#endif
+}
 
-    if (meta.version != BM_FILE_VERSION) {
-        fprintf(stderr,
-                "ERROR: %s: unsupported version of BM file %d. Expected version %d.\n",
-                file_path,
-                meta.version, BM_FILE_VERSION);
-        exit(1);
+Err bm_string_key(Bm *bm, Memory_Addr addr, uint64_t count, void **key)
+{
+    if (addr >= BM_MEMORY_CAPACITY) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
     }
 
-    if (meta.program_size > BM_PROGRAM_CAPACITY) {
-        fprintf(stderr,
-                "ERROR: %s: program section is too big. The file contains %" PRIu64 " program instruction. But the capacity is %"  PRIu64 "\n",
-                file_path,
-                meta.program_size,
-                (uint64_t) BM_PROGRAM_CAPACITY);
-        exit(1);
+    if (addr + count < addr || addr + count >= BM_MEMORY_CAPACITY) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
     }
 
-    if (meta.memory_capacity > BM_MEMORY_CAPACITY) {
-        fprintf(stderr,
-                "ERROR: %s: memory section is too big. The file wants %" PRIu64 " bytes. But the capacity is %"  PRIu64 " bytes\n",
-                file_path,
-                meta.memory_capacity,
-                (uint64_t) BM_MEMORY_CAPACITY);
-        exit(1);
+    if (count + 1 > bm->key_capacity) {
+        size_t capacity = bm->key_capacity == 0 ? 64 : bm->key_capacity;
+        while (capacity < count + 1) {
+            capacity *= 2;
+        }
+
+        char *grown = realloc(bm->key, capacity);
+        if (grown == NULL) {
+            return ERR_OUT_OF_MEMORY;
+        }
+        bm->key = grown;
+        bm->key_capacity = capacity;
     }
 
-    if (meta.memory_size > meta.memory_capacity) {
-        fprintf(stderr,
-                "ERROR: %s: memory size %"PRIu64" is greater than declared memory capacity %"PRIu64"\n",
-                file_path,
-                meta.memory_size,
-                meta.memory_capacity);
-        exit(1);
+    memcpy(bm->key, &bm->memory[addr], count);
+    bm->key[count] = '\0';
+    *key = bm->key;
+
+    return ERR_OK;
+}
+
+#ifdef BM_CACHE
+Err bm_cache_join(Bm *bm, ConcTab *cache)
+{
+    ConcTabThread *thread = join_conctab(cache);
+    if (thread == NULL) {
+        return ERR_OUT_OF_MEMORY;
     }
 
-    bm->program_size = fread(bm->program, sizeof(bm->program[0]), meta.program_size, f);
+    if (bm->cache != NULL) {
+        leave_conctab(bm->cache);
+    }
+    bm->cache = thread;
 
-    if (bm->program_size != meta.program_size) {
-        fprintf(stderr, "ERROR: %s: read %zd program instructions, but expected %"PRIu64"\n",
-                file_path,
-                bm->program_size,
-                meta.program_size);
-        exit(1);
+    return ERR_OK;
+}
+
+Err bm_cache_get(Bm *bm)
+{
+    if (bm->cache == NULL) {
+        return ERR_ILLEGAL_OPERAND;
     }
 
-    n = fread(bm->memory, sizeof(bm->memory[0]), meta.memory_size, f);
+    if (bm->stack_size < 2) {
+        return ERR_STACK_UNDERFLOW;
+    }
 
-    if (n != meta.memory_size) {
-        fprintf(stderr, "ERROR: %s: read %zd bytes of memory section, but expected %"PRIu64" bytes.\n",
-                file_path,
-                n,
-                meta.memory_size);
-        exit(1);
+    void *key = NULL;
+    Err err = bm_string_key(bm,
+                            bm->stack[bm->stack_size - 2].as_u64,
+                            bm->stack[bm->stack_size - 1].as_u64,
+                            &key);
+    if (err != ERR_OK) {
+        return err;
     }
 
-    fclose(f);
+    value_t value = {0};
+    get_conctab(bm->cache, key, &value);
+    bm->stack_size -= 1;
+    bm->stack[bm->stack_size - 1].as_f64 = value.real;
+
+    return ERR_OK;
 }
 
-String_View sv_from_cstr(const char *cstr)
+Err bm_cache_set(Bm *bm)
 {
-    return (String_View) {
-        .count = strlen(cstr),
-        .data = cstr,
-    };
+    if (bm->cache == NULL) {
+        return ERR_ILLEGAL_OPERAND;
+    }
+
+    if (bm->stack_size < 3) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    void *key = NULL;
+    Err err = bm_string_key(bm,
+                            bm->stack[bm->stack_size - 2].as_u64,
+                            bm->stack[bm->stack_size - 1].as_u64,
+                            &key);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    set_conctab(bm->cache, key, real(bm->stack[bm->stack_size - 3].as_f64));
+    bm->stack_size -= 3;
+
+    return ERR_OK;
 }
 
-String_View sv_trim_left(String_View sv)
+Err bm_cache_del(Bm *bm)
 {
-    size_t i = 0;
-    while (i < sv.count && isspace(sv.data[i])) {
-        i += 1;
+    if (bm->cache == NULL) {
+        return ERR_ILLEGAL_OPERAND;
     }
 
-    return (String_View) {
-        .count = sv.count - i,
-        .data = sv.data + i,
-    };
+    if (bm->stack_size < 2) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    void *key = NULL;
+    Err err = bm_string_key(bm,
+                            bm->stack[bm->stack_size - 2].as_u64,
+                            bm->stack[bm->stack_size - 1].as_u64,
+                            &key);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    del_conctab(bm->cache, key);
+    bm->stack_size -= 2;
+
+    return ERR_OK;
 }
+#endif
 
-String_View sv_trim_right(String_View sv)
+// Starts the VM over with the sections that are already validated
+static Err bm_load_sections(Bm *bm, const void *program, const Bm_File_Meta *meta, const void *memory)
 {
-    size_t i = 0;
-    while (i < sv.count && isspace(sv.data[sv.count - 1 - i])) {
-        i += 1;
+    Err err = bm_memory_init(bm);
+    if (err != ERR_OK) {
+        return err;
     }
 
-    return (String_View) {
-        .count = sv.count - i,
-        .data = sv.data
-    };
+    err = bm_output_restart(bm);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    // NOTE: the previous program may have left the windows over the memory
+    bm_release_resources(bm);
+
+    memcpy(bm->program, program, meta->program_size * sizeof(bm->program[0]));
+    bm->program_size = meta->program_size;
+    memcpy(bm->memory, memory, meta->memory_size);
+    memset(bm->memory + meta->memory_size, 0, BM_MEMORY_CAPACITY - meta->memory_size);
+
+    bm->stack_size = 0;
+    bm->returns_size = 0;
+    bm->frames_size = 0;
+    bm->locals_size = 0;
+    memset(bm->caches, 0, sizeof(bm->caches));
+    bm->ip = 0;
+    bm->halt = false;
+    memset(&bm->gc, 0, sizeof(bm->gc));
+    bm_heap_init(bm, meta->memory_capacity);
+
+    return ERR_OK;
 }
 
-String_View sv_trim(String_View sv)
+Err bm_load_program_from_memory(Bm *bm, const void *data, size_t size)
 {
-    return sv_trim_right(sv_trim_left(sv));
+    Bm_File_Meta meta = {0};
+    if (size < sizeof(meta)) {
+        return ERR_INVALID_FILE;
+    }
+    memcpy(&meta, data, sizeof(meta));
+
+    if (meta.magic != BM_FILE_MAGIC || meta.version != BM_FILE_VERSION) {
+        return ERR_INVALID_FILE;
+    }
+
+    if (meta.program_size > BM_PROGRAM_CAPACITY ||
+        meta.memory_capacity > BM_MEMORY_CAPACITY) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    if (meta.memory_size > meta.memory_capacity) {
+        return ERR_INVALID_FILE;
+    }
+
+    // NOTE: both of the sections are within the capacities, so this does
+    // not overflow
+    const size_t program_bytes = meta.program_size * sizeof(bm->program[0]);
+    if (size - sizeof(meta) < program_bytes + meta.memory_size) {
+        return ERR_INVALID_FILE;
+    }
+
+    const uint8_t *bytes = (const uint8_t *) data + sizeof(meta);
+    return bm_load_sections(bm, bytes, &meta, bytes + program_bytes);
 }
 
-String_View sv_chop_by_delim(String_View *sv, char delim)
+// NOTE: a valid file is never bigger than the meta and both of the
+// sections at their capacities
+#define BM_FILE_MAX_SIZE (sizeof(Bm_File_Meta) + sizeof(Inst) * BM_PROGRAM_CAPACITY + BM_MEMORY_CAPACITY)
+
+// Reads the whole .bm file into a buffer that is valid until the next call
+static const uint8_t *bm_slurp_program(const char *file_path, size_t *size)
 {
-    size_t i = 0;
-    while (i < sv->count && sv->data[i] != delim) {
-        i += 1;
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+            file_path, strerror(errno));
+        exit(1);
+    }
+
+    static uint8_t buffer[BM_FILE_MAX_SIZE + 1];
+    *size = fread(buffer, 1, sizeof(buffer), f);
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: Could not read file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+    fclose(f);
+
+    return buffer;
+}
+
+void bm_load_program_from_file(Bm *bm, const char *file_path)
+{
+    size_t size = 0;
+    const uint8_t *data = bm_slurp_program(file_path, &size);
+
+    Err err = size <= BM_FILE_MAX_SIZE
+        ? bm_load_program_from_memory(bm, data, size)
+        : ERR_INVALID_FILE;
+    if (err != ERR_OK) {
+        fprintf(stderr, "ERROR: Could not load file `%s`: %s\n",
+                file_path, err_as_cstr(err));
+        exit(1);
+    }
+}
+
+Err bm_verify_program(const Bm *bm, Inst_Addr *at)
+{
+    for (Inst_Addr i = 0; i < bm->program_size; ++i) {
+        const Inst inst = bm->program[i];
+        *at = i;
+
+        if ((uint64_t) inst.type >= NUMBER_OF_INSTS) {
+            return ERR_ILLEGAL_INST;
+        }
+
+        // NOTE: jumping right past the last instruction is fine as long
+        // as it never happens
+        if (inst_has_addr_operand(inst.type) && inst.operand.as_u64 > bm->program_size) {
+            return ERR_ILLEGAL_OPERAND;
+        }
+
+        if (inst.type == INST_NATIVE && inst.operand.as_u64 >= bm->natives_size) {
+            return ERR_ILLEGAL_OPERAND;
+        }
+    }
+
+    return ERR_OK;
+}
+
+void bm_prepare_program(Bm *bm, const char *file_path)
+{
+    bm_load_program_from_file(bm, file_path);
+
+    Inst_Addr at = 0;
+    Err err = bm_verify_program(bm, &at);
+    if (err != ERR_OK) {
+        fprintf(stderr, "ERROR: %s: instruction %" PRIu64 ": %s\n",
+                file_path, at, err_as_cstr(err));
+        exit(1);
+    }
+}
+
+static const uint64_t bm_heap_size_classes[BM_HEAP_SIZE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+};
+
+#define BM_HEAP_LARGE_MIN (bm_heap_size_classes[BM_HEAP_SIZE_CLASSES - 1] + BM_HEAP_ALIGNMENT)
+
+static uint64_t *bm_heap_word(Bm *bm, Memory_Addr addr)
+{
+    return (uint64_t*)&bm->memory[addr];
+}
+
+static uint64_t bm_heap_capacity(Bm *bm, Memory_Addr addr)
+{
+    return *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE) & ~(uint64_t) BM_HEAP_FLAGS;
+}
+
+// NOTE: the headers and the free list links live in the VM memory where the
+// guest can overwrite them, so every block is checked against the heap
+// before it is followed. `flags` are the exact flags the header must have.
+static bool bm_heap_is_block(Bm *bm, Memory_Addr addr, uint64_t flags)
+{
+    if (bm->heap.top > BM_MEMORY_CAPACITY ||
+        addr < bm->heap.start + BM_HEAP_HEADER_SIZE ||
+        addr >= bm->heap.top ||
+        addr % BM_HEAP_ALIGNMENT != 0) {
+        return false;
+    }
+
+    const uint64_t header = *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE);
+    const uint64_t capacity = header & ~(uint64_t) BM_HEAP_FLAGS;
+    return (header & BM_HEAP_FLAGS) == flags &&
+           capacity >= BM_HEAP_ALIGNMENT &&
+           capacity <= bm->heap.top - addr;
+}
+
+void bm_heap_init(Bm *bm, Memory_Addr start)
+{
+    memset(&bm->heap, 0, sizeof(bm->heap));
+    // NOTE: 0 is the null address, so no block may ever start there
+    if (start < BM_HEAP_ALIGNMENT) {
+        start = BM_HEAP_ALIGNMENT;
+    }
+    bm->heap.start = (start + BM_HEAP_ALIGNMENT - 1) & ~(uint64_t) (BM_HEAP_ALIGNMENT - 1);
+    bm->heap.top = bm->heap.start;
+}
+
+static Memory_Addr bm_heap_bump(Bm *bm, uint64_t capacity, uint64_t flags)
+{
+    if (bm->heap.top > BM_MEMORY_CAPACITY ||
+        BM_MEMORY_CAPACITY - bm->heap.top < BM_HEAP_HEADER_SIZE + capacity) {
+        return 0;
+    }
+
+    const Memory_Addr addr = bm->heap.top + BM_HEAP_HEADER_SIZE;
+    *bm_heap_word(bm, bm->heap.top) = capacity | flags;
+    bm->heap.top = addr + capacity;
+    return addr;
+}
+
+static Err bm_heap_alloc_large(Bm *bm, uint64_t capacity, Memory_Addr *output)
+{
+    // NOTE: the large list is address ordered, a link that does not go
+    // forward was overwritten and would loop forever
+    Memory_Addr prev = 0;
+    Memory_Addr *link = &bm->heap.large;
+    while (*link != 0) {
+        const Memory_Addr addr = *link;
+        if (addr <= prev || !bm_heap_is_block(bm, addr, BM_HEAP_LARGE)) {
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+
+        const uint64_t available = bm_heap_capacity(bm, addr);
+        if (available >= capacity) {
+            *link = *bm_heap_word(bm, addr);
+
+            // NOTE: the rest of the block is split off only if it is still
+            // a large block, otherwise it stays with the allocation
+            if (available - capacity >= BM_HEAP_HEADER_SIZE + BM_HEAP_LARGE_MIN) {
+                const Memory_Addr rest = addr + capacity + BM_HEAP_HEADER_SIZE;
+                *bm_heap_word(bm, rest - BM_HEAP_HEADER_SIZE) =
+                    (available - capacity - BM_HEAP_HEADER_SIZE) | BM_HEAP_LARGE;
+                *bm_heap_word(bm, rest) = *link;
+                *link = rest;
+            } else {
+                capacity = available;
+            }
+
+            *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE) = capacity | BM_HEAP_LARGE | BM_HEAP_USED;
+            *output = addr;
+            return ERR_OK;
+        }
+        prev = addr;
+        link = bm_heap_word(bm, addr);
+    }
+
+    *output = bm_heap_bump(bm, capacity, BM_HEAP_LARGE | BM_HEAP_USED);
+    return ERR_OK;
+}
+
+static Err bm_heap_free_large(Bm *bm, Memory_Addr addr)
+{
+    uint64_t capacity = bm_heap_capacity(bm, addr);
+
+    Memory_Addr *prev_link = NULL;
+    Memory_Addr *link = &bm->heap.large;
+    Memory_Addr prev = 0;
+    while (*link != 0 && *link < addr) {
+        if (*link <= prev || !bm_heap_is_block(bm, *link, BM_HEAP_LARGE)) {
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+        prev_link = link;
+        prev = *link;
+        link = bm_heap_word(bm, prev);
+    }
+
+    Memory_Addr next = *link;
+    if (next != 0 && !bm_heap_is_block(bm, next, BM_HEAP_LARGE)) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    if (next != 0 && addr + capacity + BM_HEAP_HEADER_SIZE == next) {
+        capacity += BM_HEAP_HEADER_SIZE + bm_heap_capacity(bm, next);
+        next = *bm_heap_word(bm, next);
+    }
+
+    if (prev != 0 && prev + bm_heap_capacity(bm, prev) + BM_HEAP_HEADER_SIZE == addr) {
+        capacity += BM_HEAP_HEADER_SIZE + bm_heap_capacity(bm, prev);
+        addr = prev;
+        link = prev_link;
+    }
+
+    if (addr + capacity == bm->heap.top) {
+        // NOTE: the block at the end of the heap goes back to the bump
+        // allocator, so it can be reused by any size class
+        *link = next;
+        bm->heap.top = addr - BM_HEAP_HEADER_SIZE;
+        return ERR_OK;
+    }
+
+    *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE) = capacity | BM_HEAP_LARGE;
+    *bm_heap_word(bm, addr) = next;
+    *link = addr;
+    return ERR_OK;
+}
+
+// NOTE: *output is 0 when the heap is out of memory
+Err bm_heap_alloc(Bm *bm, uint64_t size, Memory_Addr *output)
+{
+    if (size == 0) {
+        size = 1;
+    }
+
+    for (size_t i = 0; i < BM_HEAP_SIZE_CLASSES; ++i) {
+        if (size <= bm_heap_size_classes[i]) {
+            const Memory_Addr addr = bm->heap.small[i];
+            if (addr != 0) {
+                if (!bm_heap_is_block(bm, addr, 0) ||
+                    bm_heap_capacity(bm, addr) != bm_heap_size_classes[i]) {
+                    return ERR_ILLEGAL_MEMORY_ACCESS;
+                }
+                bm->heap.small[i] = *bm_heap_word(bm, addr);
+                *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE) |= BM_HEAP_USED;
+                *output = addr;
+                return ERR_OK;
+            }
+
+            *output = bm_heap_bump(bm, bm_heap_size_classes[i], BM_HEAP_USED);
+            if (*output != 0) {
+                return ERR_OK;
+            }
+
+            // NOTE: once the heap cannot grow anymore, small objects are
+            // carved out of the free large blocks and stay large blocks
+            return bm_heap_alloc_large(bm, bm_heap_size_classes[i], output);
+        }
+    }
+
+    if (size > BM_MEMORY_CAPACITY) {
+        *output = 0;
+        return ERR_OK;
+    }
+
+    return bm_heap_alloc_large(bm, (size + BM_HEAP_ALIGNMENT - 1) & ~(uint64_t) (BM_HEAP_ALIGNMENT - 1), output);
+}
+
+// NOTE: checks that the address was returned by the heap and was not freed
+// since then, as far as it can be told from the header
+static bool bm_heap_is_used(Bm *bm, Memory_Addr addr)
+{
+    return bm_heap_is_block(bm, addr, BM_HEAP_USED) ||
+           bm_heap_is_block(bm, addr, BM_HEAP_USED | BM_HEAP_LARGE);
+}
+
+Err bm_heap_free(Bm *bm, Memory_Addr addr)
+{
+    if (addr == 0) {
+        return ERR_OK;
+    }
+
+    if (!bm_heap_is_used(bm, addr)) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    uint64_t *header = bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE);
+    if (*header & BM_HEAP_LARGE) {
+        return bm_heap_free_large(bm, addr);
+    }
+
+    const uint64_t capacity = bm_heap_capacity(bm, addr);
+    for (size_t i = 0; i < BM_HEAP_SIZE_CLASSES; ++i) {
+        if (capacity == bm_heap_size_classes[i]) {
+            *header &= ~(uint64_t) BM_HEAP_USED;
+            *bm_heap_word(bm, addr) = bm->heap.small[i];
+            bm->heap.small[i] = addr;
+            return ERR_OK;
+        }
+    }
+
+    return ERR_ILLEGAL_MEMORY_ACCESS;
+}
+
+Err bm_heap_realloc(Bm *bm, Memory_Addr addr, uint64_t size, Memory_Addr *output)
+{
+    if (addr == 0) {
+        return bm_heap_alloc(bm, size, output);
+    }
+
+    if (!bm_heap_is_used(bm, addr)) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    const uint64_t capacity = bm_heap_capacity(bm, addr);
+    if (size <= capacity) {
+        *output = addr;
+        return ERR_OK;
+    }
+
+    // NOTE: the last block of the heap grows in place
+    const uint64_t header = *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE);
+    const uint64_t grown = (size + BM_HEAP_ALIGNMENT - 1) & ~(uint64_t) (BM_HEAP_ALIGNMENT - 1);
+    if ((header & BM_HEAP_LARGE) &&
+        addr + capacity == bm->heap.top &&
+        size <= BM_MEMORY_CAPACITY &&
+        grown <= BM_MEMORY_CAPACITY - addr) {
+        *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE) = grown | (header & BM_HEAP_FLAGS);
+        bm->heap.top = addr + grown;
+        *output = addr;
+        return ERR_OK;
+    }
+
+    Memory_Addr result = 0;
+    Err err = bm_heap_alloc(bm, size, &result);
+    if (err != ERR_OK || result == 0) {
+        *output = 0;
+        return err;
+    }
+
+    memcpy(&bm->memory[result], &bm->memory[addr], capacity);
+    *output = result;
+    return bm_heap_free(bm, addr);
+}
+
+static bool bm_gc_is_ref(uint64_t word)
+{
+    return (word >> BM_GC_REF_SHIFT) == BM_GC_REF_TAG;
+}
+
+static uint64_t bm_gc_ref(Memory_Addr addr)
+{
+    return (BM_GC_REF_TAG << BM_GC_REF_SHIFT) | addr;
+}
+
+static bool bm_gc_is_object(const Bm *bm, Memory_Addr addr)
+{
+    return addr >= bm->heap.start + BM_HEAP_HEADER_SIZE + BM_GC_HEADER_SIZE &&
+           addr < bm->heap.top && addr < BM_MEMORY_CAPACITY && addr % 8 == 0 &&
+           ((bm->gc.objects[addr / 64] >> (addr / 8 % 8)) & 1) != 0;
+}
+
+static void bm_gc_set_object(Bm *bm, Memory_Addr addr, bool object)
+{
+    const uint8_t bit = (uint8_t) (1 << (addr / 8 % 8));
+    if (object) {
+        bm->gc.objects[addr / 64] |= bit;
+    } else {
+        bm->gc.objects[addr / 64] &= (uint8_t) ~bit;
+    }
+}
+
+static uint64_t *bm_gc_header(Bm *bm, Memory_Addr object)
+{
+    return bm_heap_word(bm, object - BM_GC_HEADER_SIZE);
+}
+
+static uint64_t bm_gc_size(Bm *bm, Memory_Addr object)
+{
+    return *bm_gc_header(bm, object) & ~(uint64_t) BM_GC_FLAGS;
+}
+
+// NOTE: the word before the header of an old object links it to the next one
+static uint64_t *bm_gc_link(Bm *bm, Memory_Addr object)
+{
+    return bm_heap_word(bm, object - BM_GC_HEADER_SIZE - 8);
+}
+
+// NOTE: the headers live in the VM memory where the guest can overwrite
+// them, so the size of an object is only trusted when the object fits
+// into the used part of the space it lives in
+static Err bm_gc_object_size(Bm *bm, Memory_Addr object, uint64_t *size)
+{
+    const bool young = object >= bm->gc.nursery && object < bm->gc.nursery_end;
+    const Memory_Addr end = young ? bm->gc.nursery_top : bm->heap.top;
+    const uint64_t header = *bm_gc_header(bm, object);
+    *size = header & ~(uint64_t) BM_GC_FLAGS;
+    if (object >= end || *size > end - object || young == ((header & BM_GC_OLD) != 0)) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+    return ERR_OK;
+}
+
+static bool bm_gc_is_old(Bm *bm, Memory_Addr object)
+{
+    return object >= bm->heap.start + BM_HEAP_HEADER_SIZE + 8 + BM_GC_HEADER_SIZE &&
+           bm_gc_is_object(bm, object) &&
+           (*bm_gc_header(bm, object) & BM_GC_OLD) != 0;
+}
+
+static uint64_t bm_gc_now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void bm_gc_pause(Bm *bm, uint64_t started)
+{
+    const uint64_t pause = bm_gc_now() - started;
+    bm->gc.pause_total_ns += pause;
+    if (pause > bm->gc.pause_max_ns) {
+        bm->gc.pause_max_ns = pause;
+    }
+}
+
+static Err bm_gc_init(Bm *bm)
+{
+    Err err = bm_heap_alloc(bm, BM_GC_NURSERY_SIZE, &bm->gc.nursery);
+    if (err != ERR_OK) {
+        return err;
+    }
+    if (bm->gc.nursery == 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    bm->gc.nursery_top = bm->gc.nursery;
+    bm->gc.nursery_end = bm->gc.nursery + BM_GC_NURSERY_SIZE;
+    bm->gc.major_threshold = BM_GC_MAJOR_THRESHOLD;
+    timespec_get(&bm->gc.started, TIME_UTC);
+    bm->gc.ready = true;
+
+    return ERR_OK;
+}
+
+// NOTE: *output is 0 when the heap is out of memory
+static Err bm_gc_alloc_old(Bm *bm, uint64_t size, Memory_Addr *output)
+{
+    Memory_Addr block = 0;
+    Err err = bm_heap_alloc(bm, 8 + BM_GC_HEADER_SIZE + size, &block);
+    if (err != ERR_OK || block == 0) {
+        *output = 0;
+        return err;
+    }
+
+    const Memory_Addr object = block + 8 + BM_GC_HEADER_SIZE;
+    *bm_gc_link(bm, object) = bm->gc.old;
+    *bm_gc_header(bm, object) = size | BM_GC_OLD;
+    bm->gc.old = object;
+    bm->gc.old_size += 8 + BM_GC_HEADER_SIZE + size;
+    bm->gc.old_count += 1;
+    bm_gc_set_object(bm, object, true);
+
+    *output = object;
+    return ERR_OK;
+}
+
+// NOTE: promotes the nursery object `slot` refers to, if any, and updates
+// the slot to the new location
+static Err bm_gc_evacuate(Bm *bm, uint64_t *slot)
+{
+    if (!bm_gc_is_ref(*slot)) {
+        return ERR_OK;
+    }
+
+    const Memory_Addr addr = *slot & BM_GC_ADDR_MASK;
+    if (addr < bm->gc.nursery || addr >= bm->gc.nursery_top || !bm_gc_is_object(bm, addr)) {
+        return ERR_OK;
+    }
+
+    const uint64_t header = *bm_gc_header(bm, addr);
+    if (header & BM_GC_FORWARDED) {
+        const Memory_Addr copy = *bm_heap_word(bm, addr);
+        if (!bm_gc_is_old(bm, copy)) {
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+        *slot = bm_gc_ref(copy);
+        return ERR_OK;
+    }
+
+    uint64_t size = 0;
+    Err err = bm_gc_object_size(bm, addr, &size);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    Memory_Addr copy = 0;
+    err = bm_gc_alloc_old(bm, size, &copy);
+    if (err != ERR_OK) {
+        return err;
+    }
+    if (copy == 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    memcpy(&bm->memory[copy], &bm->memory[addr], size);
+    *bm_gc_header(bm, addr) = header | BM_GC_FORWARDED;
+    *bm_heap_word(bm, addr) = copy;
+    bm->gc.promoted_bytes += size;
+
+    *slot = bm_gc_ref(copy);
+    return ERR_OK;
+}
+
+static Err bm_gc_minor(Bm *bm)
+{
+    const Memory_Addr boundary = bm->gc.old;
+
+    for (uint64_t i = 0; i < bm->stack_size; ++i) {
+        Err err = bm_gc_evacuate(bm, &bm->stack[i].as_u64);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    for (uint64_t i = 0; i < bm->locals_size; ++i) {
+        Err err = bm_gc_evacuate(bm, &bm->locals[i].as_u64);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    for (size_t card = 0; card < sizeof(bm->gc.cards); ++card) {
+        if (!bm->gc.cards[card]) {
+            continue;
+        }
+
+        const Memory_Addr begin = card * BM_GC_CARD_SIZE;
+        for (Memory_Addr addr = begin;
+             addr < begin + BM_GC_CARD_SIZE && addr + 8 <= BM_MEMORY_CAPACITY;
+             addr += 8) {
+            if (addr >= bm->gc.nursery && addr < bm->gc.nursery_end) {
+                continue;
+            }
+
+            Err err = bm_gc_evacuate(bm, bm_heap_word(bm, addr));
+            if (err != ERR_OK) {
+                return err;
+            }
+        }
+
+        bm->gc.cards[card] = 0;
+    }
+
+    // NOTE: the promoted objects are pushed to the front of the old list,
+    // so every round scans the objects promoted by the previous one
+    Memory_Addr scanned = boundary;
+    while (bm->gc.old != scanned) {
+        const Memory_Addr stop = scanned;
+        scanned = bm->gc.old;
+        for (Memory_Addr object = scanned; object != stop; object = *bm_gc_link(bm, object)) {
+            const uint64_t size = bm_gc_size(bm, object);
+            for (uint64_t offset = 0; offset < size; offset += 8) {
+                Err err = bm_gc_evacuate(bm, bm_heap_word(bm, object + offset));
+                if (err != ERR_OK) {
+                    return err;
+                }
+            }
+        }
+    }
+
+    // NOTE: the bits are cleared word by word, the headers in the nursery
+    // may have been overwritten since the objects were allocated
+    for (Memory_Addr addr = bm->gc.nursery; addr < bm->gc.nursery_top; addr += 8) {
+        bm_gc_set_object(bm, addr, false);
+    }
+    bm->gc.nursery_top = bm->gc.nursery;
+    bm->gc.minor_count += 1;
+
+    return ERR_OK;
+}
+
+static void bm_gc_mark(Bm *bm, uint64_t word)
+{
+    if (!bm_gc_is_ref(word)) {
+        return;
+    }
+
+    const Memory_Addr addr = word & BM_GC_ADDR_MASK;
+    if (!bm_gc_is_object(bm, addr)) {
+        return;
+    }
+
+    uint64_t *header = bm_gc_header(bm, addr);
+    if (*header & BM_GC_MARK) {
+        return;
+    }
+    *header |= BM_GC_MARK;
+
+    // NOTE: the objects that did not fit into the gray stack are found
+    // again by rescanning the old generation
+    if (bm->gc.gray_size < BM_GC_GRAY_CAPACITY) {
+        bm->gc.gray[bm->gc.gray_size++] = addr;
+    } else {
+        bm->gc.gray_overflow = true;
+    }
+}
+
+static Err bm_gc_mark_fields(Bm *bm, Memory_Addr object)
+{
+    uint64_t size = 0;
+    Err err = bm_gc_object_size(bm, object, &size);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    for (uint64_t offset = 0; offset + 8 <= size; offset += 8) {
+        bm_gc_mark(bm, *bm_heap_word(bm, object + offset));
+    }
+
+    return ERR_OK;
+}
+
+// NOTE: the blocks of heap_alloc are roots for the minor collections through
+// the cards, so they have to be roots here as well. The heap is walked
+// block by block, the objects and the nursery are blocks of their own.
+static Err bm_gc_mark_heap_blocks(Bm *bm)
+{
+    Memory_Addr addr = bm->heap.start + BM_HEAP_HEADER_SIZE;
+    while (addr < bm->heap.top) {
+        const uint64_t header = *bm_heap_word(bm, addr - BM_HEAP_HEADER_SIZE);
+        const uint64_t capacity = header & ~(uint64_t) BM_HEAP_FLAGS;
+        if (capacity < BM_HEAP_ALIGNMENT || capacity > bm->heap.top - addr) {
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+
+        if ((header & BM_HEAP_USED) &&
+            addr != bm->gc.nursery &&
+            !bm_gc_is_object(bm, addr + 8 + BM_GC_HEADER_SIZE)) {
+            for (uint64_t offset = 0; offset < capacity; offset += 8) {
+                bm_gc_mark(bm, *bm_heap_word(bm, addr + offset));
+            }
+        }
+
+        addr += capacity + BM_HEAP_HEADER_SIZE;
+    }
+
+    return ERR_OK;
+}
+
+static Err bm_gc_major(Bm *bm)
+{
+    // NOTE: after a minor collection every live object is old
+    Err err = bm_gc_minor(bm);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    for (uint64_t i = 0; i < bm->stack_size; ++i) {
+        bm_gc_mark(bm, bm->stack[i].as_u64);
+    }
+
+    for (uint64_t i = 0; i < bm->locals_size; ++i) {
+        bm_gc_mark(bm, bm->locals[i].as_u64);
+    }
+
+    for (Memory_Addr addr = 0; addr + 8 <= bm->heap.start; addr += 8) {
+        bm_gc_mark(bm, *bm_heap_word(bm, addr));
+    }
+
+    err = bm_gc_mark_heap_blocks(bm);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    // NOTE: the links of the old list live in the VM memory too. A link to
+    // anything but an old object, or a list longer than the amount of the
+    // old objects, means the guest overwrote it.
+    const uint64_t old_count = bm->gc.old_count;
+    do {
+        while (bm->gc.gray_size > 0) {
+            err = bm_gc_mark_fields(bm, bm->gc.gray[--bm->gc.gray_size]);
+            if (err != ERR_OK) {
+                return err;
+            }
+        }
+
+        if (bm->gc.gray_overflow) {
+            bm->gc.gray_overflow = false;
+            uint64_t count = 0;
+            for (Memory_Addr object = bm->gc.old; object != 0; object = *bm_gc_link(bm, object)) {
+                if (!bm_gc_is_old(bm, object) || ++count > old_count) {
+                    return ERR_ILLEGAL_MEMORY_ACCESS;
+                }
+                if (*bm_gc_header(bm, object) & BM_GC_MARK) {
+                    err = bm_gc_mark_fields(bm, object);
+                    if (err != ERR_OK) {
+                        return err;
+                    }
+                }
+            }
+        }
+    } while (bm->gc.gray_size > 0 || bm->gc.gray_overflow);
+
+    uint64_t count = 0;
+    uint64_t *link = &bm->gc.old;
+    while (*link != 0) {
+        const Memory_Addr object = *link;
+        if (!bm_gc_is_old(bm, object) || ++count > old_count) {
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+
+        uint64_t *header = bm_gc_header(bm, object);
+        if (*header & BM_GC_MARK) {
+            *header &= ~(uint64_t) BM_GC_MARK;
+            link = bm_gc_link(bm, object);
+            continue;
+        }
+
+        uint64_t size = 0;
+        err = bm_gc_object_size(bm, object, &size);
+        if (err != ERR_OK) {
+            return err;
+        }
+
+        size += 8 + BM_GC_HEADER_SIZE;
+        *link = *bm_gc_link(bm, object);
+        bm_gc_set_object(bm, object, false);
+        bm->gc.old_size -= size;
+        bm->gc.old_count -= 1;
+        bm->gc.freed_bytes += size;
+
+        err = bm_heap_free(bm, object - BM_GC_HEADER_SIZE - 8);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    bm->gc.major_threshold = bm->gc.old_size * 2;
+    if (bm->gc.major_threshold < BM_GC_MAJOR_THRESHOLD) {
+        bm->gc.major_threshold = BM_GC_MAJOR_THRESHOLD;
+    }
+    bm->gc.major_count += 1;
+
+    return ERR_OK;
+}
+
+Err bm_gc_alloc(Bm *bm, uint64_t size, Word *output)
+{
+    if (!bm->gc.ready) {
+        Err err = bm_gc_init(bm);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    if (size > BM_MEMORY_CAPACITY) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    // NOTE: every object has at least one word for the forwarding address
+    size = size < 8 ? 8 : (size + 7) & ~(uint64_t) 7;
+
+    bm->gc.allocated_objects += 1;
+    bm->gc.allocated_bytes += size;
+
+    Memory_Addr object = 0;
+    if (size + BM_GC_HEADER_SIZE <= BM_GC_NURSERY_SIZE / 4) {
+        if (bm->gc.nursery_end - bm->gc.nursery_top < size + BM_GC_HEADER_SIZE) {
+            const uint64_t started = bm_gc_now();
+            Err err = bm->gc.old_size > bm->gc.major_threshold ? bm_gc_major(bm) : bm_gc_minor(bm);
+            bm_gc_pause(bm, started);
+            if (err != ERR_OK) {
+                return err;
+            }
+        }
+
+        object = bm->gc.nursery_top + BM_GC_HEADER_SIZE;
+        *bm_gc_header(bm, object) = size;
+        bm->gc.nursery_top = object + size;
+        bm_gc_set_object(bm, object, true);
+    } else {
+        // NOTE: large objects are allocated in the old generation right
+        // away, copying them out of the nursery is not worth it
+        for (int attempt = 0; attempt < 2 && object == 0; ++attempt) {
+            if (attempt > 0 || bm->gc.old_size > bm->gc.major_threshold) {
+                const uint64_t started = bm_gc_now();
+                Err err = bm_gc_major(bm);
+                bm_gc_pause(bm, started);
+                if (err != ERR_OK) {
+                    return err;
+                }
+            }
+            Err err = bm_gc_alloc_old(bm, size, &object);
+            if (err != ERR_OK) {
+                return err;
+            }
+        }
+
+        if (object == 0) {
+            return ERR_OUT_OF_MEMORY;
+        }
+    }
+
+    memset(&bm->memory[object], 0, size);
+    *output = word_u64(bm_gc_ref(object));
+
+    return ERR_OK;
+}
+
+Err bm_gc_collect(Bm *bm)
+{
+    if (!bm->gc.ready) {
+        return ERR_OK;
+    }
+
+    const uint64_t started = bm_gc_now();
+    Err err = bm_gc_major(bm);
+    bm_gc_pause(bm, started);
+
+    return err;
+}
+
+void bm_gc_dump_stats(FILE *stream, const Bm *bm)
+{
+    if (!bm->gc.ready) {
+        fprintf(stream, "GC: no objects were allocated\n");
+        return;
+    }
+
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    const double elapsed = (double) (now.tv_sec - bm->gc.started.tv_sec) +
+                           (double) (now.tv_nsec - bm->gc.started.tv_nsec) / 1e9;
+
+    fprintf(stream, "GC: allocated %" PRIu64 " objects, %" PRIu64 " bytes (%.0f bytes/s)\n",
+            bm->gc.allocated_objects, bm->gc.allocated_bytes,
+            elapsed > 0.0 ? (double) bm->gc.allocated_bytes / elapsed : 0.0);
+    fprintf(stream, "GC: promoted %" PRIu64 " bytes, freed %" PRIu64 " bytes, %" PRIu64 " bytes in the old generation\n",
+            bm->gc.promoted_bytes, bm->gc.freed_bytes, bm->gc.old_size);
+    fprintf(stream, "GC: %" PRIu64 " minor and %" PRIu64 " major collections, pauses: %.3fms total, %.3fms max\n",
+            bm->gc.minor_count, bm->gc.major_count,
+            (double) bm->gc.pause_total_ns / 1e6, (double) bm->gc.pause_max_ns / 1e6);
+}
+
+void bm_output_init(Bm *bm, int fd, bool unbuffered)
+{
+    bm->output.ready = true;
+    bm->output.fd = fd;
+    bm->output.unbuffered = unbuffered;
+    bm->output.size = 0;
+}
+
+#ifdef BM_POSIX
+bool bm_output_is_terminal(int fd)
+{
+    return isatty(fd);
+}
+
+// Writes all of the vectors out, retrying the partial writes
+static Err bm_output_writev(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERR_OUTPUT;
+        }
+
+        size_t written = (size_t) n;
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov += 1;
+            count -= 1;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return ERR_OK;
+}
+#else
+bool bm_output_is_terminal(int fd)
+{
+    (void) fd;
+    return false;
+}
+
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+
+// NOTE: only the standard output and error are there without POSIX
+static Err bm_output_writev(int fd, struct iovec *iov, int count)
+{
+    FILE *stream = fd == BM_OUTPUT_STDOUT ? stdout : fd == BM_OUTPUT_STDERR ? stderr : NULL;
+    if (stream == NULL) {
+        return ERR_OUTPUT;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, stream) != iov[i].iov_len) {
+            return ERR_OUTPUT;
+        }
+    }
+
+    return fflush(stream) == 0 ? ERR_OK : ERR_OUTPUT;
+}
+#endif
+
+Err bm_output_restart(Bm *bm)
+{
+    Err err = bm_output_flush(bm);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    if (!bm->output.ready) {
+        bm_output_init(bm, BM_OUTPUT_STDOUT, bm_output_is_terminal(BM_OUTPUT_STDOUT));
+    }
+
+    return ERR_OK;
+}
+
+Err bm_output_flush(Bm *bm)
+{
+    if (bm->output.size == 0) {
+        return ERR_OK;
+    }
+
+    struct iovec iov = {
+        .iov_base = bm->output.data,
+        .iov_len = bm->output.size,
+    };
+    bm->output.size = 0;
+    return bm_output_writev(bm->output.fd, &iov, 1);
+}
+
+Err bm_output_write(Bm *bm, const void *data, size_t size)
+{
+    Bm_Output *output = &bm->output;
+
+    if (size > BM_OUTPUT_CAPACITY - output->size) {
+        // NOTE: a big chunk goes out together with what is buffered in one
+        // system call instead of being copied through the buffer
+        if (size >= BM_OUTPUT_CAPACITY / 2) {
+            struct iovec iov[2] = {
+                {.iov_base = output->data, .iov_len = output->size},
+                {.iov_base = (void *) data, .iov_len = size},
+            };
+            output->size = 0;
+            return bm_output_writev(output->fd, iov, 2);
+        }
+
+        Err err = bm_output_flush(bm);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    memcpy(output->data + output->size, data, size);
+    output->size += size;
+
+    if (output->unbuffered) {
+        return bm_output_flush(bm);
+    }
+
+    return ERR_OK;
+}
+
+static const char bm_output_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Formats the decimal digits of `x` right before `end`, at least `width`
+// of them, and returns where they start
+static char *bm_output_format_u64(char *end, uint64_t x, int width)
+{
+    char *p = end;
+    while (x >= 100) {
+        const uint64_t pair = (x % 100) * 2;
+        x /= 100;
+        p -= 2;
+        p[0] = bm_output_digit_pairs[pair];
+        p[1] = bm_output_digit_pairs[pair + 1];
+    }
+    if (x >= 10) {
+        p -= 2;
+        p[0] = bm_output_digit_pairs[x * 2];
+        p[1] = bm_output_digit_pairs[x * 2 + 1];
+    } else {
+        *--p = (char) ('0' + x);
+    }
+    while (end - p < width) {
+        *--p = '0';
+    }
+    return p;
+}
+
+Err bm_output_u64(Bm *bm, uint64_t x)
+{
+    char buffer[32];
+    char *end = buffer + sizeof(buffer);
+    *--end = '\n';
+    char *begin = bm_output_format_u64(end, x, 1);
+    return bm_output_write(bm, begin, (size_t) (end + 1 - begin));
+}
+
+Err bm_output_i64(Bm *bm, int64_t x)
+{
+    char buffer[32];
+    char *end = buffer + sizeof(buffer);
+    *--end = '\n';
+    const uint64_t magnitude = x < 0 ? 0 - (uint64_t) x : (uint64_t) x;
+    char *begin = bm_output_format_u64(end, magnitude, 1);
+    if (x < 0) {
+        *--begin = '-';
+    }
+    return bm_output_write(bm, begin, (size_t) (end + 1 - begin));
+}
+
+Err bm_output_f64(Bm *bm, double x)
+{
+    uint64_t bits = 0;
+    memcpy(&bits, &x, sizeof(bits));
+    const bool negative = (bits >> 63) != 0;
+    const double magnitude = negative ? -x : x;
+
+    // NOTE: the fast path needs the fraction of the number to be a multiple
+    // of 2^-64, everything else (tiny and huge numbers, nan and inf) is
+    // left to snprintf
+    if (!(magnitude == 0.0 || (magnitude >= 0x1p-11 && magnitude < 0x1p63))) {
+        char buffer[512];
+        int n = snprintf(buffer, sizeof(buffer), "%lf\n", x);
+        if (n < 0) {
+            return ERR_OUTPUT;
+        }
+        return bm_output_write(bm, buffer, (size_t) n < sizeof(buffer) ? (size_t) n : sizeof(buffer) - 1);
+    }
+
+    uint64_t integer = (uint64_t) magnitude;
+    const uint64_t fraction = (uint64_t) ((magnitude - (double) integer) * 0x1p64);
+
+    // fraction * 10^6 / 2^64 with the remainder, without 128 bit integers
+    const uint64_t low = (fraction & 0xFFFFFFFF) * 1000000;
+    const uint64_t high = (fraction >> 32) * 1000000 + (low >> 32);
+    uint64_t digits = high >> 32;
+    const uint64_t remainder = (high << 32) | (low & 0xFFFFFFFF);
+
+    // printf rounds the exact value half to even
+    const uint64_t half = 1ULL << 63;
+    if (remainder > half || (remainder == half && (digits & 1) != 0)) {
+        digits += 1;
+        if (digits == 1000000) {
+            digits = 0;
+            integer += 1;
+        }
+    }
+
+    char buffer[48];
+    char *end = buffer + sizeof(buffer);
+    *--end = '\n';
+    char *begin = bm_output_format_u64(end, digits, 6);
+    *--begin = '.';
+    begin = bm_output_format_u64(begin, integer, 1);
+    if (negative) {
+        *--begin = '-';
+    }
+    return bm_output_write(bm, begin, (size_t) (end + 1 - begin));
+}
+
+Err bm_output_value(Bm *bm, Word value)
+{
+    char buffer[64];
+    int n = 0;
+
+    switch (bm_value_tag(value)) {
+    case 0:
+        return bm_output_f64(bm, value.as_f64);
+    case BM_VALUE_TAG_INT:
+        return bm_output_i64(bm, bm_value_as_int(value));
+    case BM_VALUE_TAG_REF:
+        n = snprintf(buffer, sizeof(buffer), "<ref %" PRIu64 ">\n", (uint64_t) (value.as_u64 & BM_VALUE_PAYLOAD_MASK));
+        break;
+    case BM_VALUE_TAG_PTR:
+        n = snprintf(buffer, sizeof(buffer), "<ptr %" PRIu64 ">\n", (uint64_t) (value.as_u64 & BM_VALUE_PAYLOAD_MASK));
+        break;
+    case BM_VALUE_TAG_IMM:
+        n = snprintf(buffer, sizeof(buffer), "%s\n",
+                     value.as_u64 == BM_VALUE_NIL ? "nil" :
+                     value.as_u64 == BM_VALUE_FALSE ? "false" :
+                     value.as_u64 == BM_VALUE_TRUE ? "true" : "<imm>");
+        break;
+    default:
+        n = snprintf(buffer, sizeof(buffer), "<tag %" PRIX64 ">\n", bm_value_tag(value));
+    }
+
+    return bm_output_write(bm, buffer, (size_t) n);
+}
+
+#ifdef BM_POSIX
+static uint64_t bm_window_page_size(void)
+{
+    const long page_size = sysconf(_SC_PAGESIZE);
+    return page_size > 0 ? (uint64_t) page_size : BM_MEMORY_ALIGNMENT;
+}
+
+static Bm_Window *bm_window_find(Bm *bm, Memory_Addr addr)
+{
+    for (size_t i = 0; i < BM_WINDOWS_CAPACITY; ++i) {
+        if (bm->windows[i].size > 0 && bm->windows[i].addr == addr) {
+            return &bm->windows[i];
+        }
+    }
+    return NULL;
+}
+
+Err bm_window_map(Bm *bm, Memory_Addr addr, const char *file_path,
+                  uint64_t offset, uint64_t size, Bm_Window_Mode mode,
+                  uint64_t *mapped)
+{
+    const uint64_t page_size = bm_window_page_size();
+    *mapped = 0;
+
+    if (mode >= BM_WINDOW_MODES_COUNT || offset % page_size != 0) {
+        return ERR_ILLEGAL_OPERAND;
+    }
+
+    if (addr >= BM_MEMORY_CAPACITY ||
+        (uintptr_t) &bm->memory[addr] % page_size != 0) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    const int fd = open(file_path, mode == BM_WINDOW_SHARED ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return ERR_OK;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (uint64_t) st.st_size <= offset) {
+        close(fd);
+        return ERR_OK;
+    }
+
+    // NOTE: the pages past the end of the file can not be touched, SIGBUS
+    if (size > (uint64_t) st.st_size - offset) {
+        size = (uint64_t) st.st_size - offset;
+    }
+    const uint64_t pages_size = (size + page_size - 1) / page_size * page_size;
+
+    if (pages_size > BM_MEMORY_CAPACITY - addr) {
+        close(fd);
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    Bm_Window *window = NULL;
+    for (size_t i = 0; i < BM_WINDOWS_CAPACITY; ++i) {
+        const Bm_Window *other = &bm->windows[i];
+        if (other->size == 0) {
+            if (window == NULL) {
+                window = &bm->windows[i];
+            }
+        } else if (addr < other->addr + other->size && other->addr < addr + pages_size) {
+            close(fd);
+            return ERR_ILLEGAL_MEMORY_ACCESS;
+        }
+    }
+
+    if (window == NULL) {
+        close(fd);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    int prot = PROT_READ;
+    int flags = MAP_FIXED | MAP_PRIVATE;
+    switch (mode) {
+    // NOTE: a read only mapping would let any write of the guest bring
+    // down the host, so the read windows are private copies as well
+    case BM_WINDOW_READ:
+    case BM_WINDOW_PRIVATE:
+        prot |= PROT_WRITE;
+        break;
+    case BM_WINDOW_SHARED:
+        prot |= PROT_WRITE;
+        flags = MAP_FIXED | MAP_SHARED;
+        break;
+    case BM_WINDOW_MODES_COUNT:
+    default:
+        assert(false && "bm_window_map: unreachable");
+    }
+
+    void *result = mmap(&bm->memory[addr], pages_size, prot, flags, fd, (off_t) offset);
+    // NOTE: the mapping keeps the file open on its own
+    close(fd);
+    if (result == MAP_FAILED) {
+        return ERR_OK;
+    }
+
+    window->addr = addr;
+    window->size = pages_size;
+    window->mode = mode;
+    *mapped = size;
+
+    return ERR_OK;
+}
+
+Err bm_window_sync(Bm *bm, Memory_Addr addr)
+{
+    const Bm_Window *window = bm_window_find(bm, addr);
+    if (window == NULL) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    if (msync(&bm->memory[addr], window->size, MS_SYNC) < 0) {
+        return ERR_OUTPUT;
+    }
+
+    return ERR_OK;
+}
+
+Err bm_window_unmap(Bm *bm, Memory_Addr addr)
+{
+    Bm_Window *window = bm_window_find(bm, addr);
+    if (window == NULL) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    // NOTE: mapping the zero pages over the window puts the memory back
+    // without ever leaving a hole in the middle of Bm that something
+    // else could be mapped into
+    const int fd = open("/dev/zero", O_RDWR);
+    if (fd < 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    void *result = mmap(&bm->memory[addr], window->size,
+                        PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE,
+                        fd, 0);
+    close(fd);
+    if (result == MAP_FAILED) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    window->size = 0;
+
+    return ERR_OK;
+}
+
+Err bm_reader_open(Bm *bm, int fd, Memory_Addr buffer, uint64_t capacity, uint64_t *reader)
+{
+    if (capacity == 0 || buffer >= BM_MEMORY_CAPACITY ||
+        capacity > BM_MEMORY_CAPACITY - buffer) {
+        return ERR_ILLEGAL_MEMORY_ACCESS;
+    }
+
+    for (size_t i = 0; i < BM_READERS_CAPACITY; ++i) {
+        if (!bm->readers[i].used) {
+            bm->readers[i] = (Bm_Reader) {
+                .used = true,
+                .fd = fd,
+                .buffer = buffer,
+                .capacity = capacity,
+            };
+            *reader = i + 1;
+            return ERR_OK;
+        }
+    }
+
+    return ERR_OUT_OF_MEMORY;
+}
+
+static Err bm_reader_get(Bm *bm, uint64_t reader, Bm_Reader **output)
+{
+    if (reader == 0 || reader > BM_READERS_CAPACITY || !bm->readers[reader - 1].used) {
+        return ERR_ILLEGAL_OPERAND;
+    }
+    *output = &bm->readers[reader - 1];
+    return ERR_OK;
+}
+
+// Moves the unread bytes to the beginning of the buffer and reads as much
+// as fits after them
+static Err bm_reader_refill(Bm *bm, Bm_Reader *reader)
+{
+    uint8_t *buffer = &bm->memory[reader->buffer];
+
+    if (reader->begin > 0) {
+        memmove(buffer, buffer + reader->begin, reader->end - reader->begin);
+        reader->end -= reader->begin;
+        reader->begin = 0;
+    }
+
+    if (reader->eof || reader->end == reader->capacity) {
+        return ERR_OK;
+    }
+
+    // NOTE: only one read, a pipe or a terminal may not have any more
+    // bytes for us until the program answers to what it already got
+    ssize_t n = 0;
+    do {
+        n = read(reader->fd, buffer + reader->end, reader->capacity - reader->end);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return ERR_INPUT;
+    }
+
+    if (n == 0) {
+        reader->eof = true;
+    }
+    reader->end += (uint64_t) n;
+
+    return ERR_OK;
+}
+
+Err bm_reader_split(Bm *bm, uint64_t reader_index, uint8_t delim,
+                    Memory_Addr *addr, uint64_t *count, Bm_Split_Status *status)
+{
+    Bm_Reader *reader = NULL;
+    Err err = bm_reader_get(bm, reader_index, &reader);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    // NOTE: only the bytes that were not searched yet are scanned again
+    // after a refill
+    uint64_t scanned = 0;
+    for (;;) {
+        const uint8_t *begin = &bm->memory[reader->buffer + reader->begin];
+        const uint64_t size = reader->end - reader->begin;
+        const uint8_t *end = memchr(begin + scanned, delim, size - scanned);
+
+        if (end != NULL) {
+            *addr = reader->buffer + reader->begin;
+            *count = (uint64_t) (end - begin);
+            *status = BM_SPLIT_DELIM;
+            reader->begin += *count + 1;
+            return ERR_OK;
+        }
+
+        if (reader->eof || size == reader->capacity) {
+            *addr = reader->buffer + reader->begin;
+            *count = size;
+            if (!reader->eof) {
+                *status = BM_SPLIT_TRUNCATED;
+            } else if (size > 0) {
+                *status = BM_SPLIT_LAST;
+            } else {
+                *status = BM_SPLIT_EOF;
+            }
+            reader->begin = reader->end;
+            return ERR_OK;
+        }
+
+        scanned = size;
+        err = bm_reader_refill(bm, reader);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+}
+
+Err bm_reader_read(Bm *bm, uint64_t reader_index, Memory_Addr *addr, uint64_t *count)
+{
+    Bm_Reader *reader = NULL;
+    Err err = bm_reader_get(bm, reader_index, &reader);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    if (reader->begin == reader->end) {
+        err = bm_reader_refill(bm, reader);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    *addr = reader->buffer + reader->begin;
+    *count = reader->end - reader->begin;
+    reader->begin = reader->end;
+
+    return ERR_OK;
+}
+
+Err bm_reader_close(Bm *bm, uint64_t reader_index)
+{
+    Bm_Reader *reader = NULL;
+    Err err = bm_reader_get(bm, reader_index, &reader);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    if (reader->fd != STDIN_FILENO) {
+        close(reader->fd);
+    }
+    reader->used = false;
+
+    return ERR_OK;
+}
+#else
+Err bm_window_map(Bm *bm, Memory_Addr addr, const char *file_path,
+                  uint64_t offset, uint64_t size, Bm_Window_Mode mode,
+                  uint64_t *mapped)
+{
+    (void) bm;
+    (void) addr;
+    (void) file_path;
+    (void) offset;
+    (void) size;
+    (void) mode;
+    *mapped = 0;
+    return ERR_ILLEGAL_OPERAND;
+}
+
+Err bm_window_sync(Bm *bm, Memory_Addr addr)
+{
+    (void) bm;
+    (void) addr;
+    return ERR_ILLEGAL_OPERAND;
+}
+
+Err bm_window_unmap(Bm *bm, Memory_Addr addr)
+{
+    (void) bm;
+    (void) addr;
+    return ERR_ILLEGAL_OPERAND;
+}
+
+Err bm_reader_open(Bm *bm, int fd, Memory_Addr buffer, uint64_t capacity, uint64_t *reader)
+{
+    (void) bm;
+    (void) fd;
+    (void) buffer;
+    (void) capacity;
+    *reader = 0;
+    return ERR_ILLEGAL_OPERAND;
+}
+
+Err bm_reader_split(Bm *bm, uint64_t reader, uint8_t delim,
+                    Memory_Addr *addr, uint64_t *count, Bm_Split_Status *status)
+{
+    (void) bm;
+    (void) reader;
+    (void) delim;
+    *addr = 0;
+    *count = 0;
+    *status = BM_SPLIT_EOF;
+    return ERR_ILLEGAL_OPERAND;
+}
+
+Err bm_reader_read(Bm *bm, uint64_t reader, Memory_Addr *addr, uint64_t *count)
+{
+    (void) bm;
+    (void) reader;
+    *addr = 0;
+    *count = 0;
+    return ERR_ILLEGAL_OPERAND;
+}
+
+Err bm_reader_close(Bm *bm, uint64_t reader)
+{
+    (void) bm;
+    (void) reader;
+    return ERR_ILLEGAL_OPERAND;
+}
+#endif
+
+// NOTE: opens a new file next to `file_path` to be renamed over it once it
+// is written out. The name is unique, so the concurrent writers never
+// share one, except without POSIX where there is no mkstemp().
+static FILE *bm_open_tmp_file(const char *file_path, char *tmp_file_path, size_t size)
+{
+#ifdef BM_POSIX
+    const int n = snprintf(tmp_file_path, size, "%s.XXXXXX", file_path);
+    if (n < 0 || (size_t) n >= size) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    const int fd = mkstemp(tmp_file_path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    FILE *f = fdopen(fd, "wb");
+    if (f == NULL) {
+        close(fd);
+        remove(tmp_file_path);
+    }
+    return f;
+#else
+    const int n = snprintf(tmp_file_path, size, "%s.tmp", file_path);
+    if (n < 0 || (size_t) n >= size) {
+        errno = ERANGE;
+        return NULL;
+    }
+    return fopen(tmp_file_path, "wb");
+#endif
+}
+
+static uint64_t bm_snapshot_layout(void)
+{
+    const uint64_t layout[] = {
+        1, // NOTE: tells the byte orders apart
+        NUMBER_OF_INSTS, sizeof(Inst), sizeof(Word), sizeof(Bm_Heap), sizeof(Bm_Gc),
+        BM_STACK_CAPACITY, BM_PROGRAM_CAPACITY, BM_MEMORY_CAPACITY, BM_MEMORY_ALIGNMENT,
+        BM_RETURNS_CAPACITY, BM_FRAMES_CAPACITY, BM_LOCALS_CAPACITY,
+    };
+    return sv_hash((String_View) {.count = sizeof(layout), .data = (const char *) layout});
+}
+
+static bool bm_snapshot_page_is_zero(const Bm *bm, uint64_t page)
+{
+    const uint64_t *words = (const uint64_t *) &bm->memory[page * BM_MEMORY_ALIGNMENT];
+    uint64_t any = 0;
+    for (size_t i = 0; i < BM_MEMORY_ALIGNMENT / sizeof(*words); ++i) {
+        any |= words[i];
+    }
+    return any == 0;
+}
+
+Err bm_snapshot_save(Bm *bm, const char *file_path)
+{
+    static_assert(BM_MEMORY_CAPACITY % BM_MEMORY_ALIGNMENT == 0,
+                  "The snapshots store the memory by the whole pages");
+    const uint64_t pages_count = BM_MEMORY_CAPACITY / BM_MEMORY_ALIGNMENT;
+
+    Err err = bm_output_flush(bm);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    Bm_Snapshot_Extent extents[BM_MEMORY_CAPACITY / BM_MEMORY_ALIGNMENT];
+    size_t extents_size = 0;
+    for (uint64_t page = 0; page < pages_count; ++page) {
+        if (bm_snapshot_page_is_zero(bm, page)) {
+            continue;
+        }
+
+        if (extents_size > 0 &&
+            extents[extents_size - 1].page + extents[extents_size - 1].pages == page) {
+            extents[extents_size - 1].pages += 1;
+        } else {
+            extents[extents_size++] = (Bm_Snapshot_Extent) {
+                .page = (uint32_t) page,
+                .pages = 1,
+            };
+        }
+    }
+
+    const Bm_Snapshot_Meta meta = {
+        .magic = BM_SNAPSHOT_MAGIC,
+        .version = BM_SNAPSHOT_VERSION,
+        .layout = bm_snapshot_layout(),
+        .natives_size = bm->natives_size,
+        .program_size = bm->program_size,
+        .ip = bm->ip,
+        .halt = bm->halt,
+        .stack_size = bm->stack_size,
+        .returns_size = bm->returns_size,
+        .frames_size = bm->frames_size,
+        .locals_size = bm->locals_size,
+        .extents_size = extents_size,
+    };
+
+    const uint64_t header_size = sizeof(meta)
+        + sizeof(bm->program[0]) * bm->program_size
+        + sizeof(bm->stack[0]) * bm->stack_size
+        + sizeof(bm->returns[0]) * bm->returns_size
+        + sizeof(bm->frames[0]) * bm->frames_size
+        + sizeof(bm->locals[0]) * bm->locals_size
+        + sizeof(bm->heap) + sizeof(bm->gc)
+        + sizeof(extents[0]) * extents_size;
+    uint64_t offset = (header_size + BM_MEMORY_ALIGNMENT - 1) / BM_MEMORY_ALIGNMENT * BM_MEMORY_ALIGNMENT;
+    for (size_t i = 0; i < extents_size; ++i) {
+        extents[i].offset = offset;
+        offset += (uint64_t) extents[i].pages * BM_MEMORY_ALIGNMENT;
+    }
+
+    // NOTE: the memory of a restored VM is still mapped from its snapshot,
+    // truncating that file in place would pull the pages from under it
+    char tmp_file_path[4096];
+    FILE *f = bm_open_tmp_file(file_path, tmp_file_path, sizeof(tmp_file_path));
+    if (f == NULL) {
+        return ERR_OUTPUT;
+    }
+
+    fwrite(&meta, sizeof(meta), 1, f);
+    fwrite(bm->program, sizeof(bm->program[0]), bm->program_size, f);
+    fwrite(bm->stack, sizeof(bm->stack[0]), bm->stack_size, f);
+    fwrite(bm->returns, sizeof(bm->returns[0]), bm->returns_size, f);
+    fwrite(bm->frames, sizeof(bm->frames[0]), bm->frames_size, f);
+    fwrite(bm->locals, sizeof(bm->locals[0]), bm->locals_size, f);
+    fwrite(&bm->heap, sizeof(bm->heap), 1, f);
+    fwrite(&bm->gc, sizeof(bm->gc), 1, f);
+    fwrite(extents, sizeof(extents[0]), extents_size, f);
+
+    static const uint8_t padding[BM_MEMORY_ALIGNMENT] = {0};
+    fwrite(padding, 1, (size_t) (extents_size > 0 ? extents[0].offset - header_size : 0), f);
+    for (size_t i = 0; i < extents_size; ++i) {
+        fwrite(&bm->memory[(uint64_t) extents[i].page * BM_MEMORY_ALIGNMENT], 1,
+               (size_t) extents[i].pages * BM_MEMORY_ALIGNMENT, f);
+    }
+
+    const bool failed = ferror(f);
+    if (fclose(f) != 0 || failed || rename(tmp_file_path, file_path) != 0) {
+        remove(tmp_file_path);
+        return ERR_OUTPUT;
+    }
+
+    return ERR_OK;
+}
+
+#ifdef BM_POSIX
+// NOTE: the heap and the collector follow these addresses without looking
+// at the memory first, so they have to lie within the heap
+static bool bm_snapshot_heap_is_valid(const Bm_Heap *heap, const Bm_Gc *gc)
+{
+    if (heap->start < BM_HEAP_ALIGNMENT || heap->start % BM_HEAP_ALIGNMENT != 0 ||
+        heap->top < heap->start || heap->top > BM_MEMORY_CAPACITY) {
+        return false;
+    }
+
+    Memory_Addr links[BM_HEAP_SIZE_CLASSES + 1];
+    memcpy(links, heap->small, sizeof(heap->small));
+    links[BM_HEAP_SIZE_CLASSES] = heap->large;
+    for (size_t i = 0; i < BM_HEAP_SIZE_CLASSES + 1; ++i) {
+        if (links[i] != 0 &&
+            (links[i] < heap->start + BM_HEAP_HEADER_SIZE || links[i] >= heap->top ||
+             links[i] % BM_HEAP_ALIGNMENT != 0)) {
+            return false;
+        }
+    }
+
+    if (!gc->ready) {
+        return true;
+    }
+
+    if (gc->nursery < heap->start + BM_HEAP_HEADER_SIZE || gc->nursery > heap->top ||
+        heap->top - gc->nursery < BM_GC_NURSERY_SIZE ||
+        gc->nursery_end != gc->nursery + BM_GC_NURSERY_SIZE ||
+        gc->nursery_top < gc->nursery || gc->nursery_top > gc->nursery_end ||
+        gc->gray_size > BM_GC_GRAY_CAPACITY) {
+        return false;
+    }
+
+    if (gc->old != 0 &&
+        (gc->old < heap->start + 8 + BM_GC_HEADER_SIZE || gc->old >= heap->top || gc->old % 8 != 0)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < gc->gray_size; ++i) {
+        if (gc->gray[i] < heap->start + BM_GC_HEADER_SIZE || gc->gray[i] >= heap->top ||
+            gc->gray[i] % 8 != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Err bm_snapshot_restore(Bm *bm, const char *file_path)
+{
+    const int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        return ERR_INPUT;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return ERR_INPUT;
+    }
+
+    const uint64_t size = (uint64_t) st.st_size;
+    if (size < sizeof(Bm_Snapshot_Meta)) {
+        close(fd);
+        return ERR_INVALID_FILE;
+    }
+
+    const uint8_t *data = mmap(NULL, (size_t) size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return ERR_INPUT;
+    }
+
+    Bm_Snapshot_Meta meta = {0};
+    memcpy(&meta, data, sizeof(meta));
+
+    const uint64_t pages_count = BM_MEMORY_CAPACITY / BM_MEMORY_ALIGNMENT;
+    uint64_t header_size = sizeof(meta)
+        + sizeof(bm->heap) + sizeof(bm->gc)
+        + sizeof(bm->program[0]) * meta.program_size
+        + sizeof(bm->stack[0]) * meta.stack_size
+        + sizeof(bm->returns[0]) * meta.returns_size
+        + sizeof(bm->frames[0]) * meta.frames_size
+        + sizeof(bm->locals[0]) * meta.locals_size
+        + sizeof(Bm_Snapshot_Extent) * meta.extents_size;
+    Err err = ERR_OK;
+    if (meta.magic != BM_SNAPSHOT_MAGIC ||
+        meta.version != BM_SNAPSHOT_VERSION ||
+        meta.layout != bm_snapshot_layout() ||
+        meta.program_size > BM_PROGRAM_CAPACITY ||
+        meta.stack_size > BM_STACK_CAPACITY ||
+        meta.returns_size > BM_RETURNS_CAPACITY ||
+        meta.frames_size > BM_FRAMES_CAPACITY ||
+        meta.locals_size > BM_LOCALS_CAPACITY ||
+        meta.extents_size > pages_count ||
+        header_size > size) {
+        err = ERR_INVALID_FILE;
+    } else if (meta.natives_size != bm->natives_size) {
+        err = ERR_ILLEGAL_OPERAND;
+    }
+
+    const uint8_t *cursor = data + sizeof(meta);
+    const Bm_Snapshot_Extent *extents = NULL;
+    Bm_Heap heap = {0};
+    Bm_Gc gc = {0};
+    if (err == ERR_OK) {
+        extents = (const Bm_Snapshot_Extent *) (cursor
+            + sizeof(bm->program[0]) * meta.program_size
+            + sizeof(bm->stack[0]) * meta.stack_size
+            + sizeof(bm->returns[0]) * meta.returns_size
+            + sizeof(bm->frames[0]) * meta.frames_size
+            + sizeof(bm->locals[0]) * meta.locals_size
+            + sizeof(bm->heap) + sizeof(bm->gc));
+        for (uint64_t i = 0; i < meta.extents_size && err == ERR_OK; ++i) {
+            Bm_Snapshot_Extent extent = {0};
+            memcpy(&extent, &extents[i], sizeof(extent));
+            if (extent.page > pages_count || extent.pages > pages_count - extent.page ||
+                extent.offset % BM_MEMORY_ALIGNMENT != 0 || extent.offset > size ||
+                (uint64_t) extent.pages * BM_MEMORY_ALIGNMENT > size - extent.offset) {
+                err = ERR_INVALID_FILE;
+            }
+        }
+
+        // NOTE: `loadl` and `storel` trust the frames to lie within the locals
+        const uint8_t *frames = cursor
+            + sizeof(bm->program[0]) * meta.program_size
+            + sizeof(bm->stack[0]) * meta.stack_size
+            + sizeof(bm->returns[0]) * meta.returns_size;
+        uint64_t base = 0;
+        for (uint64_t i = 0; i < meta.frames_size && err == ERR_OK; ++i) {
+            uint64_t frame = 0;
+            memcpy(&frame, frames + sizeof(frame) * i, sizeof(frame));
+            if (frame < base || frame > meta.locals_size) {
+                err = ERR_INVALID_FILE;
+            }
+            base = frame;
+        }
+
+        const uint8_t *heaps = frames
+            + sizeof(bm->frames[0]) * meta.frames_size
+            + sizeof(bm->locals[0]) * meta.locals_size;
+        memcpy(&heap, heaps, sizeof(heap));
+        memcpy(&gc, heaps + sizeof(heap), sizeof(gc));
+        if (err == ERR_OK && !bm_snapshot_heap_is_valid(&heap, &gc)) {
+            err = ERR_INVALID_FILE;
+        }
+    }
+
+    if (err == ERR_OK) {
+        err = bm_memory_init(bm);
+    }
+
+    if (err == ERR_OK) {
+        err = bm_output_restart(bm);
+    }
+
+    if (err == ERR_OK) {
+        bm_release_resources(bm);
+
+        memcpy(bm->program, cursor, sizeof(bm->program[0]) * meta.program_size);
+        cursor += sizeof(bm->program[0]) * meta.program_size;
+        memcpy(bm->stack, cursor, sizeof(bm->stack[0]) * meta.stack_size);
+        cursor += sizeof(bm->stack[0]) * meta.stack_size;
+        memcpy(bm->returns, cursor, sizeof(bm->returns[0]) * meta.returns_size);
+        cursor += sizeof(bm->returns[0]) * meta.returns_size;
+        memcpy(bm->frames, cursor, sizeof(bm->frames[0]) * meta.frames_size);
+        cursor += sizeof(bm->frames[0]) * meta.frames_size;
+        memcpy(bm->locals, cursor, sizeof(bm->locals[0]) * meta.locals_size);
+        cursor += sizeof(bm->locals[0]) * meta.locals_size;
+        bm->heap = heap;
+        bm->gc = gc;
+
+        bm->program_size = meta.program_size;
+        bm->stack_size = meta.stack_size;
+        bm->returns_size = meta.returns_size;
+        bm->frames_size = meta.frames_size;
+        bm->locals_size = meta.locals_size;
+        memset(bm->caches, 0, sizeof(bm->caches));
+        bm->ip = meta.ip;
+        bm->halt = meta.halt;
+
+        // NOTE: the pages are mapped right from the file when the pages of
+        // the host are the same size, the untouched ones are never read
+        const bool mappable = bm_window_page_size() == BM_MEMORY_ALIGNMENT;
+        memset(bm->memory, 0, BM_MEMORY_CAPACITY);
+        for (uint64_t i = 0; i < meta.extents_size && err == ERR_OK; ++i) {
+            Bm_Snapshot_Extent extent = {0};
+            memcpy(&extent, &extents[i], sizeof(extent));
+            uint8_t *target = &bm->memory[(uint64_t) extent.page * BM_MEMORY_ALIGNMENT];
+            const size_t extent_size = (size_t) extent.pages * BM_MEMORY_ALIGNMENT;
+
+            if (!mappable ||
+                mmap(target, extent_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fd, (off_t) extent.offset) == MAP_FAILED) {
+                memcpy(target, data + extent.offset, extent_size);
+            }
+        }
+    }
+
+    munmap((void *) data, (size_t) size);
+    close(fd);
+
+    return err;
+}
+#else
+Err bm_snapshot_restore(Bm *bm, const char *file_path)
+{
+    (void) bm;
+    (void) file_path;
+    return ERR_ILLEGAL_OPERAND;
+}
+#endif
+
+uint64_t bm_program_hash(const Inst *program, uint64_t program_size)
+{
+    // NOTE: FNV-1a over the fields, the padding of Inst is not hashed
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint64_t i = 0; i < program_size; ++i) {
+        const uint64_t fields[] = {(uint64_t) program[i].type, program[i].operand.as_u64};
+        for (size_t j = 0; j < sizeof(fields) / sizeof(fields[0]); ++j) {
+            for (size_t k = 0; k < sizeof(fields[j]); ++k) {
+                hash ^= (fields[j] >> (k * 8)) & 0xFF;
+                hash *= 1099511628211ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+void bm_save_profile_to_file(const Bm *bm, const Bm_Profile_Entry *profile, const char *file_path)
+{
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    Bm_Profile_Meta meta = {
+        .magic = BM_PROFILE_MAGIC,
+        .version = BM_PROFILE_VERSION,
+        .program_size = bm->program_size,
+        .program_hash = bm_program_hash(bm->program, bm->program_size),
+    };
+
+    fwrite(&meta, sizeof(meta), 1, f);
+    fwrite(profile, sizeof(profile[0]), bm->program_size, f);
+
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    fclose(f);
+}
+
+String_View sv_from_cstr(const char *cstr)
+{
+    return (String_View) {
+        .count = strlen(cstr),
+        .data = cstr,
+    };
+}
+
+String_View sv_trim_left(String_View sv)
+{
+    size_t i = 0;
+    while (i < sv.count && isspace(sv.data[i])) {
+        i += 1;
+    }
+
+    return (String_View) {
+        .count = sv.count - i,
+        .data = sv.data + i,
+    };
+}
+
+String_View sv_trim_right(String_View sv)
+{
+    size_t i = 0;
+    while (i < sv.count && isspace(sv.data[sv.count - 1 - i])) {
+        i += 1;
+    }
+
+    return (String_View) {
+        .count = sv.count - i,
+        .data = sv.data
+    };
+}
+
+String_View sv_trim(String_View sv)
+{
+    return sv_trim_right(sv_trim_left(sv));
+}
+
+String_View sv_chop_by_delim(String_View *sv, char delim)
+{
+    size_t i = 0;
+    while (i < sv->count && sv->data[i] != delim) {
+        i += 1;
+    }
+
+    String_View result = {
+        .count = i,
+        .data = sv->data,
+    };
+
+    if (i < sv->count) {
+        sv->count -= i + 1;
+        sv->data  += i + 1;
+    } else {
+        sv->count -= i;
+        sv->data  += i;
+    }
+
+    return result;
+}
+
+bool sv_eq(String_View a, String_View b)
+{
+    if (a.count != b.count) {
+        return false;
+    } else {
+        return memcmp(a.data, b.data, a.count) == 0;
+    }
+}
+
+// NOTE: 64-bit FNV-1a
+uint64_t sv_hash(String_View sv)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sv.count; ++i) {
+        hash ^= (uint8_t) sv.data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// NOTE: accepts the same integers as strtoull(..., 10) without
+// copying the String_View into a NULL-terminated buffer
+bool sv_parse_u64(String_View sv, uint64_t *output)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (i < sv.count && (sv.data[i] == '-' || sv.data[i] == '+')) {
+        negative = sv.data[i] == '-';
+        i += 1;
+    }
+
+    if (i >= sv.count) {
+        return false;
+    }
+
+    uint64_t result = 0;
+    bool overflow = false;
+    for (; i < sv.count; ++i) {
+        if (!isdigit(sv.data[i])) {
+            return false;
+        }
+
+        uint64_t digit = (uint64_t) (sv.data[i] - '0');
+        if (result > (UINT64_MAX - digit) / 10) {
+            overflow = true;
+        }
+        result = result * 10 + digit;
+    }
+
+    if (overflow) {
+        *output = UINT64_MAX;
+    } else {
+        *output = negative ? 0 - result : result;
+    }
+    return true;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    // NOTE: keep every allocation aligned for any type we put there
+    size = (size + sizeof(Word) - 1) / sizeof(Word) * sizeof(Word);
+
+    // NOTE: regions kept around by arena_reset are reused before
+    // allocating new ones
+    while (arena->last != NULL && arena->last->size + size > arena->last->capacity) {
+        if (arena->last->next == NULL) {
+            break;
+        }
+        arena->last = arena->last->next;
+        arena->last->size = 0;
+    }
+
+    if (arena->last == NULL || arena->last->size + size > arena->last->capacity) {
+        size_t capacity = size > BASM_ARENA_REGION_CAPACITY ? size : BASM_ARENA_REGION_CAPACITY;
+        Region *region = malloc(sizeof(Region) + capacity);
+        if (region == NULL) {
+            return NULL;
+        }
+        region->next = NULL;
+        region->size = 0;
+        region->capacity = capacity;
+        arena->capacity += sizeof(Region) + capacity;
+
+        if (arena->last == NULL) {
+            arena->first = region;
+        } else {
+            // NOTE: regions that were too small for this allocation
+            // stay after the new one and get reused on the next reset
+            region->next = arena->last->next;
+            arena->last->next = region;
+        }
+        arena->last = region;
+    }
+
+    void *result = arena->last->data + arena->last->size;
+    arena->last->size += size;
+    return result;
+}
+
+void arena_reset(Arena *arena)
+{
+    arena->last = arena->first;
+    if (arena->last != NULL) {
+        arena->last->size = 0;
+    }
+}
+
+void arena_free(Arena *arena)
+{
+    Region *region = arena->first;
+    while (region != NULL) {
+        Region *next = region->next;
+        free(region);
+        region = next;
+    }
+
+    arena->first = NULL;
+    arena->last = NULL;
+    arena->capacity = 0;
+}
+
+void *basm_alloc(Basm *basm, size_t size)
+{
+    void *result = arena_alloc(&basm->arena, size);
+    if (result == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate %zu bytes: %s\n",
+                size, strerror(errno));
+        exit(1);
+    }
+    return result;
+}
+
+// NOTE: forgets everything about the previous source but keeps the
+// allocated memory around, so assembling many sources in one process
+// is bounded by the biggest of them
+void basm_reset(Basm *basm)
+{
+    basm->bindings_size = 0;
+    if (basm->bindings_slots != NULL) {
+        memset(basm->bindings_slots, 0,
+               basm->bindings_slots_capacity * sizeof(basm->bindings_slots[0]));
+    }
+    basm->deferred_operands_size = 0;
+    basm->memory_operands_size = 0;
+    basm->exports_size = 0;
+    basm->table_slots_size = 0;
+    basm->program_size = 0;
+    basm->memory_size = 0;
+    basm->memory_capacity = 0;
+    basm->cache_hits = 0;
+    basm->cache_misses = 0;
+    arena_reset(&basm->arena);
+}
+
+void basm_free(Basm *basm)
+{
+    free(basm->bindings);
+    free(basm->bindings_slots);
+    free(basm->deferred_operands);
+    free(basm->memory_operands);
+    free(basm->exports);
+    free(basm->table_slots);
+    free(basm->program);
+    free(basm->memory);
+    arena_free(&basm->arena);
+    memset(basm, 0, sizeof(*basm));
+}
+
+size_t basm_memory_usage(const Basm *basm)
+{
+    return basm->arena.capacity
+        + basm->bindings_capacity * sizeof(basm->bindings[0])
+        + basm->bindings_slots_capacity * sizeof(basm->bindings_slots[0])
+        + basm->deferred_operands_capacity * sizeof(basm->deferred_operands[0])
+        + basm->memory_operands_capacity * sizeof(basm->memory_operands[0])
+        + basm->exports_capacity * sizeof(basm->exports[0])
+        + basm->table_slots_capacity * sizeof(basm->table_slots[0])
+        + basm->program_allocated * sizeof(basm->program[0])
+        + basm->memory_allocated * sizeof(basm->memory[0]);
+}
+
+Inst *basm_push_inst(Basm *basm, Inst_Type type)
+{
+    if (basm->program_size >= BM_PROGRAM_CAPACITY) {
+        fprintf(stderr, "ERROR: program does not fit into %d instructions\n",
+                BM_PROGRAM_CAPACITY);
+        exit(1);
+    }
+
+    if (basm->program_size >= basm->program_allocated) {
+        basm->program_allocated =
+            basm->program_allocated == 0 ? BASM_PROGRAM_INIT_CAPACITY : basm->program_allocated * 2;
+        basm->program = realloc(basm->program, basm->program_allocated * sizeof(basm->program[0]));
+        if (basm->program == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for the program: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    Inst *inst = &basm->program[basm->program_size++];
+    // NOTE: the padding of Inst ends up in the output file
+    memset(inst, 0, sizeof(*inst));
+    inst->type = type;
+    return inst;
+}
+
+static Binding_Slot *basm_binding_slot(const Basm *basm, String_View name, uint64_t hash)
+{
+    size_t mask = basm->bindings_slots_capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Binding_Slot *slot = &basm->bindings_slots[i];
+        if (slot->index == 0 ||
+            (slot->hash == hash && sv_eq(basm->bindings[slot->index - 1].name, name))) {
+            return slot;
+        }
+    }
+}
+
+static void basm_grow_bindings_slots(Basm *basm)
+{
+    Binding_Slot *old_slots = basm->bindings_slots;
+    size_t old_capacity = basm->bindings_slots_capacity;
+
+    basm->bindings_slots_capacity =
+        old_capacity == 0 ? BASM_BINDINGS_INIT_CAPACITY * 2 : old_capacity * 2;
+    basm->bindings_slots = calloc(basm->bindings_slots_capacity, sizeof(basm->bindings_slots[0]));
+    if (basm->bindings_slots == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate memory for bindings: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].index != 0) {
+            Binding_Slot *slot = basm_binding_slot(
+                basm, basm->bindings[old_slots[i].index - 1].name, old_slots[i].hash);
+            *slot = old_slots[i];
+        }
+    }
+
+    free(old_slots);
+}
+
+const Binding *basm_find_binding(const Basm *basm, String_View name)
+{
+    if (basm->bindings_size == 0) {
+        return NULL;
+    }
+
+    const Binding_Slot *slot = basm_binding_slot(basm, name, sv_hash(name));
+    if (slot->index == 0) {
+        return NULL;
+    }
+
+    return &basm->bindings[slot->index - 1];
+}
+
+bool basm_resolve_binding(const Basm *basm, String_View name, Word *output)
+{
+    const Binding *binding = basm_find_binding(basm, name);
+    if (binding == NULL) {
+        return false;
+    }
+
+    *output = binding->value;
+    return true;
+}
+
+bool basm_bind_value(Basm *basm, String_View name, Word value, Binding_Kind kind)
+{
+    // NOTE: the hash index is kept at most half full
+    if ((basm->bindings_size + 1) * 2 > basm->bindings_slots_capacity) {
+        basm_grow_bindings_slots(basm);
+    }
+
+    uint64_t hash = sv_hash(name);
+    Binding_Slot *slot = basm_binding_slot(basm, name, hash);
+    if (slot->index != 0) {
+        return false;
+    }
+
+    if (basm->bindings_size >= basm->bindings_capacity) {
+        basm->bindings_capacity =
+            basm->bindings_capacity == 0 ? BASM_BINDINGS_INIT_CAPACITY : basm->bindings_capacity * 2;
+        basm->bindings = realloc(basm->bindings, basm->bindings_capacity * sizeof(basm->bindings[0]));
+        if (basm->bindings == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for bindings: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    basm->bindings[basm->bindings_size++] = (Binding) {
+        .kind = kind,
+        .name = name,
+        .value = value,
+    };
+    slot->hash = hash;
+    slot->index = basm->bindings_size;
+    return true;
+}
+
+void basm_push_deferred_operand(Basm *basm, Inst_Addr addr, String_View name)
+{
+    if (basm->deferred_operands_size >= basm->deferred_operands_capacity) {
+        basm->deferred_operands_capacity =
+            basm->deferred_operands_capacity == 0
+            ? BASM_DEFERRED_OPERANDS_INIT_CAPACITY
+            : basm->deferred_operands_capacity * 2;
+        basm->deferred_operands = realloc(
+            basm->deferred_operands,
+            basm->deferred_operands_capacity * sizeof(basm->deferred_operands[0]));
+        if (basm->deferred_operands == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for deferred operands: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    basm->deferred_operands[basm->deferred_operands_size++] =
+        (Deferred_Operand) {.addr = addr, .name = name};
+}
+
+void basm_push_memory_operand(Basm *basm, Inst_Addr addr)
+{
+    if (basm->memory_operands_size >= basm->memory_operands_capacity) {
+        basm->memory_operands_capacity =
+            basm->memory_operands_capacity == 0
+            ? BASM_DEFERRED_OPERANDS_INIT_CAPACITY
+            : basm->memory_operands_capacity * 2;
+        basm->memory_operands = realloc(
+            basm->memory_operands,
+            basm->memory_operands_capacity * sizeof(basm->memory_operands[0]));
+        if (basm->memory_operands == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for memory operands: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    basm->memory_operands[basm->memory_operands_size++] = addr;
+}
+
+void basm_push_export(Basm *basm, String_View name)
+{
+    if (basm->exports_size >= basm->exports_capacity) {
+        basm->exports_capacity =
+            basm->exports_capacity == 0 ? BASM_EXPORTS_INIT_CAPACITY : basm->exports_capacity * 2;
+        basm->exports = realloc(basm->exports, basm->exports_capacity * sizeof(basm->exports[0]));
+        if (basm->exports == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for exports: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    basm->exports[basm->exports_size++] = name;
+}
+
+void basm_push_table_slot(Basm *basm, Memory_Addr addr, String_View name)
+{
+    if (basm->table_slots_size >= basm->table_slots_capacity) {
+        basm->table_slots_capacity =
+            basm->table_slots_capacity == 0
+            ? BASM_DEFERRED_OPERANDS_INIT_CAPACITY
+            : basm->table_slots_capacity * 2;
+        basm->table_slots = realloc(
+            basm->table_slots,
+            basm->table_slots_capacity * sizeof(basm->table_slots[0]));
+        if (basm->table_slots == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for table slots: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    basm->table_slots[basm->table_slots_size++] =
+        (Deferred_Operand) {.addr = addr, .name = name};
+}
+
+// NOTE: writes the addresses of the labels into the jump tables, again
+// every time the optimizer moves the labels around
+static void basm_fill_tables(Basm *basm)
+{
+    for (size_t i = 0; i < basm->table_slots_size; ++i) {
+        const Deferred_Operand *slot = &basm->table_slots[i];
+        const Binding *binding = basm_find_binding(basm, slot->name);
+        if (binding == NULL || binding->kind != BINDING_LABEL) {
+            fprintf(stderr, "ERROR: `%.*s` in a jump table is not a label of this program\n",
+                    SV_FORMAT(slot->name));
+            exit(1);
+        }
+        memcpy(basm->memory + slot->addr, &binding->value, sizeof(binding->value));
+    }
+}
+
+Word basm_push_string_to_memory(Basm *basm, String_View sv)
+{
+    assert(basm->memory_size + sv.count <= BM_MEMORY_CAPACITY);
+
+    if (basm->memory_size + sv.count > basm->memory_allocated) {
+        size_t allocated = basm->memory_allocated == 0 ? BASM_MEMORY_INIT_CAPACITY : basm->memory_allocated;
+        while (basm->memory_size + sv.count > allocated) {
+            allocated *= 2;
+        }
+        basm->memory = realloc(basm->memory, allocated);
+        if (basm->memory == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for the memory section: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+        basm->memory_allocated = allocated;
+    }
+
+    Word result = word_u64(basm->memory_size);
+    memcpy(basm->memory + basm->memory_size, sv.data, sv.count);
+    basm->memory_size += sv.count;
+
+    if (basm->memory_size > basm->memory_capacity) {
+        basm->memory_capacity = basm->memory_size;
+    }
+
+    return result;
+}
+
+bool basm_translate_literal(Basm *basm, String_View sv, Word *output)
+{
+    if (sv.count >= 2 && *sv.data == '"' && sv.data[sv.count - 1] == '"') {
+        // TODO: string literals don't support escaped characters
+        sv.data += 1;
+        sv.count -= 2;
+        *output = basm_push_string_to_memory(basm, sv);
+        return true;
+    }
+
+    return basm_parse_number(sv, output);
+}
+
+bool basm_parse_number(String_View sv, Word *output)
+{
+    if (!sv_parse_u64(sv, &output->as_u64)) {
+        // NOTE: most of the operands that are not integers are names,
+        // so they are rejected before reaching strtod
+        size_t i = sv.count > 0 && (*sv.data == '-' || *sv.data == '+') ? 1 : 0;
+        if (i >= sv.count ||
+            !(isdigit(sv.data[i]) || sv.data[i] == '.' ||
+              tolower(sv.data[i]) == 'i' || tolower(sv.data[i]) == 'n')) {
+            return false;
+        }
+
+        char cstr[BASM_LITERAL_MAX_LENGTH];
+        if (sv.count >= sizeof(cstr)) {
+            return false;
+        }
+        memcpy(cstr, sv.data, sv.count);
+        cstr[sv.count] = '\0';
+
+        char *endptr = 0;
+        double result = strtod(cstr, &endptr);
+        if ((size_t) (endptr - cstr) != sv.count) {
+            return false;
+        }
+
+        output->as_f64 = result;
+    }
+    return true;
+}
+
+void basm_save_to_file(Basm *basm, const char *file_path)
+{
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    Bm_File_Meta meta = {
+        .magic = BM_FILE_MAGIC,
+        .version = BM_FILE_VERSION,
+        .program_size = basm->program_size,
+        .memory_size = basm->memory_size,
+        .memory_capacity = basm->memory_capacity,
+    };
+
+    fwrite(&meta, sizeof(meta), 1, f);
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    fwrite(basm->program, sizeof(basm->program[0]), basm->program_size, f);
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    fwrite(basm->memory, sizeof(basm->memory[0]), basm->memory_size, f);
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    fclose(f);
+}
+
+void basm_save_object_to_file(Basm *basm, const char *file_path)
+{
+    // NOTE: the exported symbols come first, followed by the imported
+    // ones in the order of their first use
+    size_t symbols_capacity = basm->exports_size + basm->deferred_operands_size;
+    Bm_Object_Symbol *symbols = basm_alloc(basm, sizeof(symbols[0]) * symbols_capacity);
+    String_View *names = basm_alloc(basm, sizeof(names[0]) * symbols_capacity);
+    size_t symbols_size = 0;
+    uint64_t strings_size = 0;
+
+    for (size_t i = 0; i < basm->exports_size; ++i) {
+        const Binding *binding = basm_find_binding(basm, basm->exports[i]);
+        if (binding == NULL) {
+            fprintf(stderr, "ERROR: exported name `%.*s` is not bound\n",
+                    SV_FORMAT(basm->exports[i]));
+            exit(1);
+        }
+
+        names[symbols_size] = binding->name;
+        symbols[symbols_size++] = (Bm_Object_Symbol) {
+            .type = SYMBOL_EXPORT,
+            .kind = (uint8_t) binding->kind,
+            .value = binding->value.as_u64,
+            .name_offset = strings_size,
+            .name_count = binding->name.count,
+        };
+        strings_size += binding->name.count;
+    }
+
+    size_t relocs_capacity = basm->deferred_operands_size + basm->memory_operands_size +
+        basm->table_slots_size + basm->program_size;
+    Bm_Object_Reloc *relocs = basm_alloc(basm, sizeof(relocs[0]) * relocs_capacity);
+    size_t relocs_size = 0;
+    bool *imported = basm_alloc(basm, sizeof(imported[0]) * basm->program_size);
+    memset(imported, 0, sizeof(imported[0]) * basm->program_size);
+
+    for (size_t i = 0; i < basm->deferred_operands_size; ++i) {
+        const Deferred_Operand *deferred = &basm->deferred_operands[i];
+        const Binding *binding = basm_find_binding(basm, deferred->name);
+
+        if (binding == NULL) {
+            size_t symbol = basm->exports_size;
+            while (symbol < symbols_size && !sv_eq(names[symbol], deferred->name)) {
+                symbol += 1;
+            }
+
+            if (symbol == symbols_size) {
+                names[symbols_size] = deferred->name;
+                symbols[symbols_size++] = (Bm_Object_Symbol) {
+                    .type = SYMBOL_IMPORT,
+                    .name_offset = strings_size,
+                    .name_count = deferred->name.count,
+                };
+                strings_size += deferred->name.count;
+            }
+
+            relocs[relocs_size++] = (Bm_Object_Reloc) {
+                .kind = RELOC_SYMBOL,
+                .addr = deferred->addr,
+                .symbol = symbol,
+            };
+            imported[deferred->addr] = true;
+        } else if (binding->kind == BINDING_LABEL &&
+                   !inst_has_addr_operand(basm->program[deferred->addr].type)) {
+            relocs[relocs_size++] = (Bm_Object_Reloc) {
+                .kind = RELOC_CODE,
+                .addr = deferred->addr,
+            };
+        } else if (binding->kind == BINDING_MEMORY) {
+            relocs[relocs_size++] = (Bm_Object_Reloc) {
+                .kind = RELOC_MEMORY,
+                .addr = deferred->addr,
+            };
+        }
+    }
+
+    // NOTE: the jumps that the optimizer introduces do not refer to any name
+    for (size_t i = 0; i < basm->program_size; ++i) {
+        if (inst_has_addr_operand(basm->program[i].type) && !imported[i]) {
+            relocs[relocs_size++] = (Bm_Object_Reloc) {
+                .kind = RELOC_CODE,
+                .addr = i,
+            };
+        }
+    }
+
+    for (size_t i = 0; i < basm->memory_operands_size; ++i) {
+        relocs[relocs_size++] = (Bm_Object_Reloc) {
+            .kind = RELOC_MEMORY,
+            .addr = basm->memory_operands[i],
+        };
+    }
+
+    for (size_t i = 0; i < basm->table_slots_size; ++i) {
+        relocs[relocs_size++] = (Bm_Object_Reloc) {
+            .kind = RELOC_TABLE,
+            .addr = basm->table_slots[i].addr,
+        };
+    }
+
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    Bm_Object_Meta meta = {
+        .magic = BM_OBJECT_MAGIC,
+        .version = BM_OBJECT_VERSION,
+        .program_size = basm->program_size,
+        .memory_size = basm->memory_size,
+        .memory_capacity = basm->memory_capacity,
+        .symbols_size = symbols_size,
+        .relocs_size = relocs_size,
+        .strings_size = strings_size,
+    };
+
+    fwrite(&meta, sizeof(meta), 1, f);
+    fwrite(basm->program, sizeof(basm->program[0]), basm->program_size, f);
+    fwrite(basm->memory, sizeof(basm->memory[0]), basm->memory_size, f);
+    fwrite(symbols, sizeof(symbols[0]), symbols_size, f);
+    fwrite(relocs, sizeof(relocs[0]), relocs_size, f);
+    for (size_t i = 0; i < symbols_size; ++i) {
+        fwrite(names[i].data, 1, names[i].count, f);
+    }
+
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    fclose(f);
+}
+
+static void basm_unit_push(Basm_Unit *unit, Basm_Entry entry)
+{
+    if (unit->size >= unit->capacity) {
+        unit->capacity = unit->capacity == 0 ? BASM_UNIT_INIT_CAPACITY : unit->capacity * 2;
+        unit->entries = realloc(unit->entries, unit->capacity * sizeof(unit->entries[0]));
+        if (unit->entries == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate memory for the unit: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    unit->entries[unit->size++] = entry;
+}
+
+static bool basm_parse_operand(String_View sv, Basm_Entry *entry)
+{
+    if (sv.count >= 2 && *sv.data == '"' && sv.data[sv.count - 1] == '"') {
+        entry->operand_kind = BASM_OPERAND_STRING;
+        entry->operand = (String_View) {
+            .count = sv.count - 2,
+            .data = sv.data + 1,
+        };
+        return true;
+    }
+
+    if (basm_parse_number(sv, &entry->value)) {
+        entry->operand_kind = BASM_OPERAND_NUMBER;
+        return true;
+    }
+
+    return false;
+}
+
+void basm_parse_unit(String_View input_file_path, String_View source, Basm_Unit *unit)
+{
+    int line_number = 0;
+
+    while (source.count > 0) {
+        String_View line = sv_trim(sv_chop_by_delim(&source, '\n'));
+        line_number += 1;
+        if (line.count > 0 && *line.data != BASM_COMMENT_SYMBOL) {
+            String_View token = sv_trim(sv_chop_by_delim(&line, ' '));
+
+            // Pre-processor
+            if (token.count > 0 && *token.data == BASM_PP_SYMBOL) {
+                token.count -= 1;
+                token.data  += 1;
+                if (sv_eq(token, sv_from_cstr("bind"))) {
+                    line = sv_trim(line);
+                    String_View name = sv_chop_by_delim(&line, ' ');
+                    if (name.count > 0) {
+                        line = sv_trim(line);
+                        String_View value = line;
+                        Basm_Entry entry = {
+                            .kind = BASM_ENTRY_BIND,
+                            .line = line_number,
+                            .name = name,
+                        };
+                        if (!basm_parse_operand(value, &entry)) {
+                            fprintf(stderr,
+                                    "%.*s:%d: ERROR: `%.*s` is not a number",
+                                    SV_FORMAT(input_file_path),
+                                    line_number,
+                                    SV_FORMAT(value));
+                            exit(1);
+                        }
+                        basm_unit_push(unit, entry);
+                    } else {
+                        fprintf(stderr,
+                                "%.*s:%d: ERROR: binding name is not provided\n",
+                                SV_FORMAT(input_file_path), line_number);
+                        exit(1);
+                    }
+                } else if (sv_eq(token, sv_from_cstr("export"))) {
+                    String_View name = sv_trim(line);
+                    if (name.count > 0) {
+                        basm_unit_push(unit, (Basm_Entry) {
+                            .kind = BASM_ENTRY_EXPORT,
+                            .line = line_number,
+                            .name = name,
+                        });
+                    } else {
+                        fprintf(stderr,
+                                "%.*s:%d: ERROR: export name is not provided\n",
+                                SV_FORMAT(input_file_path), line_number);
+                        exit(1);
+                    }
+                } else if (sv_eq(token, sv_from_cstr("table"))) {
+                    line = sv_trim(line);
+                    String_View name = sv_chop_by_delim(&line, ' ');
+                    if (name.count > 0) {
+                        basm_unit_push(unit, (Basm_Entry) {
+                            .kind = BASM_ENTRY_TABLE,
+                            .line = line_number,
+                            .name = name,
+                            .operand = sv_trim(sv_chop_by_delim(&line, BASM_COMMENT_SYMBOL)),
+                        });
+                    } else {
+                        fprintf(stderr,
+                                "%.*s:%d: ERROR: table name is not provided\n",
+                                SV_FORMAT(input_file_path), line_number);
+                        exit(1);
+                    }
+                } else if (sv_eq(token, sv_from_cstr("include"))) {
+                    line = sv_trim(line);
+
+                    if (line.count > 0) {
+                        if (*line.data == '"' && line.data[line.count - 1] == '"') {
+                            line.data  += 1;
+                            line.count -= 2;
+
+                            basm_unit_push(unit, (Basm_Entry) {
+                                .kind = BASM_ENTRY_INCLUDE,
+                                .line = line_number,
+                                .name = line,
+                            });
+                        } else {
+                            fprintf(stderr,
+                                    "%.*s:%d: ERROR: include file path has to be surrounded with quotation marks\n",
+                                    SV_FORMAT(input_file_path), line_number);
+                            exit(1);
+                        }
+                    } else {
+                        fprintf(stderr,
+                                "%.*s:%d: ERROR: include file path is not provided\n",
+                                SV_FORMAT(input_file_path), line_number);
+                        exit(1);
+                    }
+                } else {
+                    fprintf(stderr,
+                            "%.*s:%d: ERROR: unknown pre-processor directive `%.*s`\n",
+                            SV_FORMAT(input_file_path),
+                            line_number,
+                            SV_FORMAT(token));
+                    exit(1);
+
+                }
+            } else {
+                // Label binding
+                if (token.count > 0 && token.data[token.count - 1] == ':') {
+                    basm_unit_push(unit, (Basm_Entry) {
+                        .kind = BASM_ENTRY_LABEL,
+                        .line = line_number,
+                        .name = {
+                            .count = token.count - 1,
+                            .data = token.data
+                        },
+                    });
+
+                    token = sv_trim(sv_chop_by_delim(&line, ' '));
+                }
+
+                // Instruction
+                if (token.count > 0) {
+                    String_View operand = sv_trim(sv_chop_by_delim(&line, BASM_COMMENT_SYMBOL));
+
+                    Inst_Type inst_type = INST_NOP;
+                    if (inst_by_name(token, &inst_type)) {
+                        Basm_Entry entry = {
+                            .kind = BASM_ENTRY_INST,
+                            .inst_type = inst_type,
+                            .line = line_number,
+                        };
+
+                        if (inst_has_operand(inst_type)) {
+                            if (operand.count == 0) {
+                                fprintf(stderr, "%.*s:%d: ERROR: instruction `%.*s` requires an operand\n",
+                                        SV_FORMAT(input_file_path),
+                                        line_number,
+                                        SV_FORMAT(token));
+                                exit(1);
+                            }
+
+                            if (!basm_parse_operand(operand, &entry)) {
+                                entry.operand_kind = BASM_OPERAND_NAME;
+                                entry.operand = operand;
+                            }
+                        }
+
+                        basm_unit_push(unit, entry);
+                    } else {
+                        fprintf(stderr, "%.*s:%d: ERROR: unknown instruction `%.*s`\n",
+                                SV_FORMAT(input_file_path),
+                                line_number,
+                                SV_FORMAT(token));
+                        exit(1);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static Word basm_entry_value(Basm *basm, const Basm_Entry *entry)
+{
+    if (entry->operand_kind == BASM_OPERAND_STRING) {
+        return basm_push_string_to_memory(basm, entry->operand);
+    }
+
+    return entry->value;
+}
+
+void basm_translate_unit(Basm *basm, String_View input_file_path,
+                         const Basm_Unit *unit, size_t level)
+{
+    for (size_t i = 0; i < unit->size; ++i) {
+        const Basm_Entry *entry = &unit->entries[i];
+
+        switch (entry->kind) {
+        case BASM_ENTRY_BIND:
+            if (!basm_bind_value(basm, entry->name, basm_entry_value(basm, entry),
+                                 entry->operand_kind == BASM_OPERAND_STRING ? BINDING_MEMORY : BINDING_CONST)) {
+                // TODO(#51): label redefinition error does not tell where the first label was already defined
+                fprintf(stderr,
+                        "%.*s:%d: ERROR: name `%.*s` is already bound\n",
+                        SV_FORMAT(input_file_path),
+                        entry->line,
+                        SV_FORMAT(entry->name));
+                exit(1);
+            }
+            break;
+
+        case BASM_ENTRY_LABEL:
+            if (!basm_bind_value(basm, entry->name, word_u64(basm->program_size), BINDING_LABEL)) {
+                fprintf(stderr,
+                        "%.*s:%d: ERROR: name `%.*s` is already bound to something\n",
+                        SV_FORMAT(input_file_path),
+                        entry->line,
+                        SV_FORMAT(entry->name));
+                exit(1);
+            }
+            break;
+
+        case BASM_ENTRY_INCLUDE:
+            if (level + 1 >= BASM_MAX_INCLUDE_LEVEL) {
+                fprintf(stderr,
+                        "%.*s:%d: ERROR: exceeded maximum include level\n",
+                        SV_FORMAT(input_file_path), entry->line);
+                exit(1);
+            }
+
+            basm_translate_source(basm, basm_resolve_include(basm, entry->name), level + 1);
+            break;
+
+        case BASM_ENTRY_INST: {
+            if (basm->program_size >= BM_PROGRAM_CAPACITY) {
+                fprintf(stderr, "%.*s:%d: ERROR: program does not fit into %d instructions\n",
+                        SV_FORMAT(input_file_path), entry->line, BM_PROGRAM_CAPACITY);
+                exit(1);
+            }
+
+            const Inst_Addr inst_addr = basm->program_size;
+            Inst *inst = basm_push_inst(basm, entry->inst_type);
+
+            if (entry->operand_kind == BASM_OPERAND_NAME) {
+                basm_push_deferred_operand(basm, inst_addr, entry->operand);
+            } else {
+                inst->operand = basm_entry_value(basm, entry);
+                if (entry->operand_kind == BASM_OPERAND_STRING) {
+                    basm_push_memory_operand(basm, inst_addr);
+                }
+            }
+        } break;
+
+        case BASM_ENTRY_EXPORT:
+            basm_push_export(basm, entry->name);
+            break;
+
+        // NOTE: the number of the entries followed by the entries, which
+        // are filled in once all of the labels are known
+        case BASM_ENTRY_TABLE: {
+            String_View labels = entry->operand;
+            uint64_t count = 0;
+            while (labels.count > 0) {
+                if (sv_trim(sv_chop_by_delim(&labels, ' ')).count > 0) {
+                    count += 1;
+                }
+            }
+
+            if (basm->memory_size + sizeof(count) * (count + 1) > BM_MEMORY_CAPACITY) {
+                fprintf(stderr, "%.*s:%d: ERROR: table `%.*s` does not fit into the memory\n",
+                        SV_FORMAT(input_file_path), entry->line, SV_FORMAT(entry->name));
+                exit(1);
+            }
+
+            const Word table = basm_push_string_to_memory(basm, (String_View) {
+                .count = sizeof(count),
+                .data = (const char *) &count,
+            });
+            labels = entry->operand;
+            while (labels.count > 0) {
+                String_View label = sv_trim(sv_chop_by_delim(&labels, ' '));
+                if (label.count > 0) {
+                    const Word slot = basm_push_string_to_memory(basm, (String_View) {
+                        .count = sizeof(uint64_t),
+                        .data = (const char *) &(uint64_t) {0},
+                    });
+                    basm_push_table_slot(basm, slot.as_u64, label);
+                }
+            }
+
+            if (!basm_bind_value(basm, entry->name, table, BINDING_MEMORY)) {
+                fprintf(stderr,
+                        "%.*s:%d: ERROR: name `%.*s` is already bound\n",
+                        SV_FORMAT(input_file_path),
+                        entry->line,
+                        SV_FORMAT(entry->name));
+                exit(1);
+            }
+        } break;
+
+        default:
+            assert(false && "basm_translate_unit: unreachable");
+            exit(1);
+        }
+    }
+}
+
+String_View basm_resolve_include(Basm *basm, String_View file_path)
+{
+    char *file_path_cstr = basm_alloc(basm, file_path.count + 1);
+    memcpy(file_path_cstr, file_path.data, file_path.count);
+    file_path_cstr[file_path.count] = '\0';
+
+    // NOTE: the path is tried as is first and then relative to every
+    // include path in the order they were added
+    FILE *f = fopen(file_path_cstr, "r");
+    for (size_t i = 0; f == NULL && i < basm->include_paths_size; ++i) {
+        size_t size = strlen(basm->include_paths[i]) + 1 + file_path.count + 1;
+        file_path_cstr = basm_alloc(basm, size);
+        snprintf(file_path_cstr, size, "%s/%.*s",
+                 basm->include_paths[i], SV_FORMAT(file_path));
+        f = fopen(file_path_cstr, "r");
+    }
+
+    if (f == NULL) {
+        // NOTE: basm_slurp_file reports the error
+        return file_path;
+    }
+
+    fclose(f);
+    return sv_from_cstr(file_path_cstr);
+}
+
+void basm_add_include_path(Basm *basm, const char *include_path)
+{
+    assert(basm->include_paths_size < BASM_INCLUDE_PATHS_CAPACITY);
+    basm->include_paths[basm->include_paths_size++] = include_path;
+}
+
+static char *basm_unit_cache_path(Basm *basm, uint64_t hash)
+{
+    size_t size = strlen(basm->cache_dir) + 1 + 16 + strlen(BASM_UNIT_CACHE_EXT) + 1;
+    char *path = basm_alloc(basm, size);
+    snprintf(path, size, "%s/%016" PRIx64 "%s", basm->cache_dir, hash, BASM_UNIT_CACHE_EXT);
+    return path;
+}
+
+static uint64_t basm_unit_layout(void)
+{
+    uint64_t layout[5 + NUMBER_OF_INSTS] = {
+        1, // NOTE: tells the byte orders apart
+        sizeof(Basm_Unit_File_Entry), BASM_ENTRY_TABLE + 1, BASM_OPERAND_NAME + 1, NUMBER_OF_INSTS,
+    };
+    for (size_t i = 0; i < NUMBER_OF_INSTS; ++i) {
+        layout[5 + i] = sv_hash(sv_from_cstr(inst_name((Inst_Type) i)));
+    }
+    return sv_hash((String_View) {.count = sizeof(layout), .data = (const char *) layout});
+}
+
+bool basm_load_unit(Basm *basm, const char *file_path, uint64_t hash, Basm_Unit *unit)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+
+    long file_size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        file_size = ftell(f);
+    }
+
+    Basm_Unit_File_Meta meta = {0};
+    Basm_Unit_File_Entry *file_entries = NULL;
+    bool ok = file_size >= (long) sizeof(meta)
+        && fseek(f, 0, SEEK_SET) == 0
+        && fread(&meta, sizeof(meta), 1, f) == 1
+        && meta.magic == BASM_UNIT_MAGIC
+        && meta.version == BASM_UNIT_VERSION
+        && meta.layout == basm_unit_layout()
+        && meta.hash == hash;
+
+    // NOTE: the sizes come from the file, they are bounded by it before
+    // anything is allocated for them
+    const uint64_t rest = ok ? (uint64_t) file_size - sizeof(meta) : 0;
+    ok = ok
+        && meta.entries_size <= rest / sizeof(file_entries[0])
+        && meta.strings_size <= rest - meta.entries_size * sizeof(file_entries[0]);
+
+    if (ok) {
+        file_entries = malloc(sizeof(file_entries[0]) * meta.entries_size + 1);
+        ok = file_entries != NULL
+            && fread(file_entries, sizeof(file_entries[0]), meta.entries_size, f) == meta.entries_size;
+    }
+
+    char *strings = NULL;
+    if (ok) {
+        strings = basm_alloc(basm, meta.strings_size + 1);
+        ok = fread(strings, 1, meta.strings_size, f) == meta.strings_size;
+    }
+
+    for (uint64_t i = 0; ok && i < meta.entries_size; ++i) {
+        const Basm_Unit_File_Entry *file_entry = &file_entries[i];
+        ok = file_entry->kind <= BASM_ENTRY_TABLE
+            && file_entry->operand_kind <= BASM_OPERAND_NAME
+            && file_entry->inst_type < NUMBER_OF_INSTS
+            && file_entry->name_offset <= meta.strings_size
+            && file_entry->name_count <= meta.strings_size - file_entry->name_offset
+            && file_entry->operand_offset <= meta.strings_size
+            && file_entry->operand_count <= meta.strings_size - file_entry->operand_offset;
+
+        if (ok) {
+            basm_unit_push(unit, (Basm_Entry) {
+                .kind = (Basm_Entry_Kind) file_entry->kind,
+                .operand_kind = (Basm_Operand_Kind) file_entry->operand_kind,
+                .inst_type = (Inst_Type) file_entry->inst_type,
+                .line = (int) file_entry->line,
+                .name = {
+                    .count = file_entry->name_count,
+                    .data = strings + file_entry->name_offset,
+                },
+                .operand = {
+                    .count = file_entry->operand_count,
+                    .data = strings + file_entry->operand_offset,
+                },
+                .value = word_u64(file_entry->value),
+            });
+        }
+    }
+
+    if (!ok) {
+        unit->size = 0;
+    }
+
+    free(file_entries);
+    fclose(f);
+    return ok;
+}
+
+void basm_save_unit(Basm *basm, const char *file_path, uint64_t hash, const Basm_Unit *unit)
+{
+    size_t size = strlen(file_path) + sizeof(".XXXXXX");
+    char *tmp_file_path = basm_alloc(basm, size);
+
+    // NOTE: the cache is only an optimization, so failing to write
+    // it is not an error
+    FILE *f = bm_open_tmp_file(file_path, tmp_file_path, size);
+    if (f == NULL) {
+        fprintf(stderr, "WARNING: Could not write include cache `%s`: %s\n",
+                file_path, strerror(errno));
+        return;
+    }
+
+    Basm_Unit_File_Meta meta = {
+        .magic = BASM_UNIT_MAGIC,
+        .version = BASM_UNIT_VERSION,
+        .layout = basm_unit_layout(),
+        .hash = hash,
+        .entries_size = unit->size,
+    };
+    for (size_t i = 0; i < unit->size; ++i) {
+        meta.strings_size += unit->entries[i].name.count + unit->entries[i].operand.count;
+    }
+    fwrite(&meta, sizeof(meta), 1, f);
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < unit->size; ++i) {
+        const Basm_Entry *entry = &unit->entries[i];
+        Basm_Unit_File_Entry file_entry = {
+            .kind = (uint8_t) entry->kind,
+            .operand_kind = (uint8_t) entry->operand_kind,
+            .inst_type = (uint16_t) entry->inst_type,
+            .line = (uint32_t) entry->line,
+            .value = entry->value.as_u64,
+            .name_offset = offset,
+            .name_count = entry->name.count,
+            .operand_offset = offset + entry->name.count,
+            .operand_count = entry->operand.count,
+        };
+        offset += entry->name.count + entry->operand.count;
+        fwrite(&file_entry, sizeof(file_entry), 1, f);
+    }
+
+    for (size_t i = 0; i < unit->size; ++i) {
+        fwrite(unit->entries[i].name.data, 1, unit->entries[i].name.count, f);
+        fwrite(unit->entries[i].operand.data, 1, unit->entries[i].operand.count, f);
+    }
+
+    bool failed = ferror(f);
+    fclose(f);
+
+    if (failed || rename(tmp_file_path, file_path) != 0) {
+        fprintf(stderr, "WARNING: Could not write include cache `%s`: %s\n",
+                file_path, strerror(errno));
+        remove(tmp_file_path);
+    }
+}
+
+void basm_translate_source(Basm *basm, String_View input_file_path, size_t level)
+{
+    String_View source = basm_slurp_file(basm, input_file_path);
+    Basm_Unit unit = {0};
+
+    // NOTE: only the included files go through the cache since the
+    // root source is the one being worked on
+    if (basm->cache_dir != NULL && level > 0) {
+        uint64_t hash = sv_hash(source);
+        const char *cache_path = basm_unit_cache_path(basm, hash);
+        if (basm_load_unit(basm, cache_path, hash, &unit)) {
+            basm->cache_hits += 1;
+        } else {
+            basm_parse_unit(input_file_path, source, &unit);
+            basm_save_unit(basm, cache_path, hash, &unit);
+            basm->cache_misses += 1;
+        }
+    } else {
+        basm_parse_unit(input_file_path, source, &unit);
+    }
+
+    basm_translate_unit(basm, input_file_path, &unit, level);
+    free(unit.entries);
+
+    // NOTE: the includes are resolved together with the file that
+    // includes them, so they can refer to any name bound in there
+    if (level > 0) {
+        return;
+    }
+
+    // Second pass
+    for (size_t i = 0; i < basm->deferred_operands_size; ++i) {
+        String_View name = basm->deferred_operands[i].name;
+        if (!basm_resolve_binding(
+                basm,
+                name,
+                &basm->program[basm->deferred_operands[i].addr].operand) &&
+            !basm->relocatable) {
+            // TODO(#52): second pass label resolution errors don't report the location in the source code
+            fprintf(stderr, "%.*s: ERROR: unknown binding `%.*s`\n",
+                    SV_FORMAT(input_file_path), SV_FORMAT(name));
+            exit(1);
+        }
+    }
+
+    basm_fill_tables(basm);
+}
+
+typedef struct {
+    Inst inst;
+    // NOTE: the operand is an address in the program and has to be
+    // updated every time the instructions are moved around
+    bool addr;
+    // NOTE: the operand is relocated or imported by the linker, so its
+    // value is not known yet
+    bool fixed;
+    // NOTE: the operand is a string literal, see Basm.memory_operands
+    bool memory;
+    bool leader;
+    bool removed;
+    String_View name;
+} Basm_Opt_Inst;
+
+static bool basm_opt_fold(Inst_Type type, Word a, Word b, Word *output)
+{
+    switch (type) {
+    case INST_PLUSI:  output->as_u64 = a.as_u64 + b.as_u64; return true;
+    case INST_MINUSI: output->as_u64 = a.as_u64 - b.as_u64; return true;
+    case INST_MULTI:  output->as_u64 = a.as_u64 * b.as_u64; return true;
+    case INST_DIVI:
+        if (b.as_u64 == 0) {
+            return false;
+        }
+        output->as_u64 = a.as_u64 / b.as_u64;
+        return true;
+    case INST_PLUSF:  output->as_f64 = a.as_f64 + b.as_f64; return true;
+    case INST_MINUSF: output->as_f64 = a.as_f64 - b.as_f64; return true;
+    case INST_MULTF:  output->as_f64 = a.as_f64 * b.as_f64; return true;
+    case INST_DIVF:   output->as_f64 = a.as_f64 / b.as_f64; return true;
+    case INST_EQ:     output->as_u64 = b.as_u64 == a.as_u64; return true;
+    case INST_GEF:    output->as_u64 = b.as_f64 >= a.as_f64; return true;
+    case INST_ANDB:   output->as_u64 = a.as_u64 & b.as_u64; return true;
+    case INST_ORB:    output->as_u64 = a.as_u64 | b.as_u64; return true;
+    case INST_XOR:    output->as_u64 = a.as_u64 ^ b.as_u64; return true;
+    case INST_SHR:
+    case INST_SHL:
+        // NOTE: the shift is left to the VM when it is undefined in C
+        if (b.as_u64 >= 64) {
+            return false;
+        }
+        output->as_u64 = type == INST_SHR ? a.as_u64 >> b.as_u64 : a.as_u64 << b.as_u64;
+        return true;
+
+    case INST_NOP:
+    case INST_PUSH:
+    case INST_DROP:
+    case INST_DUP:
+    case INST_SWAP:
+    case INST_JMP:
+    case INST_JMP_IF:
+    case INST_RET:
+    case INST_CALL:
+    case INST_NATIVE:
+    case INST_HALT:
+    case INST_NOT:
+    case INST_NOTB:
+    case INST_READ8:
+    case INST_READ16:
+    case INST_READ32:
+    case INST_READ64:
+    case INST_WRITE8:
+    case INST_WRITE16:
+    case INST_WRITE32:
+    case INST_WRITE64:
+    case INST_TCALL:
+    case INST_PLUSV:
+    case INST_MINUSV:
+    case INST_MULTV:
+    case INST_DIVV:
+    case INST_JMP_INT:
+    case INST_JMP_FLOAT:
+    case INST_JMP_REF:
+    case INST_BOXI:
+    case INST_BOXP:
+    case INST_UNBOX:
+    case INST_CALLF:
+    case INST_RETF:
+    case INST_ENTER:
+    case INST_LEAVE:
+    case INST_LOADL:
+    case INST_STOREL:
+    case INST_CALL_INDIRECT:
+    case INST_JMP_TABLE:
+    case NUMBER_OF_INSTS:
+    default:
+        return false;
+    }
+}
+
+static bool basm_opt_is_commutative(Inst_Type type)
+{
+    return type == INST_PLUSI || type == INST_MULTI || type == INST_EQ ||
+        type == INST_ANDB || type == INST_ORB || type == INST_XOR;
+}
+
+// NOTE: the instruction after a call is where the call returns to
+static bool basm_opt_returns_after(Inst_Type type)
+{
+    return type == INST_CALL || type == INST_CALLF || type == INST_CALL_INDIRECT ||
+        inst_is_value_arith(type);
+}
+
+// NOTE: whether the next instruction may run right after this one
+static bool basm_opt_falls_through(Inst_Type type)
+{
+    return type != INST_JMP && type != INST_RET && type != INST_HALT &&
+        type != INST_TCALL && type != INST_RETF;
+}
+
+// NOTE: the labels that the control may come to without any instruction
+// that names them: the exports and the entries of the jump tables
+static size_t basm_opt_entries_size(const Basm *basm)
+{
+    return basm->exports_size + basm->table_slots_size;
+}
+
+static String_View basm_opt_entry(const Basm *basm, size_t i)
+{
+    return i < basm->exports_size
+        ? basm->exports[i]
+        : basm->table_slots[i - basm->exports_size].name;
+}
+
+static void basm_opt_mark_leaders(const Basm *basm, Basm_Opt_Inst *insts, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        insts[i].leader = false;
+    }
+
+    if (size > 0) {
+        insts[0].leader = true;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        if (insts[i].addr && insts[i].inst.operand.as_u64 < size) {
+            insts[insts[i].inst.operand.as_u64].leader = true;
+        }
+
+        // NOTE: `ret` comes back right after the `call`
+        if (basm_opt_returns_after(insts[i].inst.type) &&
+            i + 1 < size) {
+            insts[i + 1].leader = true;
+        }
+    }
+
+    // NOTE: other objects may jump to the exported labels and `jmp_table`
+    // to the labels of the tables
+    for (size_t i = 0; i < basm_opt_entries_size(basm); ++i) {
+        const Binding *binding = basm_find_binding(basm, basm_opt_entry(basm, i));
+        if (binding != NULL && binding->kind == BINDING_LABEL && binding->value.as_u64 < size) {
+            insts[binding->value.as_u64].leader = true;
+        }
+    }
+}
+
+static void basm_opt_remove(Basm_Opt_Inst *inst)
+{
+    inst->removed = true;
+}
+
+// NOTE: a push of a value that is known at this point
+static bool basm_opt_is_const(const Basm_Opt_Inst *inst)
+{
+    return inst->inst.type == INST_PUSH && !inst->addr && !inst->fixed;
+}
+
+static void basm_opt_replace(Basm_Opt_Inst *inst, Inst_Type type, Word operand)
+{
+    inst->inst.type = type;
+    inst->inst.operand = operand;
+    inst->addr = false;
+    inst->fixed = false;
+    inst->memory = false;
+    inst->name = (String_View) {0};
+}
+
+static bool basm_opt_thread_jumps(Basm_Opt_Inst *insts, size_t size)
+{
+    bool changed = false;
+
+    for (size_t i = 0; i < size; ++i) {
+        Inst_Type type = insts[i].inst.type;
+        if (!insts[i].addr || !inst_has_addr_operand(type)) {
+            continue;
+        }
+
+        Inst_Addr target = insts[i].inst.operand.as_u64;
+        String_View name = insts[i].name;
+        for (size_t hops = 0;
+             hops < BASM_OPT_MAX_JUMP_THREADING &&
+                 target < size &&
+                 target != i &&
+                 insts[target].inst.type == INST_JMP &&
+                 insts[target].addr &&
+                 insts[target].inst.operand.as_u64 != target;
+             ++hops) {
+            name = insts[target].name;
+            target = insts[target].inst.operand.as_u64;
+        }
+
+        if (target != insts[i].inst.operand.as_u64) {
+            insts[i].inst.operand.as_u64 = target;
+            insts[i].name = name;
+            changed = true;
+        }
+
+        // NOTE: jumping to `halt` or `ret` is the same as executing them in place
+        if (type == INST_JMP && target < size &&
+            (insts[target].inst.type == INST_HALT || insts[target].inst.type == INST_RET ||
+             insts[target].inst.type == INST_RETF)) {
+            basm_opt_replace(&insts[i], insts[target].inst.type, insts[target].inst.operand);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+static bool basm_opt_peephole(Basm_Opt_Inst *insts, size_t size)
+{
+    bool changed = false;
+
+    size_t i = 0;
+    while (i < size) {
+        Basm_Opt_Inst *a = &insts[i];
+        // NOTE: only the first instruction of a window may be a jump target
+        Basm_Opt_Inst *b = i + 1 < size && !insts[i + 1].leader ? &insts[i + 1] : NULL;
+        Basm_Opt_Inst *c = b != NULL && i + 2 < size && !insts[i + 2].leader ? &insts[i + 2] : NULL;
+
+        if (a->inst.type == INST_NOP ||
+            (a->inst.type == INST_SWAP && a->inst.operand.as_u64 == 0)) {
+            basm_opt_remove(a);
+            changed = true;
+            i += 1;
+        } else if ((a->inst.type == INST_JMP || inst_is_type_test(a->inst.type)) &&
+                   a->addr && a->inst.operand.as_u64 == i + 1) {
+            basm_opt_remove(a);
+            changed = true;
+            i += 1;
+        } else if (a->inst.type == INST_JMP_IF && a->addr && a->inst.operand.as_u64 == i + 1) {
+            basm_opt_replace(a, INST_DROP, word_u64(0));
+            changed = true;
+            i += 1;
+        } else if (b != NULL &&
+                   (a->inst.type == INST_PUSH || a->inst.type == INST_DUP) &&
+                   b->inst.type == INST_DROP) {
+            basm_opt_remove(a);
+            basm_opt_remove(b);
+            changed = true;
+            i += 2;
+        } else if (c != NULL &&
+                   a->inst.type == INST_NOT &&
+                   b->inst.type == INST_NOT &&
+                   c->inst.type == INST_JMP_IF) {
+            // NOTE: `not` turns any value into 0 or 1, the pair is only a
+            // no-op when just the truth of the value is used
+            basm_opt_remove(a);
+            basm_opt_remove(b);
+            changed = true;
+            i += 2;
+        } else if (b != NULL &&
+                   a->inst.type == INST_SWAP &&
+                   b->inst.type == INST_SWAP &&
+                   a->inst.operand.as_u64 == b->inst.operand.as_u64) {
+            basm_opt_remove(a);
+            basm_opt_remove(b);
+            changed = true;
+            i += 2;
+        } else if (b != NULL &&
+                   a->inst.type == INST_SWAP &&
+                   a->inst.operand.as_u64 == 1 &&
+                   basm_opt_is_commutative(b->inst.type)) {
+            basm_opt_remove(a);
+            changed = true;
+            i += 2;
+        } else if (b != NULL && basm_opt_is_const(a) &&
+                   (b->inst.type == INST_NOT || b->inst.type == INST_NOTB)) {
+            Word x = a->inst.operand;
+            basm_opt_replace(a, INST_PUSH,
+                             word_u64(b->inst.type == INST_NOT ? !x.as_u64 : ~x.as_u64));
+            basm_opt_remove(b);
+            changed = true;
+            i += 2;
+        } else if (b != NULL && basm_opt_is_const(a) && b->inst.type == INST_JMP_IF) {
+            if (a->inst.operand.as_u64) {
+                *a = *b;
+                a->inst.type = INST_JMP;
+            } else {
+                basm_opt_remove(a);
+            }
+            basm_opt_remove(b);
+            changed = true;
+            i += 2;
+        } else if (c != NULL &&
+                   a->inst.type == INST_NOT &&
+                   b->inst.type == INST_JMP_IF &&
+                   b->addr &&
+                   b->inst.operand.as_u64 == i + 3 &&
+                   c->inst.type == INST_JMP) {
+            // not; jmp_if L1; jmp L2; L1: => jmp_if L2; L1:
+            *a = *c;
+            a->inst.type = INST_JMP_IF;
+            basm_opt_remove(b);
+            basm_opt_remove(c);
+            changed = true;
+            i += 3;
+        } else if (c != NULL &&
+                   basm_opt_is_const(a) &&
+                   basm_opt_is_const(b) &&
+                   c->inst.type == INST_SWAP &&
+                   c->inst.operand.as_u64 == 1) {
+            const Basm_Opt_Inst t = *a;
+            a->inst = b->inst;
+            a->memory = b->memory;
+            a->name = b->name;
+            b->inst = t.inst;
+            b->memory = t.memory;
+            b->name = t.name;
+            basm_opt_remove(c);
+            changed = true;
+            i += 3;
+        } else if (c != NULL &&
+                   basm_opt_is_const(a) &&
+                   basm_opt_is_const(b) &&
+                   basm_opt_fold(c->inst.type, a->inst.operand, b->inst.operand, &a->inst.operand)) {
+            a->name = (String_View) {0};
+            basm_opt_remove(b);
+            basm_opt_remove(c);
+            changed = true;
+            i += 3;
+        } else if (a->inst.type == INST_JMP || a->inst.type == INST_HALT ||
+                   a->inst.type == INST_RET || a->inst.type == INST_TCALL ||
+                   a->inst.type == INST_RETF) {
+            // Nothing can reach the instructions between here and the next jump target
+            i += 1;
+            while (i < size && !insts[i].leader) {
+                basm_opt_remove(&insts[i]);
+                changed = true;
+                i += 1;
+            }
+        } else {
+            i += 1;
+        }
+    }
+
+    return changed;
+}
+
+static bool basm_opt_inline_emit(Basm_Opt_Inst *body, size_t *body_size, Basm_Opt_Inst inst)
+{
+    if (*body_size >= BASM_OPT_INLINE_MAX_SIZE) {
+        return false;
+    }
+    body[(*body_size)++] = inst;
+    return true;
+}
+
+static bool basm_opt_inline_emit_swap(Basm_Opt_Inst *body, size_t *body_size, uint64_t n)
+{
+    Basm_Opt_Inst swap = {.inst = {.type = INST_SWAP, .operand = word_u64(n)}};
+    return basm_opt_inline_emit(body, body_size, swap);
+}
+
+// NOTE: copies the subroutine at `entry` into `body` rewritten as if the
+// return address was never pushed. The jumps of the body are made relative
+// to its beginning. Returns false if the subroutine cannot be inlined.
+//
+// The depth of the return address is tracked through the body. The
+// subroutine is rejected when it reads, drops or duplicates the return
+// address, when the depth does not agree on the merging paths, when it
+// leaves the body by anything but its only `ret` and when its effect on
+// the stack is not known statically (`call`, `native`, `halt`).
+static bool basm_opt_inline_body(const Basm_Opt_Inst *insts, size_t size,
+                                 Inst_Addr entry, Basm_Opt_Inst *body, size_t *body_size)
+{
+    // NOTE: depth of the return address before each instruction of the
+    // subroutine, -1 if no path has reached it yet
+    int64_t depths[BASM_OPT_INLINE_MAX_SIZE + 1];
+    // NOTE: where each instruction of the subroutine starts in the body
+    size_t offsets[BASM_OPT_INLINE_MAX_SIZE + 1];
+    for (size_t n = 0; n <= BASM_OPT_INLINE_MAX_SIZE; ++n) {
+        depths[n] = -1;
+    }
+
+    uint64_t depth = 0;
+    bool reachable = true;
+    *body_size = 0;
+
+    for (size_t n = 0; n <= BASM_OPT_INLINE_MAX_SIZE && entry + n < size; ++n) {
+        if (depths[n] >= 0) {
+            if (reachable && (uint64_t) depths[n] != depth) {
+                return false;
+            }
+            depth = (uint64_t) depths[n];
+        } else if (!reachable) {
+            return false;
+        }
+        depths[n] = (int64_t) depth;
+        offsets[n] = *body_size;
+        reachable = true;
+
+        Basm_Opt_Inst inst = insts[entry + n];
+        const uint64_t operand = inst.inst.operand.as_u64;
+
+        switch (inst.inst.type) {
+        case INST_NOP:
+            break;
+
+        case INST_PUSH:
+            depth += 1;
+            if (!basm_opt_inline_emit(body, body_size, inst)) {
+                return false;
+            }
+            break;
+
+        case INST_DROP:
+            if (depth < 1) {
+                return false;
+            }
+            depth -= 1;
+            if (!basm_opt_inline_emit(body, body_size, inst)) {
+                return false;
+            }
+            break;
+
+        case INST_DUP:
+            if (operand == depth) {
+                return false;
+            }
+            inst.inst.operand.as_u64 = operand > depth ? operand - 1 : operand;
+            depth += 1;
+            if (!basm_opt_inline_emit(body, body_size, inst)) {
+                return false;
+            }
+            break;
+
+        case INST_SWAP:
+            if (operand == 0) {
+                break;
+            }
+
+            if (depth == 0) {
+                // NOTE: the return address goes down and the rest of the
+                // stack rolls the element from the depth `operand - 1` up
+                for (uint64_t k = 1; k < operand; ++k) {
+                    if (!basm_opt_inline_emit_swap(body, body_size, k)) {
+                        return false;
+                    }
+                }
+                depth = operand;
+            } else if (depth == operand) {
+                // NOTE: the return address goes up and the rest of the
+                // stack rolls the top element down to the depth `operand - 1`
+                for (uint64_t k = operand - 1; k > 0; --k) {
+                    if (!basm_opt_inline_emit_swap(body, body_size, k)) {
+                        return false;
+                    }
+                }
+                depth = 0;
+            } else {
+                inst.inst.operand.as_u64 = operand > depth ? operand - 1 : operand;
+                if (!basm_opt_inline_emit(body, body_size, inst)) {
+                    return false;
+                }
+            }
+            break;
+
+        case INST_PLUSI:
+        case INST_MINUSI:
+        case INST_MULTI:
+        case INST_DIVI:
+        case INST_PLUSF:
+        case INST_MINUSF:
+        case INST_MULTF:
+        case INST_DIVF:
+        case INST_EQ:
+        case INST_GEF:
+        case INST_ANDB:
+        case INST_ORB:
+        case INST_XOR:
+        case INST_SHR:
+        case INST_SHL:
+            if (depth < 2) {
+                return false;
+            }
+            depth -= 1;
+            if (!basm_opt_inline_emit(body, body_size, inst)) {
+                return false;
+            }
+            break;
+
+        case INST_NOT:
+        case INST_NOTB:
+        case INST_READ8:
+        case INST_READ16:
+        case INST_READ32:
+        case INST_READ64:
+            if (depth < 1) {
+                return false;
+            }
+            if (!basm_opt_inline_emit(body, body_size, inst)) {
+                return false;
+            }
+            break;
+
+        case INST_WRITE8:
+        case INST_WRITE16:
+        case INST_WRITE32:
+        case INST_WRITE64:
+            if (depth < 2) {
+                return false;
+            }
+            depth -= 2;
+            if (!basm_opt_inline_emit(body, body_size, inst)) {
+                return false;
+            }
+            break;
+
+        case INST_JMP:
+        case INST_JMP_IF: {
+            if (!inst.addr || operand < entry || operand - entry > BASM_OPT_INLINE_MAX_SIZE) {
+                return false;
+            }
+
+            if (inst.inst.type == INST_JMP_IF) {
+                if (depth < 1) {
+                    return false;
+                }
+                depth -= 1;
+            }
+
+            const size_t target = operand - entry;
+            if (depths[target] >= 0 && (uint64_t) depths[target] != depth) {
+                return false;
+            }
+            depths[target] = (int64_t) depth;
+
+            inst.inst.operand.as_u64 = target;
+            if (!basm_opt_inline_emit(body, body_size, inst)) {
+                return false;
+            }
+            reachable = inst.inst.type == INST_JMP_IF;
+        } break;
+
+        case INST_RET:
+            if (depth != 0) {
+                return false;
+            }
+
+            // NOTE: a jump past the `ret` leaves the body some other way
+            for (size_t k = n + 1; k <= BASM_OPT_INLINE_MAX_SIZE; ++k) {
+                if (depths[k] >= 0) {
+                    return false;
+                }
+            }
+
+            // NOTE: the `ret` itself becomes the fall through out of the body
+            for (size_t k = 0; k < *body_size; ++k) {
+                Inst_Type type = body[k].inst.type;
+                if (body[k].addr && (type == INST_JMP || type == INST_JMP_IF)) {
+                    const size_t target = (size_t) body[k].inst.operand.as_u64;
+                    body[k].inst.operand.as_u64 = target == n ? *body_size : offsets[target];
+                }
+            }
+
+            return true;
+
+        case INST_CALL:
+        case INST_TCALL:
+        case INST_NATIVE:
+        case INST_HALT:
+        case INST_PLUSV:
+        case INST_MINUSV:
+        case INST_MULTV:
+        case INST_DIVV:
+        case INST_JMP_INT:
+        case INST_JMP_FLOAT:
+        case INST_JMP_REF:
+        case INST_BOXI:
+        case INST_BOXP:
+        case INST_UNBOX:
+        case INST_CALLF:
+        case INST_RETF:
+        case INST_ENTER:
+        case INST_LEAVE:
+        case INST_LOADL:
+        case INST_STOREL:
+        case INST_CALL_INDIRECT:
+        case INST_JMP_TABLE:
+        case NUMBER_OF_INSTS:
+        default:
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// NOTE: substitutes the bodies of small leaf subroutines at the call sites.
+// The `ret` of the copy becomes a fall through to the instruction after the
+// `call` and the jumps inside of the body are moved together with it.
+static size_t basm_opt_inline(Basm *basm, Basm_Opt_Inst *insts, size_t size, Inst_Addr *map)
+{
+    Basm_Opt_Inst body[BASM_OPT_INLINE_MAX_SIZE + 1];
+    bool *inlined = basm_alloc(basm, sizeof(inlined[0]) * size);
+    size_t *body_sizes = basm_alloc(basm, sizeof(body_sizes[0]) * size);
+
+    bool changed = false;
+    size_t new_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        inlined[i] = insts[i].inst.type == INST_CALL &&
+            insts[i].addr &&
+            basm_opt_inline_body(insts, size, insts[i].inst.operand.as_u64, body, &body_sizes[i]) &&
+            new_size + body_sizes[i] + (size - i - 1) <= BM_PROGRAM_CAPACITY;
+
+        map[i] = new_size;
+        new_size += inlined[i] ? body_sizes[i] : 1;
+        changed = changed || inlined[i];
+    }
+    map[size] = new_size;
+
+    if (!changed) {
+        return size;
+    }
+
+    Basm_Opt_Inst *result = basm_alloc(basm, sizeof(result[0]) * new_size);
+    for (size_t i = 0; i < size; ++i) {
+        if (!inlined[i]) {
+            result[map[i]] = insts[i];
+            if (insts[i].addr && insts[i].inst.operand.as_u64 <= size) {
+                result[map[i]].inst.operand.as_u64 = map[insts[i].inst.operand.as_u64];
+            }
+            continue;
+        }
+
+        const Inst_Addr entry = insts[i].inst.operand.as_u64;
+        basm_opt_inline_body(insts, size, entry, body, &body_sizes[i]);
+        for (size_t n = 0; n < body_sizes[i]; ++n) {
+            Basm_Opt_Inst *copy = &result[map[i] + n];
+            *copy = body[n];
+            if (!copy->addr || copy->inst.operand.as_u64 > size) {
+                continue;
+            }
+
+            if (copy->inst.type == INST_JMP || copy->inst.type == INST_JMP_IF) {
+                copy->inst.operand.as_u64 += map[i];
+            } else {
+                copy->inst.operand.as_u64 = map[copy->inst.operand.as_u64];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        if (basm->bindings[i].kind == BINDING_LABEL &&
+            basm->bindings[i].value.as_u64 <= size) {
+            basm->bindings[i].value.as_u64 = map[basm->bindings[i].value.as_u64];
+        }
+    }
+
+    memcpy(insts, result, sizeof(result[0]) * new_size);
+    return new_size;
+}
+
+// NOTE: `call X; ret` or `call X; swap 1; ret`. Returns how many results
+// the call leaves above the return address of the caller or -1.
+static int basm_opt_tail_results(const Basm_Opt_Inst *insts, size_t size, size_t i)
+{
+    if (insts[i].inst.type != INST_CALL || !insts[i].addr || insts[i].inst.operand.as_u64 >= size) {
+        return -1;
+    }
+
+    if (i + 1 < size && insts[i + 1].inst.type == INST_RET) {
+        return 0;
+    }
+
+    if (i + 2 < size &&
+        insts[i + 1].inst.type == INST_SWAP &&
+        insts[i + 1].inst.operand.as_u64 == 1 &&
+        insts[i + 2].inst.type == INST_RET) {
+        return 1;
+    }
+
+    return -1;
+}
+
+// NOTE: what is known about the function that starts at some address
+typedef struct {
+    // NOTE: the depth of the return address is known everywhere
+    // the function can reach
+    bool known;
+    // NOTE: every tail call of the function calls the function itself, so
+    // `reach` and `effect` below describe the whole function
+    bool closed;
+    // NOTE: how many values below the return address the function looks at
+    uint64_t reach;
+    // NOTE: how the function changes the stack below the return address
+    int64_t effect;
+} Basm_Opt_Frame;
+
+static bool basm_opt_frame_flow(int64_t *depths, int64_t *levels,
+                                size_t *worklist, size_t *worklist_size,
+                                size_t addr, int64_t depth, int64_t level)
+{
+    if (depths[addr] < 0) {
+        depths[addr] = depth;
+        levels[addr] = level;
+        worklist[(*worklist_size)++] = addr;
+        return true;
+    }
+
+    return depths[addr] == depth && levels[addr] == level;
+}
+
+// NOTE: follows the function from its entry where the return address is on
+// top of the stack and records the depth of the return address and the
+// height of the stack relative to the entry in `depths` and `levels`.
+// The function ends in `ret`, `halt` or a tail call. Anything the depth of
+// the return address cannot be followed through makes it unknown: natives,
+// regular calls, touching the return address or disagreeing paths.
+static Basm_Opt_Frame basm_opt_frame(const Basm_Opt_Inst *insts, size_t size, Inst_Addr entry,
+                                     int64_t *depths, int64_t *levels, size_t *worklist)
+{
+    Basm_Opt_Frame frame = {.closed = true};
+    bool has_effect = false;
+
+    for (size_t i = 0; i < size; ++i) {
+        depths[i] = -1;
+        levels[i] = 0;
+    }
+
+    size_t worklist_size = 0;
+    basm_opt_frame_flow(depths, levels, worklist, &worklist_size, entry, 0, 0);
+
+    while (worklist_size > 0) {
+        const size_t i = worklist[--worklist_size];
+        int64_t depth = depths[i];
+        int64_t level = levels[i];
+        const Inst_Addr target = insts[i].inst.operand.as_u64;
+        const int64_t n = (int64_t) insts[i].inst.operand.as_u64;
+        bool falls = true;
+
+        switch (insts[i].inst.type) {
+        case INST_NOP:
+            break;
+
+        case INST_PUSH:
+            depth += 1;
+            level += 1;
+            break;
+
+        case INST_DROP:
+            if (depth < 1) {
+                return (Basm_Opt_Frame) {0};
+            }
+            depth -= 1;
+            level -= 1;
+            break;
+
+        case INST_DUP:
+            if (n < 0 || n == depth) {
+                return (Basm_Opt_Frame) {0};
+            }
+            if (n > depth && (uint64_t) (n - depth) > frame.reach) {
+                frame.reach = (uint64_t) (n - depth);
+            }
+            depth += 1;
+            level += 1;
+            break;
+
+        case INST_SWAP:
+            if (n < 0) {
+                return (Basm_Opt_Frame) {0};
+            }
+            if (n == 0) {
+                break;
+            }
+            if (depth == 0) {
+                if ((uint64_t) n > frame.reach) {
+                    frame.reach = (uint64_t) n;
+                }
+                depth = n;
+            } else if (depth == n) {
+                depth = 0;
+            } else if (n > depth && (uint64_t) (n - depth) > frame.reach) {
+                frame.reach = (uint64_t) (n - depth);
+            }
+            break;
+
+        case INST_PLUSI:
+        case INST_MINUSI:
+        case INST_MULTI:
+        case INST_DIVI:
+        case INST_PLUSF:
+        case INST_MINUSF:
+        case INST_MULTF:
+        case INST_DIVF:
+        case INST_EQ:
+        case INST_GEF:
+        case INST_ANDB:
+        case INST_ORB:
+        case INST_XOR:
+        case INST_SHR:
+        case INST_SHL:
+            if (depth < 2) {
+                return (Basm_Opt_Frame) {0};
+            }
+            depth -= 1;
+            level -= 1;
+            break;
+
+        case INST_NOT:
+        case INST_NOTB:
+        case INST_READ8:
+        case INST_READ16:
+        case INST_READ32:
+        case INST_READ64:
+            if (depth < 1) {
+                return (Basm_Opt_Frame) {0};
+            }
+            break;
+
+        case INST_WRITE8:
+        case INST_WRITE16:
+        case INST_WRITE32:
+        case INST_WRITE64:
+            if (depth < 2) {
+                return (Basm_Opt_Frame) {0};
+            }
+            depth -= 2;
+            level -= 2;
+            break;
+
+        case INST_JMP:
+            if (!insts[i].addr || target >= size ||
+                !basm_opt_frame_flow(depths, levels, worklist, &worklist_size, target, depth, level)) {
+                return (Basm_Opt_Frame) {0};
+            }
+            falls = false;
+            break;
+
+        case INST_JMP_IF:
+            if (depth < 1) {
+                return (Basm_Opt_Frame) {0};
+            }
+            depth -= 1;
+            level -= 1;
+            if (!insts[i].addr || target >= size ||
+                !basm_opt_frame_flow(depths, levels, worklist, &worklist_size, target, depth, level)) {
+                return (Basm_Opt_Frame) {0};
+            }
+            break;
+
+        case INST_CALL: {
+            const int results = basm_opt_tail_results(insts, size, i);
+            if (results < 0) {
+                return (Basm_Opt_Frame) {0};
+            }
+
+            // NOTE: a tail call of itself has to leave the stack exactly
+            // as the whole function does, that is checked once the reach
+            // and the effect of the function are known
+            if (target != entry) {
+                frame.closed = false;
+            } else if (level != 0) {
+                frame.closed = false;
+            }
+            falls = false;
+        } break;
+
+        case INST_RET:
+            if (depth != 0) {
+                return (Basm_Opt_Frame) {0};
+            }
+            if (has_effect && frame.effect != level) {
+                frame.closed = false;
+            }
+            frame.effect = level;
+            has_effect = true;
+            falls = false;
+            break;
+
+        case INST_HALT:
+            falls = false;
+            break;
+
+        // NOTE: the locals live outside of the stack
+        case INST_ENTER:
+        case INST_LEAVE:
+            break;
+
+        case INST_LOADL:
+            depth += 1;
+            level += 1;
+            break;
+
+        case INST_STOREL:
+            if (depth < 1) {
+                return (Basm_Opt_Frame) {0};
+            }
+            depth -= 1;
+            level -= 1;
+            break;
+
+        case INST_TCALL:
+        case INST_CALLF:
+        case INST_RETF:
+        case INST_CALL_INDIRECT:
+        case INST_JMP_TABLE:
+        case INST_NATIVE:
+        case INST_PLUSV:
+        case INST_MINUSV:
+        case INST_MULTV:
+        case INST_DIVV:
+        case INST_JMP_INT:
+        case INST_JMP_FLOAT:
+        case INST_JMP_REF:
+        case INST_BOXI:
+        case INST_BOXP:
+        case INST_UNBOX:
+        case NUMBER_OF_INSTS:
+        default:
+            return (Basm_Opt_Frame) {0};
+        }
+
+        if (falls &&
+            (i + 1 >= size ||
+             !basm_opt_frame_flow(depths, levels, worklist, &worklist_size, i + 1, depth, level))) {
+            return (Basm_Opt_Frame) {0};
+        }
+    }
+
+    frame.known = true;
+    frame.closed = frame.closed && has_effect;
+
+    for (size_t i = 0; i < size && frame.closed; ++i) {
+        const int results = depths[i] >= 0 ? basm_opt_tail_results(insts, size, i) : -1;
+        if (results >= 0 &&
+            insts[i].inst.operand.as_u64 == entry &&
+            (frame.reach > (uint64_t) depths[i] || frame.effect != results - depths[i])) {
+            frame.closed = false;
+        }
+    }
+
+    return frame;
+}
+
+// NOTE: the function may only be entered through its entry with the return
+// address on top of the stack, otherwise the depths of its frame would be
+// wrong for some of the paths
+static bool basm_opt_frame_sealed(const Basm *basm, const Basm_Opt_Inst *insts, size_t size,
+                                  Inst_Addr entry, const int64_t *depths)
+{
+    if (entry == 0 || depths[0] >= 0) {
+        return false;
+    }
+
+    const Inst_Type before = insts[entry - 1].inst.type;
+    if (depths[entry - 1] < 0 && basm_opt_falls_through(before)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        const Inst_Type type = insts[i].inst.type;
+        const Inst_Addr target = insts[i].inst.operand.as_u64;
+
+        if (depths[i] < 0 && i + 1 < size && depths[i + 1] >= 0 && i + 1 != entry &&
+            basm_opt_falls_through(type)) {
+            return false;
+        }
+
+        if (insts[i].addr && target < size && depths[target] >= 0 &&
+            (target == entry ? type != INST_CALL : depths[i] < 0)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < basm_opt_entries_size(basm); ++i) {
+        const Binding *binding = basm_find_binding(basm, basm_opt_entry(basm, i));
+        if (binding != NULL && binding->kind == BINDING_LABEL &&
+            binding->value.as_u64 < size && binding->value.as_u64 != entry &&
+            depths[binding->value.as_u64] >= 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// NOTE: turns `call X; ret` and `call X; swap 1; ret` into tail calls that
+// reuse the return address of the current function, so recursion in the
+// tail position runs in constant stack space. Both the caller and X have
+// to be simple enough for their frames to be followed: the caller to know
+// how deep its return address is at the call, and X to prove it never
+// looks at it and leaves exactly the right amount of values above it.
+static void basm_opt_tail_calls(Basm *basm, Basm_Opt_Inst *insts, size_t size)
+{
+    Basm_Opt_Frame *frames = basm_alloc(basm, sizeof(frames[0]) * size);
+    bool *entries = basm_alloc(basm, sizeof(entries[0]) * size);
+    bool *targeted = basm_alloc(basm, sizeof(targeted[0]) * size);
+    int64_t *depths = basm_alloc(basm, sizeof(depths[0]) * size);
+    int64_t *levels = basm_alloc(basm, sizeof(levels[0]) * size);
+    size_t *worklist = basm_alloc(basm, sizeof(worklist[0]) * size);
+
+    memset(entries, 0, sizeof(entries[0]) * size);
+    memset(targeted, 0, sizeof(targeted[0]) * size);
+    bool any = false;
+    for (size_t i = 0; i < size; ++i) {
+        const Inst_Addr target = insts[i].inst.operand.as_u64;
+        if (insts[i].addr && target < size) {
+            targeted[target] = true;
+            if (insts[i].inst.type == INST_CALL) {
+                entries[target] = true;
+            }
+        }
+        any = any || basm_opt_tail_results(insts, size, i) >= 0;
+    }
+
+    if (!any) {
+        return;
+    }
+
+    for (size_t i = 0; i < basm_opt_entries_size(basm); ++i) {
+        const Binding *binding = basm_find_binding(basm, basm_opt_entry(basm, i));
+        if (binding != NULL && binding->kind == BINDING_LABEL && binding->value.as_u64 < size) {
+            targeted[binding->value.as_u64] = true;
+        }
+    }
+
+    for (size_t entry = 0; entry < size; ++entry) {
+        frames[entry] = entries[entry]
+            ? basm_opt_frame(insts, size, entry, depths, levels, worklist)
+            : (Basm_Opt_Frame) {0};
+    }
+
+    for (size_t entry = 0; entry < size; ++entry) {
+        if (!frames[entry].known) {
+            continue;
+        }
+
+        basm_opt_frame(insts, size, entry, depths, levels, worklist);
+        if (!basm_opt_frame_sealed(basm, insts, size, entry, depths)) {
+            continue;
+        }
+
+        for (size_t i = 0; i < size; ++i) {
+            const int results = depths[i] >= 0 ? basm_opt_tail_results(insts, size, i) : -1;
+            if (results < 0) {
+                continue;
+            }
+
+            const Basm_Opt_Frame *callee = &frames[insts[i].inst.operand.as_u64];
+            const int64_t depth = depths[i];
+            if (!callee->closed ||
+                callee->reach > (uint64_t) depth ||
+                callee->effect != results - depth ||
+                targeted[i + 1] || depths[i + 1] >= 0 ||
+                (results == 1 && (targeted[i + 2] || depths[i + 2] >= 0))) {
+                continue;
+            }
+
+            // NOTE: the instructions after the call are not reachable
+            // anymore and are removed as dead code later
+            if (depth == 0) {
+                insts[i].inst.type = INST_JMP;
+            } else {
+                insts[i + 1] = insts[i];
+                insts[i + 1].inst.type = INST_TCALL;
+                basm_opt_replace(&insts[i], INST_PUSH, word_u64((uint64_t) depth));
+            }
+        }
+    }
+}
+
+// NOTE: what the dataflow optimizer knows about a single stack slot
+typedef struct {
+    bool known;
+    Word value;
+    // NOTE: slots with the same non-zero id hold the same value. The ids
+    // are only meaningful within a single block.
+    uint64_t id;
+    // NOTE: the `push` or `dup` of the current block that produced the value
+    // (+1). Reset to 0 as soon as anything reads the value, moves it or
+    // reaches below it.
+    size_t origin;
+} Basm_Opt_Value;
+
+typedef struct {
+    size_t start;
+    size_t end;
+    bool reached;
+    bool queued;
+    // NOTE: the top of the stack on the entry to the block, the constants
+    // are the only thing that is carried across the blocks
+    Basm_Opt_Value entry[BASM_OPT_STACK_WINDOW];
+} Basm_Opt_Block;
+
+static void basm_opt_stack_push(Basm_Opt_Value *stack, Basm_Opt_Value value)
+{
+    memmove(stack + 1, stack, sizeof(stack[0]) * (BASM_OPT_STACK_WINDOW - 1));
+    stack[0] = value;
+}
+
+static Basm_Opt_Value basm_opt_stack_pop(Basm_Opt_Value *stack)
+{
+    Basm_Opt_Value value = stack[0];
+    memmove(stack, stack + 1, sizeof(stack[0]) * (BASM_OPT_STACK_WINDOW - 1));
+    stack[BASM_OPT_STACK_WINDOW - 1] = (Basm_Opt_Value) {0};
+    return value;
+}
+
+// NOTE: an instruction accesses the stack down to `depth`
+static void basm_opt_stack_touch(Basm_Opt_Value *stack, uint64_t depth)
+{
+    for (uint64_t k = 0; k <= depth && k < BASM_OPT_STACK_WINDOW; ++k) {
+        stack[k].origin = 0;
+    }
+}
+
+static bool basm_opt_value_eq(Basm_Opt_Value a, Basm_Opt_Value b)
+{
+    return (a.known && b.known && a.value.as_u64 == b.value.as_u64) ||
+        (a.id != 0 && a.id == b.id);
+}
+
+static void basm_opt_transfer(const Basm_Opt_Inst *insts, size_t i, Basm_Opt_Value *stack)
+{
+    const Inst inst = insts[i].inst;
+    const uint64_t n = inst.operand.as_u64;
+    const Basm_Opt_Value fresh = {.id = i + 1, .origin = 0};
+
+    switch (inst.type) {
+    case INST_NOP:
+    case INST_JMP:
+    case INST_RET:
+    case INST_HALT:
+    case INST_RETF:
+    case INST_ENTER:
+    case INST_LEAVE:
+        break;
+
+    case INST_LOADL:
+        basm_opt_stack_push(stack, fresh);
+        break;
+
+    case INST_STOREL:
+        basm_opt_stack_touch(stack, 0);
+        basm_opt_stack_pop(stack);
+        break;
+
+    case INST_PUSH: {
+        Basm_Opt_Value value = fresh;
+        if (basm_opt_is_const(&insts[i])) {
+            value.known = true;
+            value.value = inst.operand;
+        }
+        value.origin = i + 1;
+        basm_opt_stack_push(stack, value);
+    } break;
+
+    case INST_DROP:
+    case INST_JMP_IF:
+    case INST_JMP_TABLE:
+        basm_opt_stack_touch(stack, 0);
+        basm_opt_stack_pop(stack);
+        break;
+
+    case INST_DUP: {
+        basm_opt_stack_touch(stack, n);
+        Basm_Opt_Value value = fresh;
+        if (n < BASM_OPT_STACK_WINDOW) {
+            if (stack[n].id == 0) {
+                stack[n].id = fresh.id;
+            }
+            value = stack[n];
+        }
+        value.origin = i + 1;
+        basm_opt_stack_push(stack, value);
+    } break;
+
+    case INST_SWAP:
+        basm_opt_stack_touch(stack, n);
+        if (n < BASM_OPT_STACK_WINDOW) {
+            Basm_Opt_Value t = stack[0];
+            stack[0] = stack[n];
+            stack[n] = t;
+        } else {
+            stack[0] = (Basm_Opt_Value) {0};
+        }
+        break;
+
+    case INST_PLUSI:
+    case INST_MINUSI:
+    case INST_MULTI:
+    case INST_DIVI:
+    case INST_PLUSF:
+    case INST_MINUSF:
+    case INST_MULTF:
+    case INST_DIVF:
+    case INST_EQ:
+    case INST_GEF:
+    case INST_ANDB:
+    case INST_ORB:
+    case INST_XOR:
+    case INST_SHR:
+    case INST_SHL: {
+        basm_opt_stack_touch(stack, 1);
+        const Basm_Opt_Value b = basm_opt_stack_pop(stack);
+        const Basm_Opt_Value a = basm_opt_stack_pop(stack);
+        Basm_Opt_Value value = fresh;
+        value.known = a.known && b.known && basm_opt_fold(inst.type, a.value, b.value, &value.value);
+        basm_opt_stack_push(stack, value);
+    } break;
+
+    case INST_NOT:
+    case INST_NOTB: {
+        basm_opt_stack_touch(stack, 0);
+        const Basm_Opt_Value a = basm_opt_stack_pop(stack);
+        Basm_Opt_Value value = fresh;
+        if (a.known) {
+            value.known = true;
+            value.value = word_u64(inst.type == INST_NOT ? !a.value.as_u64 : ~a.value.as_u64);
+        }
+        basm_opt_stack_push(stack, value);
+    } break;
+
+    case INST_READ8:
+    case INST_READ16:
+    case INST_READ32:
+    case INST_READ64:
+    case INST_BOXI:
+    case INST_BOXP:
+    case INST_UNBOX:
+        basm_opt_stack_touch(stack, 0);
+        basm_opt_stack_pop(stack);
+        basm_opt_stack_push(stack, fresh);
+        break;
+
+    case INST_JMP_INT:
+    case INST_JMP_FLOAT:
+    case INST_JMP_REF:
+        basm_opt_stack_touch(stack, 0);
+        break;
+
+    case INST_WRITE8:
+    case INST_WRITE16:
+    case INST_WRITE32:
+    case INST_WRITE64:
+        basm_opt_stack_touch(stack, 1);
+        basm_opt_stack_pop(stack);
+        basm_opt_stack_pop(stack);
+        break;
+
+    // NOTE: anything may happen to the stack in there
+    case INST_CALL:
+    case INST_TCALL:
+    case INST_CALLF:
+    case INST_CALL_INDIRECT:
+    case INST_NATIVE:
+    case INST_PLUSV:
+    case INST_MINUSV:
+    case INST_MULTV:
+    case INST_DIVV:
+    case NUMBER_OF_INSTS:
+    default:
+        memset(stack, 0, sizeof(stack[0]) * BASM_OPT_STACK_WINDOW);
+    }
+}
+
+static bool basm_opt_ends_block(Inst_Type type)
+{
+    return type == INST_JMP || type == INST_JMP_IF || type == INST_CALL ||
+        type == INST_TCALL || type == INST_RET || type == INST_HALT ||
+        type == INST_CALLF || type == INST_RETF ||
+        type == INST_CALL_INDIRECT || type == INST_JMP_TABLE ||
+        inst_is_value_arith(type) || inst_is_type_test(type);
+}
+
+static void basm_opt_block_flow(Basm_Opt_Block *block, const Basm_Opt_Value *stack,
+                                size_t *worklist, size_t *worklist_size, size_t index)
+{
+    bool changed = false;
+    for (size_t k = 0; k < BASM_OPT_STACK_WINDOW; ++k) {
+        Basm_Opt_Value value = {
+            .known = stack[k].known,
+            .value = stack[k].value,
+        };
+
+        if (!block->reached) {
+            block->entry[k] = value;
+        } else if (block->entry[k].known &&
+                   !(value.known && value.value.as_u64 == block->entry[k].value.as_u64)) {
+            block->entry[k] = (Basm_Opt_Value) {0};
+            changed = true;
+        }
+    }
+
+    if ((!block->reached || changed) && !block->queued) {
+        block->queued = true;
+        worklist[(*worklist_size)++] = index;
+    }
+    block->reached = true;
+}
+
+static void basm_opt_block_enter(const Basm_Opt_Block *block, size_t size, Basm_Opt_Value *stack)
+{
+    for (size_t k = 0; k < BASM_OPT_STACK_WINDOW; ++k) {
+        stack[k] = block->entry[k];
+        stack[k].id = size + 1 + k;
+        stack[k].origin = 0;
+    }
+}
+
+// NOTE: propagates the constants on the stack across the whole control flow
+// graph and rewrites the program according to what it found:
+// - the blocks that are never reached are removed,
+// - `jmp_if` on a known false condition becomes `drop`,
+// - `dup` of a known constant becomes `push`,
+// - `swap` of two slots holding the same value is removed,
+// - a value that is pushed and dropped without anyone looking at it is
+//   never pushed in the first place.
+static bool basm_opt_dataflow(Basm *basm, Basm_Opt_Inst *insts, size_t size)
+{
+    if (size == 0) {
+        return false;
+    }
+
+    Basm_Opt_Block *blocks = basm_alloc(basm, sizeof(blocks[0]) * size);
+    size_t *block_of = basm_alloc(basm, sizeof(block_of[0]) * size);
+    size_t blocks_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (i == 0 || insts[i].leader || basm_opt_ends_block(insts[i - 1].inst.type)) {
+            blocks[blocks_size++] = (Basm_Opt_Block) {.start = i};
+        }
+        blocks[blocks_size - 1].end = i + 1;
+        block_of[i] = blocks_size - 1;
+    }
+
+    size_t *worklist = basm_alloc(basm, sizeof(worklist[0]) * blocks_size);
+    size_t worklist_size = 0;
+    Basm_Opt_Value stack[BASM_OPT_STACK_WINDOW] = {0};
+
+    // NOTE: the places where the control may come from without any jump
+    // the optimizer can see
+    basm_opt_block_flow(&blocks[0], stack, worklist, &worklist_size, 0);
+    for (size_t i = 0; i < size; ++i) {
+        const Inst_Type type = insts[i].inst.type;
+        const Inst_Addr target = insts[i].inst.operand.as_u64;
+        if (insts[i].addr && target < size &&
+            !inst_has_addr_operand(type)) {
+            basm_opt_block_flow(&blocks[block_of[target]], stack, worklist, &worklist_size, block_of[target]);
+        }
+        if (basm_opt_returns_after(type) && i + 1 < size) {
+            basm_opt_block_flow(&blocks[block_of[i + 1]], stack, worklist, &worklist_size, block_of[i + 1]);
+        }
+    }
+    for (size_t i = 0; i < basm_opt_entries_size(basm); ++i) {
+        const Binding *binding = basm_find_binding(basm, basm_opt_entry(basm, i));
+        if (binding != NULL && binding->kind == BINDING_LABEL && binding->value.as_u64 < size) {
+            const size_t b = block_of[binding->value.as_u64];
+            basm_opt_block_flow(&blocks[b], stack, worklist, &worklist_size, b);
+        }
+    }
+
+    while (worklist_size > 0) {
+        const size_t b = worklist[--worklist_size];
+        blocks[b].queued = false;
+        basm_opt_block_enter(&blocks[b], size, stack);
+
+        const size_t last = blocks[b].end - 1;
+        for (size_t i = blocks[b].start; i < last; ++i) {
+            basm_opt_transfer(insts, i, stack);
+        }
+
+        const Inst_Type type = insts[last].inst.type;
+        const Inst_Addr target = insts[last].inst.operand.as_u64;
+        const bool has_target = insts[last].addr && target < size;
+        const size_t next = last + 1 < size ? block_of[last + 1] : blocks_size;
+        const Basm_Opt_Value top = stack[0];
+
+        // NOTE: the fallback of the arithmetic on tagged values is a call,
+        // `callf` leaves the stack as it is
+        if (basm_opt_returns_after(type)) {
+            if (has_target) {
+                if (type != INST_CALLF) {
+                    basm_opt_stack_push(stack, (Basm_Opt_Value) {0});
+                }
+                basm_opt_block_flow(&blocks[block_of[target]], stack, worklist, &worklist_size, block_of[target]);
+            }
+            continue;
+        }
+
+        basm_opt_transfer(insts, last, stack);
+
+        if (type == INST_JMP || type == INST_TCALL) {
+            if (has_target) {
+                basm_opt_block_flow(&blocks[block_of[target]], stack, worklist, &worklist_size, block_of[target]);
+            }
+        } else if (type == INST_JMP_IF || inst_is_type_test(type)) {
+            const bool known = type == INST_JMP_IF && top.known;
+            if (has_target && !(known && top.value.as_u64 == 0)) {
+                basm_opt_block_flow(&blocks[block_of[target]], stack, worklist, &worklist_size, block_of[target]);
+            }
+            if (next < blocks_size && !(known && top.value.as_u64 != 0)) {
+                basm_opt_block_flow(&blocks[next], stack, worklist, &worklist_size, next);
+            }
+        } else if (type != INST_RET && type != INST_RETF && type != INST_HALT && next < blocks_size) {
+            basm_opt_block_flow(&blocks[next], stack, worklist, &worklist_size, next);
+        }
     }
 
-    String_View result = {
-        .count = i,
-        .data = sv->data,
-    };
+    bool changed = false;
+    for (size_t b = 0; b < blocks_size; ++b) {
+        if (!blocks[b].reached) {
+            for (size_t i = blocks[b].start; i < blocks[b].end; ++i) {
+                basm_opt_remove(&insts[i]);
+            }
+            changed = true;
+            continue;
+        }
 
-    if (i < sv->count) {
-        sv->count -= i + 1;
-        sv->data  += i + 1;
-    } else {
-        sv->count -= i;
-        sv->data  += i;
+        basm_opt_block_enter(&blocks[b], size, stack);
+        for (size_t i = blocks[b].start; i < blocks[b].end; ++i) {
+            Basm_Opt_Inst *inst = &insts[i];
+            const uint64_t n = inst->inst.operand.as_u64;
+
+            if (inst->inst.type == INST_DUP && n < BASM_OPT_STACK_WINDOW && stack[n].known) {
+                basm_opt_replace(inst, INST_PUSH, stack[n].value);
+                changed = true;
+            } else if (inst->inst.type == INST_SWAP && n > 0 && n < BASM_OPT_STACK_WINDOW &&
+                       basm_opt_value_eq(stack[0], stack[n])) {
+                basm_opt_remove(inst);
+                changed = true;
+                continue;
+            } else if (inst->inst.type == INST_JMP_IF && stack[0].known && stack[0].value.as_u64 == 0) {
+                basm_opt_replace(inst, INST_DROP, word_u64(0));
+                changed = true;
+            }
+
+            if (inst->inst.type == INST_DROP && stack[0].origin != 0) {
+                basm_opt_remove(&insts[stack[0].origin - 1]);
+                basm_opt_remove(inst);
+                basm_opt_stack_pop(stack);
+                changed = true;
+                continue;
+            }
+
+            basm_opt_transfer(insts, i, stack);
+        }
     }
 
-    return result;
+    return changed;
 }
 
-bool sv_eq(String_View a, String_View b)
+static size_t basm_opt_compact(Basm *basm, Basm_Opt_Inst *insts, size_t size, Inst_Addr *map)
 {
-    if (a.count != b.count) {
-        return false;
-    } else {
-        return memcmp(a.data, b.data, a.count) == 0;
+    size_t new_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        map[i] = new_size;
+        if (!insts[i].removed) {
+            new_size += 1;
+        }
     }
-}
+    map[size] = new_size;
 
-void *basm_alloc(Basm *basm, size_t size)
-{
-    assert(basm->arena_size + size <= BASM_ARENA_CAPACITY);
+    if (new_size == size) {
+        return size;
+    }
 
-    void *result = basm->arena + basm->arena_size;
-    basm->arena_size += size;
-    return result;
-}
+    for (size_t i = 0; i < size; ++i) {
+        if (insts[i].addr && insts[i].inst.operand.as_u64 <= size) {
+            insts[i].inst.operand.as_u64 = map[insts[i].inst.operand.as_u64];
+        }
+    }
 
-bool basm_resolve_binding(const Basm *basm, String_View name, Word *output)
-{
     for (size_t i = 0; i < basm->bindings_size; ++i) {
-        if (sv_eq(basm->bindings[i].name, name)) {
-            *output = basm->bindings[i].value;
-            return true;
+        if (basm->bindings[i].kind == BINDING_LABEL &&
+            basm->bindings[i].value.as_u64 <= size) {
+            basm->bindings[i].value.as_u64 = map[basm->bindings[i].value.as_u64];
         }
     }
 
-    return false;
+    new_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (!insts[i].removed) {
+            insts[new_size++] = insts[i];
+        }
+    }
+
+    return new_size;
 }
 
-bool basm_bind_value(Basm *basm, String_View name, Word value)
+static void basm_opt_load(const Basm *basm, Basm_Opt_Inst *insts)
 {
-    assert(basm->bindings_size < BASM_BINDINGS_CAPACITY);
-
-    Word ignore = {0};
-    if (basm_resolve_binding(basm, name, &ignore)) {
-        return false;
+    for (size_t i = 0; i < basm->program_size; ++i) {
+        insts[i] = (Basm_Opt_Inst) {
+            .inst = basm->program[i],
+            .addr = inst_has_addr_operand(basm->program[i].type),
+        };
     }
 
-    basm->bindings[basm->bindings_size++] = (Binding) {.name = name, .value = value};
-    return true;
-}
+    for (size_t i = 0; i < basm->deferred_operands_size; ++i) {
+        const Deferred_Operand *deferred = &basm->deferred_operands[i];
+        const Binding *binding = basm_find_binding(basm, deferred->name);
+        insts[deferred->addr].name = deferred->name;
+        if (binding == NULL) {
+            insts[deferred->addr].addr = false;
+            insts[deferred->addr].fixed = true;
+        } else if (binding->kind == BINDING_LABEL) {
+            insts[deferred->addr].addr = true;
+        } else if (binding->kind == BINDING_MEMORY) {
+            insts[deferred->addr].fixed = basm->relocatable;
+        }
+    }
 
-void basm_push_deferred_operand(Basm *basm, Inst_Addr addr, String_View name)
-{
-    assert(basm->deferred_operands_size < BASM_DEFERRED_OPERANDS_CAPACITY);
-    basm->deferred_operands[basm->deferred_operands_size++] =
-        (Deferred_Operand) {.addr = addr, .name = name};
+    for (size_t i = 0; i < basm->memory_operands_size; ++i) {
+        insts[basm->memory_operands[i]].memory = true;
+        insts[basm->memory_operands[i]].fixed = basm->relocatable;
+    }
 }
 
-Word basm_push_string_to_memory(Basm *basm, String_View sv)
+static void basm_opt_store(Basm *basm, const Basm_Opt_Inst *insts, size_t size)
 {
-    assert(basm->memory_size + sv.count <= BM_MEMORY_CAPACITY);
-
-    Word result = word_u64(basm->memory_size);
-    memcpy(basm->memory + basm->memory_size, sv.data, sv.count);
-    basm->memory_size += sv.count;
-
-    if (basm->memory_size > basm->memory_capacity) {
-        basm->memory_capacity = basm->memory_size;
+    basm->deferred_operands_size = 0;
+    basm->memory_operands_size = 0;
+    basm->program_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        Inst *inst = basm_push_inst(basm, insts[i].inst.type);
+        inst->operand = insts[i].inst.operand;
+        if (insts[i].name.count > 0) {
+            basm_push_deferred_operand(basm, i, insts[i].name);
+        }
+        if (insts[i].memory) {
+            basm_push_memory_operand(basm, i);
+        }
     }
 
-    return result;
+    basm_fill_tables(basm);
 }
 
-bool basm_translate_literal(Basm *basm, String_View sv, Word *output)
+void basm_optimize(Basm *basm, int level)
 {
-    if (sv.count >= 2 && *sv.data == '"' && sv.data[sv.count - 1] == '"') {
-        // TODO: string literals don't support escaped characters
-        sv.data += 1;
-        sv.count -= 2;
-        *output = basm_push_string_to_memory(basm, sv);
-    } else {
-        char *cstr = basm_alloc(basm, sv.count + 1);
-        memcpy(cstr, sv.data, sv.count);
-        cstr[sv.count] = '\0';
+    const size_t original_size = basm->program_size;
 
-        char *endptr = 0;
-        Word result = {0};
+    // NOTE: inlining may grow the program up to its capacity
+    Basm_Opt_Inst *insts = basm_alloc(basm, sizeof(insts[0]) * BM_PROGRAM_CAPACITY);
+    Inst_Addr *map = basm_alloc(basm, sizeof(map[0]) * (BM_PROGRAM_CAPACITY + 1));
 
-        result.as_u64 = strtoull(cstr, &endptr, 10);
-        if ((size_t) (endptr - cstr) != sv.count) {
-            result.as_f64 = strtod(cstr, &endptr);
-            if ((size_t) (endptr - cstr) != sv.count) {
-                return false;
-            }
+    basm_opt_load(basm, insts);
+
+    size_t size = basm_opt_inline(basm, insts, original_size, map);
+    basm_opt_tail_calls(basm, insts, size);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        if (level >= 2) {
+            basm_opt_mark_leaders(basm, insts, size);
+            changed = basm_opt_dataflow(basm, insts, size);
+            size = basm_opt_compact(basm, insts, size, map);
         }
 
-        *output = result;
+        basm_opt_mark_leaders(basm, insts, size);
+        changed = basm_opt_thread_jumps(insts, size) || changed;
+        changed = basm_opt_peephole(insts, size) || changed;
+        size = basm_opt_compact(basm, insts, size, map);
     }
-    return true;
+
+    basm_opt_store(basm, insts, size);
 }
 
-void basm_save_to_file(Basm *basm, const char *file_path)
+Bm_Profile_Entry *basm_load_profile(Basm *basm, const char *file_path)
 {
-    FILE *f = fopen(file_path, "wb");
+    FILE *f = fopen(file_path, "rb");
     if (f == NULL) {
         fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
                 file_path, strerror(errno));
         exit(1);
     }
 
-    Bm_File_Meta meta = {
-        .magic = BM_FILE_MAGIC,
-        .version = BM_FILE_VERSION,
-        .program_size = basm->program_size,
-        .memory_size = basm->memory_size,
-        .memory_capacity = basm->memory_capacity,
-    };
-
-    fwrite(&meta, sizeof(meta), 1, f);
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+    Bm_Profile_Meta meta = {0};
+    if (fread(&meta, sizeof(meta), 1, f) < 1) {
+        fprintf(stderr, "ERROR: Could not read meta data from file `%s`: %s\n",
                 file_path, strerror(errno));
         exit(1);
     }
 
-    fwrite(basm->program, sizeof(basm->program[0]), basm->program_size, f);
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
-                file_path, strerror(errno));
+    if (meta.magic != BM_PROFILE_MAGIC) {
+        fprintf(stderr,
+                "ERROR: %s does not appear to be a valid BM profile. "
+                "Unexpected magic %04X. Expected %04X.\n",
+                file_path,
+                meta.magic, BM_PROFILE_MAGIC);
         exit(1);
     }
 
-    fwrite(basm->memory, sizeof(basm->memory[0]), basm->memory_size, f);
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
-                file_path, strerror(errno));
+    if (meta.version != BM_PROFILE_VERSION) {
+        fprintf(stderr,
+                "ERROR: %s: unsupported version of BM profile %d. Expected version %d.\n",
+                file_path,
+                meta.version, BM_PROFILE_VERSION);
+        exit(1);
+    }
+
+    if (meta.program_size != basm->program_size ||
+        meta.program_hash != bm_program_hash(basm->program, basm->program_size)) {
+        fprintf(stderr,
+                "ERROR: %s: the profile was recorded for a different program. "
+                "Build the program with the same flags, but without the profile, "
+                "and record it again.\n",
+                file_path);
+        exit(1);
+    }
+
+    Bm_Profile_Entry *profile = basm_alloc(basm, sizeof(profile[0]) * meta.program_size);
+    if (fread(profile, sizeof(profile[0]), meta.program_size, f) != meta.program_size) {
+        fprintf(stderr, "ERROR: %s: unexpected end of file\n", file_path);
         exit(1);
     }
 
     fclose(f);
+
+    return profile;
 }
 
-void basm_translate_source(Basm *basm, String_View input_file_path, size_t level)
+// NOTE: a run of instructions that the layout moves around as a whole.
+// The instruction after a `call` always stays with the `call`, because
+// that is where `ret` comes back to.
+typedef struct {
+    size_t start;
+    size_t end;
+    uint64_t count;
+    bool placed;
+} Basm_Layout_Unit;
+
+static bool basm_layout_falls_through(Inst_Type type)
 {
-    String_View original_source = basm_slurp_file(basm, input_file_path);
-    String_View source = original_source;
+    return basm_opt_falls_through(type);
+}
 
-    int line_number = 0;
+// NOTE: the unit that starts exactly at the target of the jump the unit
+// ends with or `units_size` if there is no such unit
+static size_t basm_layout_target(const Basm_Opt_Inst *insts, size_t size,
+                                 const Basm_Layout_Unit *units, size_t units_size,
+                                 const size_t *unit_of, size_t u)
+{
+    const Basm_Opt_Inst *last = &insts[units[u].end - 1];
+    if ((last->inst.type != INST_JMP && last->inst.type != INST_JMP_IF) ||
+        !last->addr ||
+        last->inst.operand.as_u64 >= size) {
+        return units_size;
+    }
 
-    // First pass
-    while (source.count > 0) {
-        String_View line = sv_trim(sv_chop_by_delim(&source, '\n'));
-        line_number += 1;
-        if (line.count > 0 && *line.data != BASM_COMMENT_SYMBOL) {
-            String_View token = sv_trim(sv_chop_by_delim(&line, ' '));
+    const size_t target = unit_of[last->inst.operand.as_u64];
+    return units[target].start == last->inst.operand.as_u64 ? target : units_size;
+}
 
-            // Pre-processor
-            if (token.count > 0 && *token.data == BASM_PP_SYMBOL) {
-                token.count -= 1;
-                token.data  += 1;
-                if (sv_eq(token, sv_from_cstr("bind"))) {
-                    line = sv_trim(line);
-                    String_View name = sv_chop_by_delim(&line, ' ');
-                    if (name.count > 0) {
-                        line = sv_trim(line);
-                        String_View value = line;
-                        Word word = {0};
-                        if (!basm_translate_literal(basm, value, &word)) {
-                            fprintf(stderr,
-                                    "%.*s:%d: ERROR: `%.*s` is not a number",
-                                    SV_FORMAT(input_file_path),
-                                    line_number,
-                                    SV_FORMAT(value));
-                            exit(1);
-                        }
+// NOTE: the hottest edge out of the unit that leads to a unit which is not
+// placed yet, preferring the original fall through on ties. The cold code
+// just keeps its original order.
+static size_t basm_layout_successor(const Basm_Opt_Inst *insts, size_t size,
+                                    const Basm_Layout_Unit *units, size_t units_size,
+                                    const size_t *unit_of,
+                                    const Bm_Profile_Entry *profile, size_t u)
+{
+    const size_t last = units[u].end - 1;
+    const Inst_Type type = insts[last].inst.type;
+
+    size_t best = units_size;
+    uint64_t best_weight = 0;
+
+    if (basm_layout_falls_through(type) && u + 1 < units_size && !units[u + 1].placed) {
+        const uint64_t weight = type == INST_JMP_IF
+            ? profile[last].count - profile[last].taken
+            : profile[last].count;
+        if (weight > 0 || units[u].count == 0) {
+            best = u + 1;
+            best_weight = weight;
+        }
+    }
 
-                        if (!basm_bind_value(basm, name, word)) {
-                            // TODO(#51): label redefinition error does not tell where the first label was already defined
-                            fprintf(stderr,
-                                    "%.*s:%d: ERROR: name `%.*s` is already bound\n",
-                                    SV_FORMAT(input_file_path),
-                                    line_number,
-                                    SV_FORMAT(name));
-                            exit(1);
-                        }
-                    } else {
-                        fprintf(stderr,
-                                "%.*s:%d: ERROR: binding name is not provided\n",
-                                SV_FORMAT(input_file_path), line_number);
-                        exit(1);
-                    }
-                } else if (sv_eq(token, sv_from_cstr("include"))) {
-                    line = sv_trim(line);
+    const size_t target = basm_layout_target(insts, size, units, units_size, unit_of, u);
+    if (target < units_size && !units[target].placed && profile[last].taken > best_weight) {
+        best = target;
+    }
 
-                    if (line.count > 0) {
-                        if (*line.data == '"' && line.data[line.count - 1] == '"') {
-                            line.data  += 1;
-                            line.count -= 2;
+    return best;
+}
 
-                            if (level + 1 >= BASM_MAX_INCLUDE_LEVEL) {
-                                fprintf(stderr,
-                                        "%.*s:%d: ERROR: exceeded maximum include level\n",
-                                        SV_FORMAT(input_file_path), line_number);
-                                exit(1);
-                            }
+// NOTE: reorders the basic blocks so the hot paths of the profile fall
+// through and the code that never ran goes to the end of the program
+void basm_layout(Basm *basm, const Bm_Profile_Entry *profile)
+{
+    const size_t size = basm->program_size;
+    if (size == 0) {
+        return;
+    }
 
-                            basm_translate_source(basm, line, level + 1);
-                        } else {
-                            fprintf(stderr,
-                                    "%.*s:%d: ERROR: include file path has to be surrounded with quotation marks\n",
-                                    SV_FORMAT(input_file_path), line_number);
-                            exit(1);
-                        }
-                    } else {
-                        fprintf(stderr,
-                                "%.*s:%d: ERROR: include file path is not provided\n",
-                                SV_FORMAT(input_file_path), line_number);
-                        exit(1);
-                    }
-                } else {
-                    fprintf(stderr,
-                            "%.*s:%d: ERROR: unknown pre-processor directive `%.*s`\n",
-                            SV_FORMAT(input_file_path),
-                            line_number,
-                            SV_FORMAT(token));
-                    exit(1);
+    Basm_Opt_Inst *insts = basm_alloc(basm, sizeof(insts[0]) * size);
+    basm_opt_load(basm, insts);
+    basm_opt_mark_leaders(basm, insts, size);
+
+    Basm_Layout_Unit *units = basm_alloc(basm, sizeof(units[0]) * size);
+    size_t *unit_of = basm_alloc(basm, sizeof(unit_of[0]) * size);
+    size_t units_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        const Inst_Type prev = i > 0 ? insts[i - 1].inst.type : INST_HALT;
+        if (i == 0 ||
+            !basm_layout_falls_through(prev) ||
+            prev == INST_JMP_IF ||
+            (insts[i].leader && !basm_opt_returns_after(prev))) {
+            units[units_size++] = (Basm_Layout_Unit) {
+                .start = i,
+                .count = profile[i].count,
+            };
+        }
+        units[units_size - 1].end = i + 1;
+        unit_of[i] = units_size - 1;
+    }
 
-                }
-            } else {
-                // Label binding
-                if (token.count > 0 && token.data[token.count - 1] == ':') {
-                    String_View label = {
-                        .count = token.count - 1,
-                        .data = token.data
-                    };
+    // NOTE: the entry point stays first, the rest of the chains start at
+    // the hottest unit that is not placed yet
+    size_t *order = basm_alloc(basm, sizeof(order[0]) * units_size);
+    size_t order_size = 0;
+    size_t seed = 0;
+    while (seed < units_size) {
+        for (size_t u = seed; u < units_size && !units[u].placed;
+             u = basm_layout_successor(insts, size, units, units_size, unit_of, profile, u)) {
+            units[u].placed = true;
+            order[order_size++] = u;
+        }
 
-                    if (!basm_bind_value(basm, label, word_u64(basm->program_size))) {
-                        fprintf(stderr,
-                                "%.*s:%d: ERROR: name `%.*s` is already bound to something\n",
-                                SV_FORMAT(input_file_path),
-                                line_number,
-                                SV_FORMAT(label));
-                        exit(1);
-                    }
+        seed = units_size;
+        for (size_t u = 0; u < units_size; ++u) {
+            if (!units[u].placed && (seed == units_size || units[u].count > units[seed].count)) {
+                seed = u;
+            }
+        }
+    }
 
-                    token = sv_trim(sv_chop_by_delim(&line, ' '));
-                }
+    // NOTE: every unit gets at most one extra instruction to fix up its exit
+    if (size + units_size > BM_PROGRAM_CAPACITY) {
+        return;
+    }
 
-                // Instruction
-                if (token.count > 0) {
-                    String_View operand = sv_trim(sv_chop_by_delim(&line, BASM_COMMENT_SYMBOL));
+    Basm_Opt_Inst *result = basm_alloc(basm, sizeof(result[0]) * (size + units_size));
+    Inst_Addr *map = basm_alloc(basm, sizeof(map[0]) * (size + 1));
+    size_t new_size = 0;
 
-                    Inst_Type inst_type = INST_NOP;
-                    if (inst_by_name(token, &inst_type)) {
-                        assert(basm->program_size < BM_PROGRAM_CAPACITY);
-                        basm->program[basm->program_size].type = inst_type;
+    for (size_t k = 0; k < order_size; ++k) {
+        const size_t u = order[k];
+        const size_t next = k + 1 < order_size ? order[k + 1] : units_size;
+        // NOTE: the original fall through, `units_size` is the end of the program
+        const size_t fall = u + 1;
+        const Inst_Addr fall_addr = units[u].end;
 
-                        if (inst_has_operand(inst_type)) {
-                            if (operand.count == 0) {
-                                fprintf(stderr, "%.*s:%d: ERROR: instruction `%.*s` requires an operand\n",
-                                        SV_FORMAT(input_file_path),
-                                        line_number,
-                                        SV_FORMAT(token));
-                                exit(1);
-                            }
+        for (size_t i = units[u].start; i < units[u].end; ++i) {
+            map[i] = new_size;
+            result[new_size++] = insts[i];
+        }
 
-                            if (!basm_translate_literal(
-                                    basm,
-                                    operand,
-                                    &basm->program[basm->program_size].operand)) {
-                                basm_push_deferred_operand(
-                                    basm, basm->program_size, operand);
-                            }
-                        }
+        const size_t last = units[u].end - 1;
+        const Basm_Opt_Inst jmp_fall = {
+            .inst = {.type = INST_JMP, .operand = word_u64(fall_addr)},
+            .addr = true,
+        };
 
-                        basm->program_size += 1;
-                    } else {
-                        fprintf(stderr, "%.*s:%d: ERROR: unknown instruction `%.*s`\n",
-                                SV_FORMAT(input_file_path),
-                                line_number,
-                                SV_FORMAT(token));
-                        exit(1);
-                    }
+        switch (insts[last].inst.type) {
+        case INST_JMP:
+            if (basm_layout_target(insts, size, units, units_size, unit_of, u) == next) {
+                new_size -= 1;
+            }
+            break;
+
+        case INST_JMP_IF:
+            if (fall == next) {
+                break;
+            }
+
+            if (next < units_size &&
+                basm_layout_target(insts, size, units, units_size, unit_of, u) == next) {
+                // NOTE: the branch is inverted so the taken path falls through
+                Basm_Opt_Inst jmp_if = insts[last];
+                jmp_if.inst.operand = word_u64(fall_addr);
+                jmp_if.name = (String_View) {0};
+
+                if (last > units[u].start &&
+                    insts[last - 1].inst.type == INST_NOT &&
+                    !insts[last].leader) {
+                    new_size -= 1;
+                    map[last] = new_size - 1;
+                    result[new_size - 1] = jmp_if;
+                } else {
+                    basm_opt_replace(&result[new_size - 1], INST_NOT, word_u64(0));
+                    result[new_size++] = jmp_if;
                 }
+            } else {
+                result[new_size++] = jmp_fall;
+            }
+            break;
+
+        case INST_RET:
+        case INST_HALT:
+        case INST_TCALL:
+        case INST_RETF:
+            break;
+
+        case INST_NOP:
+        case INST_PUSH:
+        case INST_DROP:
+        case INST_DUP:
+        case INST_SWAP:
+        case INST_PLUSI:
+        case INST_MINUSI:
+        case INST_MULTI:
+        case INST_DIVI:
+        case INST_PLUSF:
+        case INST_MINUSF:
+        case INST_MULTF:
+        case INST_DIVF:
+        case INST_CALL:
+        case INST_NATIVE:
+        case INST_EQ:
+        case INST_NOT:
+        case INST_GEF:
+        case INST_ANDB:
+        case INST_ORB:
+        case INST_XOR:
+        case INST_SHR:
+        case INST_SHL:
+        case INST_NOTB:
+        case INST_READ8:
+        case INST_READ16:
+        case INST_READ32:
+        case INST_READ64:
+        case INST_WRITE8:
+        case INST_WRITE16:
+        case INST_WRITE32:
+        case INST_WRITE64:
+        case INST_PLUSV:
+        case INST_MINUSV:
+        case INST_MULTV:
+        case INST_DIVV:
+        case INST_JMP_INT:
+        case INST_JMP_FLOAT:
+        case INST_JMP_REF:
+        case INST_BOXI:
+        case INST_BOXP:
+        case INST_UNBOX:
+        case INST_CALLF:
+        case INST_ENTER:
+        case INST_LEAVE:
+        case INST_LOADL:
+        case INST_STOREL:
+        case INST_CALL_INDIRECT:
+        case INST_JMP_TABLE:
+        case NUMBER_OF_INSTS:
+        default:
+            if (fall != next) {
+                result[new_size++] = jmp_fall;
             }
         }
     }
+    map[size] = new_size;
 
-    // Second pass
-    for (size_t i = 0; i < basm->deferred_operands_size; ++i) {
-        String_View name = basm->deferred_operands[i].name;
-        if (!basm_resolve_binding(
-                basm,
-                name,
-                &basm->program[basm->deferred_operands[i].addr].operand)) {
-            // TODO(#52): second pass label resolution errors don't report the location in the source code
-            fprintf(stderr, "%.*s: ERROR: unknown binding `%.*s`\n",
-                    SV_FORMAT(input_file_path), SV_FORMAT(name));
-            exit(1);
+    for (size_t i = 0; i < new_size; ++i) {
+        if (result[i].addr && result[i].inst.operand.as_u64 <= size) {
+            result[i].inst.operand.as_u64 = map[result[i].inst.operand.as_u64];
+        }
+    }
+
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        if (basm->bindings[i].kind == BINDING_LABEL &&
+            basm->bindings[i].value.as_u64 <= size) {
+            basm->bindings[i].value.as_u64 = map[basm->bindings[i].value.as_u64];
         }
     }
+
+    basm_opt_store(basm, result, new_size);
 }
 
 String_View basm_slurp_file(Basm *basm, String_View file_path)
@@ -1,5 +1,17 @@
+// NOTE: syscall() of perf_event_open is not a part of POSIX
+#define _DEFAULT_SOURCE
+
 #define BM_IMPLEMENTATION
+#define BM_CACHE
 #include "./bm.h"
+#include "./exclib/swisstab.h"
+#include "./exclib/conctab.h"
+
+#ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <linux/perf_event.h>
+#endif
 
 Bm bm = {0};
 
@@ -14,7 +26,7 @@ static  char *shift(int *argc, char ***argv)
 
 static void usage(FILE *stream, const char *program)
 {
-    fprintf(stream, "Usage: %s -i <input.bm> [-l <limit>] [-h] [-d]\n", program);
+    fprintf(stream, "Usage: %s -i <input.bm>|-r <snapshot.bms> [-l <limit>] [-h] [-d] [-p <output.bmp>] [-g] [-u] [-perf]\n", program);
 }
 
 static Err bm_alloc(Bm *bm)
@@ -46,9 +58,9 @@ static Err bm_print_f64(Bm *bm)
         return ERR_STACK_UNDERFLOW;
     }
 
-    printf("%lf\n", bm->stack[bm->stack_size - 1].as_f64);
+    Err err = bm_output_f64(bm, bm->stack[bm->stack_size - 1].as_f64);
     bm->stack_size -= 1;
-    return ERR_OK;
+    return err;
 }
 
 static Err bm_print_i64(Bm *bm)
@@ -57,9 +69,9 @@ static Err bm_print_i64(Bm *bm)
         return ERR_STACK_UNDERFLOW;
     }
 
-    printf("%" PRId64 "\n", bm->stack[bm->stack_size - 1].as_i64);
+    Err err = bm_output_i64(bm, bm->stack[bm->stack_size - 1].as_i64);
     bm->stack_size -= 1;
-    return ERR_OK;
+    return err;
 }
 
 static Err bm_print_u64(Bm *bm)
@@ -68,9 +80,9 @@ static Err bm_print_u64(Bm *bm)
         return ERR_STACK_UNDERFLOW;
     }
 
-    printf("%" PRIu64 "\n", bm->stack[bm->stack_size - 1].as_u64);
+    Err err = bm_output_u64(bm, bm->stack[bm->stack_size - 1].as_u64);
     bm->stack_size -= 1;
-    return ERR_OK;
+    return err;
 }
 
 static Err bm_print_ptr(Bm *bm)
@@ -79,9 +91,11 @@ static Err bm_print_ptr(Bm *bm)
         return ERR_STACK_UNDERFLOW;
     }
 
-    printf("%p\n", bm->stack[bm->stack_size - 1].as_ptr);
+    char buffer[32];
+    int n = snprintf(buffer, sizeof(buffer), "%p\n", bm->stack[bm->stack_size - 1].as_ptr);
+    Err err = bm_output_write(bm, buffer, (size_t) n);
     bm->stack_size -= 1;
-    return ERR_OK;
+    return err;
 }
 
 static Err bm_dump_memory(Bm *bm)
@@ -101,14 +115,22 @@ static Err bm_dump_memory(Bm *bm)
         return ERR_ILLEGAL_MEMORY_ACCESS;
     }
 
+    static const char hex[] = "0123456789ABCDEF";
     for (uint64_t i = 0; i < count; ++i) {
-        printf("%02X ", bm->memory[addr + i]);
+        const char byte[3] = {
+            hex[bm->memory[addr + i] >> 4],
+            hex[bm->memory[addr + i] & 0xF],
+            ' ',
+        };
+        Err err = bm_output_write(bm, byte, sizeof(byte));
+        if (err != ERR_OK) {
+            return err;
+        }
     }
-    printf("\n");
 
     bm->stack_size -= 2;
 
-    return ERR_OK;
+    return bm_output_write(bm, "\n", 1);
 }
 
 static Err bm_write(Bm *bm)
@@ -128,13 +150,565 @@ static Err bm_write(Bm *bm)
         return ERR_ILLEGAL_MEMORY_ACCESS;
     }
 
-    fwrite(&bm->memory[addr], sizeof(bm->memory[0]), count, stdout);
-
     bm->stack_size -= 2;
 
+    return bm_output_write(bm, &bm->memory[addr], count);
+}
+
+static Err bm_heap_alloc_native(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    return bm_heap_alloc(bm,
+                         bm->stack[bm->stack_size - 1].as_u64,
+                         &bm->stack[bm->stack_size - 1].as_u64);
+}
+
+static Err bm_heap_free_native(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    Err err = bm_heap_free(bm, bm->stack[bm->stack_size - 1].as_u64);
+    if (err != ERR_OK) {
+        return err;
+    }
+    bm->stack_size -= 1;
+
+    return ERR_OK;
+}
+
+static Err bm_heap_realloc_native(Bm *bm)
+{
+    if (bm->stack_size < 2) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    Memory_Addr addr = 0;
+    Err err = bm_heap_realloc(bm,
+                              bm->stack[bm->stack_size - 2].as_u64,
+                              bm->stack[bm->stack_size - 1].as_u64,
+                              &addr);
+    if (err != ERR_OK) {
+        return err;
+    }
+    bm->stack[bm->stack_size - 2].as_u64 = addr;
+    bm->stack_size -= 1;
+
+    return ERR_OK;
+}
+
+static Err bm_gc_alloc_native(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    // NOTE: the size stays on the stack while collecting, it is not a
+    // reference anyway
+    Word ref = {0};
+    Err err = bm_gc_alloc(bm, bm->stack[bm->stack_size - 1].as_u64, &ref);
+    if (err != ERR_OK) {
+        return err;
+    }
+    bm->stack[bm->stack_size - 1] = ref;
+
+    return ERR_OK;
+}
+
+static Err bm_gc_collect_native(Bm *bm)
+{
+    return bm_gc_collect(bm);
+}
+
+static Err bm_print_value(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    Err err = bm_output_value(bm, bm->stack[bm->stack_size - 1]);
+    bm->stack_size -= 1;
+    return err;
+}
+
+static Err bm_flush(Bm *bm)
+{
+    return bm_output_flush(bm);
+}
+
+// NOTE: the maps live in the host memory like the blocks of `alloc`. The
+// keys are either 32 bit integers or strings from the bm memory, the
+// values are whole words that are carried in the REAL values of the table
+static Err bm_map_new(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    vtype_t key = bm->stack[bm->stack_size - 1].as_u64 == 0 ? DECIMAL_TYPE : STRING_TYPE;
+    bm->stack[bm->stack_size - 1].as_ptr = new_swisstab(0, key, REAL_TYPE);
+
+    return ERR_OK;
+}
+
+static Err bm_map_free(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    free_swisstab(bm->stack[bm->stack_size - 1].as_ptr);
+    bm->stack_size -= 1;
+
     return ERR_OK;
 }
 
+// NOTE: the map is always on top of the stack and the key is right under
+// it, so the size of the key is known before it is read. String keys take
+// two words: the address and the count of the bytes.
+static Err bm_map_key(Bm *bm, SwissTab **map, void **key, uint64_t *words)
+{
+    if (bm->stack_size < 2) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    *map = bm->stack[bm->stack_size - 1].as_ptr;
+    if (keytype_swisstab(*map) == DECIMAL_TYPE) {
+        *key = decimal((int32_t) bm->stack[bm->stack_size - 2].as_i64);
+        *words = 2;
+        return ERR_OK;
+    }
+
+    if (bm->stack_size < 3) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    *words = 3;
+    return bm_string_key(bm,
+                         bm->stack[bm->stack_size - 3].as_u64,
+                         bm->stack[bm->stack_size - 2].as_u64,
+                         key);
+}
+
+static Err bm_map_get(Bm *bm)
+{
+    SwissTab *map = NULL;
+    void *key = NULL;
+    uint64_t words = 0;
+    Err err = bm_map_key(bm, &map, &key, &words);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack_size -= words - 1;
+    bm->stack[bm->stack_size - 1].as_f64 = get_swisstab(map, key).real;
+
+    return ERR_OK;
+}
+
+static Err bm_map_set(Bm *bm)
+{
+    SwissTab *map = NULL;
+    void *key = NULL;
+    uint64_t words = 0;
+    Err err = bm_map_key(bm, &map, &key, &words);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    if (bm->stack_size < words + 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    set_swisstab(map, key, real(bm->stack[bm->stack_size - words - 1].as_f64));
+    bm->stack_size -= words + 1;
+
+    return ERR_OK;
+}
+
+static Err bm_map_del(Bm *bm)
+{
+    SwissTab *map = NULL;
+    void *key = NULL;
+    uint64_t words = 0;
+    Err err = bm_map_key(bm, &map, &key, &words);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    del_swisstab(map, key);
+    bm->stack_size -= words;
+
+    return ERR_OK;
+}
+
+static Err bm_map_in(Bm *bm)
+{
+    SwissTab *map = NULL;
+    void *key = NULL;
+    uint64_t words = 0;
+    Err err = bm_map_key(bm, &map, &key, &words);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack_size -= words - 1;
+    bm->stack[bm->stack_size - 1].as_u64 = in_swisstab(map, key);
+
+    return ERR_OK;
+}
+
+// NOTE: `path_addr path_count offset size addr mode -> mapped`, see
+// bm_window_map() for what the amount of the mapped bytes means
+static Err bm_window_map_native(Bm *bm)
+{
+    if (bm->stack_size < 6) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    void *file_path = NULL;
+    Err err = bm_string_key(bm,
+                            bm->stack[bm->stack_size - 6].as_u64,
+                            bm->stack[bm->stack_size - 5].as_u64,
+                            &file_path);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    const uint64_t mode = bm->stack[bm->stack_size - 1].as_u64;
+    if (mode >= BM_WINDOW_MODES_COUNT) {
+        return ERR_ILLEGAL_OPERAND;
+    }
+
+    uint64_t mapped = 0;
+    err = bm_window_map(bm,
+                        bm->stack[bm->stack_size - 2].as_u64,
+                        file_path,
+                        bm->stack[bm->stack_size - 4].as_u64,
+                        bm->stack[bm->stack_size - 3].as_u64,
+                        (Bm_Window_Mode) mode,
+                        &mapped);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack_size -= 5;
+    bm->stack[bm->stack_size - 1].as_u64 = mapped;
+
+    return ERR_OK;
+}
+
+static Err bm_window_sync_native(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    Err err = bm_window_sync(bm, bm->stack[bm->stack_size - 1].as_u64);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack_size -= 1;
+
+    return ERR_OK;
+}
+
+static Err bm_window_unmap_native(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    Err err = bm_window_unmap(bm, bm->stack[bm->stack_size - 1].as_u64);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack_size -= 1;
+
+    return ERR_OK;
+}
+
+// NOTE: `path_addr path_count buffer capacity -> reader`, the empty path
+// is stdin and the reader is 0 when the file could not be opened
+static Err bm_reader_open_native(Bm *bm)
+{
+    if (bm->stack_size < 4) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    int fd = STDIN_FILENO;
+    if (bm->stack[bm->stack_size - 3].as_u64 > 0) {
+        void *file_path = NULL;
+        Err err = bm_string_key(bm,
+                                bm->stack[bm->stack_size - 4].as_u64,
+                                bm->stack[bm->stack_size - 3].as_u64,
+                                &file_path);
+        if (err != ERR_OK) {
+            return err;
+        }
+
+        fd = open(file_path, O_RDONLY);
+    }
+
+    uint64_t reader = 0;
+    if (fd >= 0) {
+        Err err = bm_reader_open(bm, fd,
+                                 bm->stack[bm->stack_size - 2].as_u64,
+                                 bm->stack[bm->stack_size - 1].as_u64,
+                                 &reader);
+        if (err != ERR_OK) {
+            if (fd != STDIN_FILENO) {
+                close(fd);
+            }
+            return err;
+        }
+    }
+
+    bm->stack_size -= 3;
+    bm->stack[bm->stack_size - 1].as_u64 = reader;
+
+    return ERR_OK;
+}
+
+// NOTE: `reader delim -> addr count status`, the status is one of
+// Bm_Split_Status and 0 once the input is over
+static Err bm_reader_split_native(Bm *bm)
+{
+    if (bm->stack_size < 2) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    if (bm->stack_size >= BM_STACK_CAPACITY) {
+        return ERR_STACK_OVERFLOW;
+    }
+
+    Memory_Addr addr = 0;
+    uint64_t count = 0;
+    Bm_Split_Status status = BM_SPLIT_EOF;
+    Err err = bm_reader_split(bm,
+                              bm->stack[bm->stack_size - 2].as_u64,
+                              (uint8_t) bm->stack[bm->stack_size - 1].as_u64,
+                              &addr, &count, &status);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack[bm->stack_size - 2].as_u64 = addr;
+    bm->stack[bm->stack_size - 1].as_u64 = count;
+    bm->stack[bm->stack_size].as_u64 = status;
+    bm->stack_size += 1;
+
+    return ERR_OK;
+}
+
+// NOTE: `reader -> addr count`
+static Err bm_reader_read_native(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    if (bm->stack_size >= BM_STACK_CAPACITY) {
+        return ERR_STACK_OVERFLOW;
+    }
+
+    Memory_Addr addr = 0;
+    uint64_t count = 0;
+    Err err = bm_reader_read(bm, bm->stack[bm->stack_size - 1].as_u64, &addr, &count);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack[bm->stack_size - 1].as_u64 = addr;
+    bm->stack[bm->stack_size].as_u64 = count;
+    bm->stack_size += 1;
+
+    return ERR_OK;
+}
+
+static Err bm_reader_close_native(Bm *bm)
+{
+    if (bm->stack_size < 1) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    Err err = bm_reader_close(bm, bm->stack[bm->stack_size - 1].as_u64);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack_size -= 1;
+
+    return ERR_OK;
+}
+
+// NOTE: `path_addr path_count -> restored`. Works like fork(): the
+// snapshot is taken right after the native, where the restored VM finds 1
+// on the stack, and the VM that took it gets 0.
+static Err bm_snapshot_native(Bm *bm)
+{
+    if (bm->stack_size < 2) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    void *file_path = NULL;
+    Err err = bm_string_key(bm,
+                            bm->stack[bm->stack_size - 2].as_u64,
+                            bm->stack[bm->stack_size - 1].as_u64,
+                            &file_path);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm->stack_size -= 1;
+    bm->stack[bm->stack_size - 1].as_u64 = 1;
+    bm->ip += 1;
+    err = bm_snapshot_save(bm, file_path);
+    bm->ip -= 1;
+    bm->stack[bm->stack_size - 1].as_u64 = 0;
+
+    return err;
+}
+
+// NOTE: the hardware counters of the host around the run of the guest,
+// only the user space of bme is counted. Every guest instruction is one
+// dispatch of the interpreter. Without perf_event_open(2), or when the
+// kernel does not let us use it, only the time is reported.
+#define PERF_COUNTERS 4
+
+static const char *const perf_names[PERF_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "cache-misses",
+};
+
+typedef struct {
+    int fds[PERF_COUNTERS];
+    // NOTE: errno of the first counter that could not be opened
+    int error;
+    uint64_t values[PERF_COUNTERS];
+    bool counted[PERF_COUNTERS];
+    // NOTE: the counter was not running all of the time because the
+    // kernel shared the hardware with other counters, the value is
+    // an estimate
+    bool scaled[PERF_COUNTERS];
+    struct timespec started;
+    double elapsed;
+} Perf;
+
+static void perf_start(Perf *perf)
+{
+#ifdef __linux__
+    static const uint64_t configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        struct perf_event_attr attr = {0};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        perf->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf->fds[i] < 0 && perf->error == 0) {
+            perf->error = errno;
+        }
+    }
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        if (perf->fds[i] >= 0) {
+            ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#else
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        perf->fds[i] = -1;
+    }
+    perf->error = ENOSYS;
+#endif
+
+    timespec_get(&perf->started, TIME_UTC);
+}
+
+static void perf_stop(Perf *perf)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    perf->elapsed = (double) (now.tv_sec - perf->started.tv_sec) +
+                    (double) (now.tv_nsec - perf->started.tv_nsec) / 1e9;
+
+#ifdef __linux__
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        if (perf->fds[i] >= 0) {
+            ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        if (perf->fds[i] < 0) {
+            continue;
+        }
+
+        // NOTE: the value, the time enabled and the time running
+        uint64_t data[3] = {0};
+        if (read(perf->fds[i], data, sizeof(data)) == (ssize_t) sizeof(data) && data[2] > 0) {
+            perf->counted[i] = true;
+            perf->scaled[i] = data[2] < data[1];
+            perf->values[i] = perf->scaled[i]
+                ? (uint64_t) ((double) data[0] * (double) data[1] / (double) data[2])
+                : data[0];
+        }
+        close(perf->fds[i]);
+    }
+}
+
+static void perf_report(FILE *stream, const Perf *perf, uint64_t executed)
+{
+    fprintf(stream, "PERF: %" PRIu64 " guest instructions in %.3fms, %.1fM guest instructions/s\n",
+            executed, perf->elapsed * 1e3,
+            perf->elapsed > 0.0 ? (double) executed / perf->elapsed / 1e6 : 0.0);
+
+    bool any = false;
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        if (!perf->counted[i]) {
+            fprintf(stream, "PERF: %-13s not counted\n", perf_names[i]);
+            continue;
+        }
+
+        any = true;
+        fprintf(stream, "PERF: %-13s %15" PRIu64 ", %.4f per guest instruction%s\n",
+                perf_names[i], perf->values[i],
+                executed > 0 ? (double) perf->values[i] / (double) executed : 0.0,
+                perf->scaled[i] ? " (estimated)" : "");
+    }
+
+    if (perf->counted[0] && perf->counted[1] && perf->values[0] > 0) {
+        fprintf(stream, "PERF: %.2f host instructions per cycle\n",
+                (double) perf->values[1] / (double) perf->values[0]);
+    }
+
+    if (!any) {
+        fprintf(stream, "PERF: the hardware counters are not available (%s), timing only\n",
+                perf->error != 0 ? strerror(perf->error) : "no events");
+    }
+}
+
 // TODO(#61): implement gdb-style (but better of course) debugger for bm
 // TODO(#62): rot13 example that read/writes data from/to the bm memory
 
@@ -142,8 +716,13 @@ int main(int argc, char **argv)
 {
     const char *program = shift(&argc, &argv);
     const char *input_file_path = NULL;
+    const char *profile_file_path = NULL;
+    const char *snapshot_file_path = NULL;
     int limit = -1;
     int debug = 0;
+    bool gc_stats = false;
+    bool unbuffered = false;
+    bool perf_stats = false;
 
     while (argc > 0) {
         const char *flag = shift(&argc, &argv);
@@ -169,6 +748,28 @@ int main(int argc, char **argv)
             exit(0);
         } else if (strcmp(flag, "-d") == 0) {
             debug = 1;
+        } else if (strcmp(flag, "-g") == 0) {
+            gc_stats = true;
+        } else if (strcmp(flag, "-u") == 0) {
+            unbuffered = true;
+        } else if (strcmp(flag, "-perf") == 0) {
+            perf_stats = true;
+        } else if (strcmp(flag, "-p") == 0) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: No argument is provided for flag `%s`\n", flag);
+                exit(1);
+            }
+
+            profile_file_path = shift(&argc, &argv);
+        } else if (strcmp(flag, "-r") == 0) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: No argument is provided for flag `%s`\n", flag);
+                exit(1);
+            }
+
+            snapshot_file_path = shift(&argc, &argv);
         } else {
             usage(stderr, program);
             fprintf(stderr, "ERROR: Unknown flag `%s`\n", flag);
@@ -176,13 +777,20 @@ int main(int argc, char **argv)
         }
     }
 
-    if (input_file_path == NULL) {
+    if (input_file_path == NULL && snapshot_file_path == NULL) {
         usage(stderr, program);
         fprintf(stderr, "ERROR: input was not provided\n");
         exit(1);
     }
 
-    bm_load_program_from_file(&bm, input_file_path);
+    // NOTE: the counters measure the plain run of the program, the
+    // profiler and the debugger would only measure themselves
+    if (perf_stats && (profile_file_path != NULL || debug)) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: -perf can not be combined with -p or -d\n");
+        exit(1);
+    }
+
     // TODO(#35): some sort of mechanism to load native functions from DLLs
     bm_push_native(&bm, bm_alloc);     // 0
     bm_push_native(&bm, bm_free);      // 1
@@ -192,11 +800,104 @@ int main(int argc, char **argv)
     bm_push_native(&bm, bm_print_ptr); // 5
     bm_push_native(&bm, bm_dump_memory); // 6
     bm_push_native(&bm, bm_write); // 7
+    bm_push_native(&bm, bm_heap_alloc_native);   // 8
+    bm_push_native(&bm, bm_heap_free_native);    // 9
+    bm_push_native(&bm, bm_heap_realloc_native); // 10
+    bm_push_native(&bm, bm_gc_alloc_native);     // 11
+    bm_push_native(&bm, bm_gc_collect_native);   // 12
+    bm_push_native(&bm, bm_print_value);         // 13
+    bm_push_native(&bm, bm_map_new);             // 14
+    bm_push_native(&bm, bm_map_free);            // 15
+    bm_push_native(&bm, bm_map_get);             // 16
+    bm_push_native(&bm, bm_map_set);             // 17
+    bm_push_native(&bm, bm_map_del);             // 18
+    bm_push_native(&bm, bm_map_in);              // 19
+    bm_push_native(&bm, bm_cache_get);           // 20
+    bm_push_native(&bm, bm_cache_set);           // 21
+    bm_push_native(&bm, bm_cache_del);           // 22
+    bm_push_native(&bm, bm_flush);               // 23
+    bm_push_native(&bm, bm_window_map_native);   // 24
+    bm_push_native(&bm, bm_window_sync_native);  // 25
+    bm_push_native(&bm, bm_window_unmap_native); // 26
+    bm_push_native(&bm, bm_reader_open_native);  // 27
+    bm_push_native(&bm, bm_reader_split_native); // 28
+    bm_push_native(&bm, bm_reader_read_native);  // 29
+    bm_push_native(&bm, bm_reader_close_native); // 30
+    bm_push_native(&bm, bm_snapshot_native);     // 31
+
+    // NOTE: the natives have to be there to verify the program
+    if (snapshot_file_path != NULL) {
+        Err err = bm_snapshot_restore(&bm, snapshot_file_path);
+        if (err != ERR_OK) {
+            fprintf(stderr, "ERROR: Could not restore snapshot `%s`: %s\n",
+                    snapshot_file_path, err_as_cstr(err));
+            exit(1);
+        }
+    } else {
+        bm_prepare_program(&bm, input_file_path);
+    }
+
+    // NOTE: the debugger prints the stack in between the instructions so
+    // the output of the program has to go out right away to make sense
+    if (unbuffered || debug) {
+        bm.output.unbuffered = true;
+    }
+
+    // NOTE: bme runs a single VM on the cache, the hosts of libbm may join
+    // it from as many VMs and threads as they want
+    ConcTab *cache = new_conctab(0, STRING_TYPE, REAL_TYPE);
+    if (cache == NULL || bm_cache_join(&bm, cache) != ERR_OK) {
+        fprintf(stderr, "ERROR: Could not create the cache of the natives\n");
+        exit(1);
+    }
+
+    if (profile_file_path != NULL) {
+        static Bm_Profile_Entry profile[BM_PROGRAM_CAPACITY] = {0};
+
+        Err err = ERR_OK;
+        while (limit != 0 && !bm.halt && err == ERR_OK) {
+            const Inst_Addr ip = bm.ip;
+            err = bm_execute_inst(&bm);
+            if (ip < BM_PROGRAM_CAPACITY) {
+                profile[ip].count += 1;
+                if (bm.ip != ip + 1) {
+                    profile[ip].taken += 1;
+                }
+            }
+            if (limit > 0) {
+                --limit;
+            }
+        }
+
+        // NOTE: the profile of a failed run is still useful
+        bm_save_profile_to_file(&bm, profile, profile_file_path);
+
+        if (err != ERR_OK) {
+            bm_output_flush(&bm);
+            fprintf(stderr, "ERROR: %s\n", err_as_cstr(err));
+            return 1;
+        }
+    } else if (perf_stats) {
+        Perf perf = {0};
+        const uint64_t budget = limit < 0 ? UINT64_MAX : (uint64_t) limit;
+        uint64_t left = budget;
+
+        perf_start(&perf);
+        Err err = bm_execute_budget(&bm, &left);
+        perf_stop(&perf);
 
-    if (!debug) {
+        bm_output_flush(&bm);
+        perf_report(stderr, &perf, budget - left);
+
+        if (err != ERR_OK) {
+            fprintf(stderr, "ERROR: %s\n", err_as_cstr(err));
+            return 1;
+        }
+    } else if (!debug) {
         Err err = bm_execute_program(&bm, limit);
 
         if (err != ERR_OK) {
+            bm_output_flush(&bm);
             fprintf(stderr, "ERROR: %s\n", err_as_cstr(err));
             return 1;
         }
@@ -206,10 +907,12 @@ int main(int argc, char **argv)
             printf("Instruction: %s %" PRIu64 "\n",
                    inst_name(bm.program[bm.ip].type),
                    bm.program[bm.ip].operand.as_u64);
+            fflush(stdout);
             getchar();
 
             Err err = bm_execute_inst(&bm);
             if (err != ERR_OK) {
+                bm_output_flush(&bm);
                 fprintf(stderr, "ERROR: %s\n", err_as_cstr(err));
                 return 1;
             }
@@ -219,5 +922,15 @@ int main(int argc, char **argv)
         }
     }
 
+    Err err = bm_output_flush(&bm);
+    if (err != ERR_OK) {
+        fprintf(stderr, "ERROR: %s\n", err_as_cstr(err));
+        return 1;
+    }
+
+    if (gc_stats) {
+        bm_gc_dump_stats(stderr, &bm);
+    }
+
     return 0;
 }
\ No newline at end of file
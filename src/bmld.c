@@ -0,0 +1,326 @@
+#define BM_IMPLEMENTATION
+#include "./bm.h"
+
+#define BMLD_OBJECTS_CAPACITY 1024
+
+typedef struct {
+    const char *file_path;
+    Bm_Object_Meta meta;
+    Inst *program;
+    uint8_t *memory;
+    Bm_Object_Symbol *symbols;
+    Bm_Object_Reloc *relocs;
+    char *strings;
+
+    Inst_Addr code_base;
+    Memory_Addr memory_base;
+} Object;
+
+// NOTE: the linker builds the output the same way the assembler does,
+// so the exported symbols end up in the hashed bindings of a Basm
+Basm linker = {0};
+Object objects[BMLD_OBJECTS_CAPACITY];
+size_t objects_size = 0;
+
+static char *shift(int *argc, char ***argv)
+{
+    assert(*argc > 0);
+    char *result = **argv;
+    *argv += 1;
+    *argc -= 1;
+    return result;
+}
+
+static void usage(FILE *stream, const char *program)
+{
+    fprintf(stream, "Usage: %s -o <output.bm> <input.bmo>...\n", program);
+}
+
+// NOTE: the counts come from the file, so they are checked against the
+// rest of it before anything is allocated for them
+static void *read_section(FILE *f, const char *file_path, uint64_t file_size, size_t size, uint64_t count)
+{
+    const long position = ftell(f);
+    if (position < 0 || (uint64_t) position > file_size ||
+        count > (file_size - (uint64_t) position) / size) {
+        fprintf(stderr, "ERROR: %s: unexpected end of file\n", file_path);
+        exit(1);
+    }
+
+    void *data = malloc(size * count + 1);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate memory for file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    if (fread(data, size, count, f) != count) {
+        fprintf(stderr, "ERROR: %s: unexpected end of file\n", file_path);
+        exit(1);
+    }
+
+    return data;
+}
+
+static String_View symbol_name(const Object *object, const Bm_Object_Symbol *symbol)
+{
+    return (String_View) {
+        .count = symbol->name_count,
+        .data = object->strings + symbol->name_offset,
+    };
+}
+
+static void load_object(Object *object, const char *file_path)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    object->file_path = file_path;
+
+    long file_size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        file_size = ftell(f);
+    }
+    if (file_size < 0 || fseek(f, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "ERROR: Could not read file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    if (fread(&object->meta, sizeof(object->meta), 1, f) < 1) {
+        fprintf(stderr, "ERROR: Could not read meta data from file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    if (object->meta.magic != BM_OBJECT_MAGIC) {
+        fprintf(stderr,
+                "ERROR: %s does not appear to be a valid BM object file. "
+                "Unexpected magic %04X. Expected %04X.\n",
+                file_path,
+                object->meta.magic, BM_OBJECT_MAGIC);
+        exit(1);
+    }
+
+    if (object->meta.version != BM_OBJECT_VERSION) {
+        fprintf(stderr,
+                "ERROR: %s: unsupported version of BM object file %d. Expected version %d.\n",
+                file_path,
+                object->meta.version, BM_OBJECT_VERSION);
+        exit(1);
+    }
+
+    if (object->meta.memory_size > object->meta.memory_capacity) {
+        fprintf(stderr,
+                "ERROR: %s: memory size %"PRIu64" is greater than declared memory capacity %"PRIu64"\n",
+                file_path,
+                object->meta.memory_size,
+                object->meta.memory_capacity);
+        exit(1);
+    }
+
+    object->program = read_section(f, file_path, (uint64_t) file_size, sizeof(object->program[0]), object->meta.program_size);
+    object->memory = read_section(f, file_path, (uint64_t) file_size, sizeof(object->memory[0]), object->meta.memory_size);
+    object->symbols = read_section(f, file_path, (uint64_t) file_size, sizeof(object->symbols[0]), object->meta.symbols_size);
+    object->relocs = read_section(f, file_path, (uint64_t) file_size, sizeof(object->relocs[0]), object->meta.relocs_size);
+    object->strings = read_section(f, file_path, (uint64_t) file_size, sizeof(object->strings[0]), object->meta.strings_size);
+
+    fclose(f);
+
+    for (uint64_t i = 0; i < object->meta.symbols_size; ++i) {
+        const Bm_Object_Symbol *symbol = &object->symbols[i];
+        if (symbol->name_offset > object->meta.strings_size ||
+            symbol->name_count > object->meta.strings_size - symbol->name_offset ||
+            symbol->type > SYMBOL_IMPORT ||
+            symbol->kind > BINDING_MEMORY) {
+            fprintf(stderr, "ERROR: %s: symbol %"PRIu64" is corrupted\n", file_path, i);
+            exit(1);
+        }
+    }
+
+    for (uint64_t i = 0; i < object->meta.relocs_size; ++i) {
+        const Bm_Object_Reloc *reloc = &object->relocs[i];
+        // NOTE: the entries of the jump tables are in the memory section
+        const bool in_bounds = reloc->kind == RELOC_TABLE
+            ? object->meta.memory_size >= sizeof(Inst_Addr) &&
+              reloc->addr <= object->meta.memory_size - sizeof(Inst_Addr)
+            : reloc->addr < object->meta.program_size;
+        if (!in_bounds ||
+            reloc->kind > RELOC_TABLE ||
+            (reloc->kind == RELOC_SYMBOL &&
+             (reloc->symbol >= object->meta.symbols_size ||
+              object->symbols[reloc->symbol].type != SYMBOL_IMPORT))) {
+            fprintf(stderr, "ERROR: %s: relocation %"PRIu64" is corrupted\n", file_path, i);
+            exit(1);
+        }
+    }
+}
+
+static void layout_object(Object *object)
+{
+    object->code_base = linker.program_size;
+    object->memory_base = linker.memory_size;
+
+    if (object->meta.program_size > BM_PROGRAM_CAPACITY - linker.program_size) {
+        fprintf(stderr, "ERROR: %s: program does not fit into %d instructions\n",
+                object->file_path, BM_PROGRAM_CAPACITY);
+        exit(1);
+    }
+
+    for (uint64_t i = 0; i < object->meta.program_size; ++i) {
+        Inst *inst = basm_push_inst(&linker, object->program[i].type);
+        inst->operand = object->program[i].operand;
+    }
+
+    if (object->meta.memory_capacity > BM_MEMORY_CAPACITY - linker.memory_size) {
+        fprintf(stderr, "ERROR: %s: memory section does not fit into %d bytes\n",
+                object->file_path, BM_MEMORY_CAPACITY);
+        exit(1);
+    }
+
+    basm_push_string_to_memory(&linker, (String_View) {
+        .count = object->meta.memory_size,
+        .data = (const char *) object->memory,
+    });
+
+    // NOTE: the reserved but uninitialized part of the memory section
+    static const char zeros[1024] = {0};
+    uint64_t reserved = object->meta.memory_capacity - object->meta.memory_size;
+    while (reserved > 0) {
+        uint64_t count = reserved < sizeof(zeros) ? reserved : sizeof(zeros);
+        basm_push_string_to_memory(&linker, (String_View) {
+            .count = count,
+            .data = zeros,
+        });
+        reserved -= count;
+    }
+}
+
+static void export_symbols(const Object *object)
+{
+    for (uint64_t i = 0; i < object->meta.symbols_size; ++i) {
+        const Bm_Object_Symbol *symbol = &object->symbols[i];
+        if (symbol->type != SYMBOL_EXPORT) {
+            continue;
+        }
+
+        Word value = word_u64(symbol->value);
+        if (symbol->kind == BINDING_LABEL) {
+            value.as_u64 += object->code_base;
+        } else if (symbol->kind == BINDING_MEMORY) {
+            value.as_u64 += object->memory_base;
+        }
+
+        String_View name = symbol_name(object, symbol);
+        if (!basm_bind_value(&linker, name, value, (Binding_Kind) symbol->kind)) {
+            fprintf(stderr, "%s: ERROR: symbol `%.*s` is already exported by another object\n",
+                    object->file_path, SV_FORMAT(name));
+            exit(1);
+        }
+    }
+}
+
+static void relocate_object(const Object *object)
+{
+    for (uint64_t i = 0; i < object->meta.relocs_size; ++i) {
+        const Bm_Object_Reloc *reloc = &object->relocs[i];
+        Word *operand = reloc->kind == RELOC_TABLE
+            ? NULL
+            : &linker.program[object->code_base + reloc->addr].operand;
+
+        switch ((Reloc_Kind) reloc->kind) {
+        case RELOC_CODE:
+            operand->as_u64 += object->code_base;
+            break;
+
+        case RELOC_MEMORY:
+            operand->as_u64 += object->memory_base;
+            break;
+
+        case RELOC_TABLE: {
+            uint8_t *entry = &linker.memory[object->memory_base + reloc->addr];
+            Inst_Addr addr = 0;
+            memcpy(&addr, entry, sizeof(addr));
+            addr += object->code_base;
+            memcpy(entry, &addr, sizeof(addr));
+        } break;
+
+        case RELOC_SYMBOL: {
+            String_View name = symbol_name(object, &object->symbols[reloc->symbol]);
+            if (!basm_resolve_binding(&linker, name, operand)) {
+                fprintf(stderr, "%s: ERROR: undefined symbol `%.*s`\n",
+                        object->file_path, SV_FORMAT(name));
+                exit(1);
+            }
+        } break;
+
+        default:
+            assert(false && "relocate_object: unreachable");
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *program = shift(&argc, &argv);
+    const char *output_file_path = NULL;
+
+    while (argc > 0) {
+        const char *arg = shift(&argc, &argv);
+
+        if (strcmp(arg, "-o") == 0) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: No argument is provided for flag `%s`\n", arg);
+                exit(1);
+            }
+
+            output_file_path = shift(&argc, &argv);
+        } else if (strcmp(arg, "-h") == 0) {
+            usage(stdout, program);
+            exit(0);
+        } else {
+            if (objects_size >= BMLD_OBJECTS_CAPACITY) {
+                fprintf(stderr, "ERROR: Too many input objects\n");
+                exit(1);
+            }
+
+            load_object(&objects[objects_size++], arg);
+        }
+    }
+
+    if (output_file_path == NULL) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: output was not provided\n");
+        exit(1);
+    }
+
+    if (objects_size == 0) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: no input objects were provided\n");
+        exit(1);
+    }
+
+    // NOTE: the objects are laid out in the order they were provided,
+    // so the execution starts at the first instruction of the first one
+    for (size_t i = 0; i < objects_size; ++i) {
+        layout_object(&objects[i]);
+    }
+
+    for (size_t i = 0; i < objects_size; ++i) {
+        export_symbols(&objects[i]);
+    }
+
+    for (size_t i = 0; i < objects_size; ++i) {
+        relocate_object(&objects[i]);
+    }
+
+    basm_save_to_file(&linker, output_file_path);
+
+    return 0;
+}
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "conctab.h"
+#include "type.h"
+
+#define _DEFAULT_SHARDS 64
+#define _INITIAL_BUCKETS 16
+#define _CACHE_LINE 64
+// NOTE: a thread tries to free what it has removed every that many removals
+#define _RETIRE_THRESHOLD 64
+#define _BUFFER_CAPACITY 256
+// the epoch of a thread that is not reading the map right now
+#define _QUIESCENT UINT64_MAX
+
+// NOTE: once a node is reachable by the readers only its value and the link
+// to the next node change, both of them atomically
+typedef struct _node {
+    uint64_t hash;
+    value_t key;
+    _Atomic uint64_t value;
+    _Atomic(struct _node*) next;
+} _node;
+
+typedef struct _buckets {
+    size_t capacity;
+    _Atomic(_node*) heads[];
+} _buckets;
+
+typedef struct _shard {
+    _Alignas(_CACHE_LINE) mtx_t lock;
+    _Atomic(_buckets*) buckets;
+    atomic_size_t size;
+} _shard;
+
+typedef enum _retired_kind {
+    _RETIRED_NODE,
+    // a node that was copied by a resize, the copy owns its key now
+    _RETIRED_NODE_COPIED,
+    _RETIRED_BUCKETS,
+} _retired_kind;
+
+typedef struct _retired {
+    void* ptr;
+    uint64_t epoch;
+    _retired_kind kind;
+} _retired;
+
+typedef struct _retired_list {
+    _retired* items;
+    size_t size;
+    size_t capacity;
+} _retired_list;
+
+typedef struct _buffered {
+    uint64_t hash;
+    size_t order;
+    value_t key;
+    uint64_t value;
+} _buffered;
+
+typedef struct ConcTabThread {
+    ConcTab* conctab;
+    _Atomic uint64_t epoch;
+    struct ConcTabThread* next;
+    _retired_list retired;
+    size_t buffer_size;
+    _buffered buffer[_BUFFER_CAPACITY];
+} ConcTabThread;
+
+typedef struct ConcTab {
+    struct {
+        vtype_t key;
+        vtype_t value;
+    } type;
+    unsigned shards_bits;
+    _shard* shards;
+    _Atomic uint64_t epoch;
+    // the threads that joined the map and what the threads that left it
+    // could not free yet
+    mtx_t threads_lock;
+    ConcTabThread* threads;
+    _retired_list orphans;
+} ConcTab;
+
+static uint64_t _get_hash(ConcTab* conctab, void* key);
+static uint64_t _mix(uint64_t x);
+static uint64_t _value_bits(vtype_t tvalue, void* value);
+static value_t _key_of(vtype_t tkey, void* key);
+static _Bool _eq_key(vtype_t tkey, value_t x, value_t y);
+static _shard* _shard_of(ConcTab* conctab, uint64_t hash);
+static _buckets* _new_buckets(size_t capacity);
+static _node* _find(ConcTab* conctab, _buckets* buckets, value_t key, uint64_t hash);
+static void _put(ConcTabThread* thread, _shard* shard, uint64_t hash, value_t key, _Bool owned, uint64_t value);
+static void _resize(ConcTabThread* thread, _shard* shard);
+static void _enter_epoch(ConcTabThread* thread);
+static void _exit_epoch(ConcTabThread* thread);
+static void _retire(ConcTabThread* thread, void* ptr, _retired_kind kind);
+static void _push_retired(_retired_list* list, _retired item);
+static void _free_retired(ConcTab* conctab, _retired_list* list, uint64_t epoch);
+static void _collect(ConcTabThread* thread);
+static int _cmp_buffered(const void* x, const void* y);
+
+extern ConcTab* new_conctab(size_t shards, vtype_t key, vtype_t value) {
+    switch (key) {
+    case DECIMAL_TYPE:
+    case STRING_TYPE:
+        break;
+    case REAL_TYPE:
+    default:
+        fprintf(stderr, "%s\n", "key type not supported");
+        return NULL;
+    }
+    switch (value) {
+    case DECIMAL_TYPE:
+    case REAL_TYPE:
+        break;
+    case STRING_TYPE:
+    default:
+        fprintf(stderr, "%s\n", "value type not supported");
+        return NULL;
+    }
+    if (shards == 0) {
+        shards = _DEFAULT_SHARDS;
+    }
+    ConcTab* conctab = (ConcTab*)malloc(sizeof(ConcTab));
+    conctab->type.key = key;
+    conctab->type.value = value;
+    conctab->shards_bits = 0;
+    while (((size_t)1 << conctab->shards_bits) < shards) {
+        conctab->shards_bits += 1;
+    }
+    size_t shards_size = (size_t)1 << conctab->shards_bits;
+    conctab->shards = (_shard*)aligned_alloc(_CACHE_LINE, shards_size * sizeof(_shard));
+    for (size_t i = 0; i < shards_size; ++i) {
+        mtx_init(&conctab->shards[i].lock, mtx_plain);
+        atomic_init(&conctab->shards[i].buckets, _new_buckets(_INITIAL_BUCKETS));
+        atomic_init(&conctab->shards[i].size, 0);
+    }
+    atomic_init(&conctab->epoch, 0);
+    mtx_init(&conctab->threads_lock, mtx_plain);
+    conctab->threads = NULL;
+    conctab->orphans.items = NULL;
+    conctab->orphans.size = 0;
+    conctab->orphans.capacity = 0;
+    return conctab;
+}
+
+extern void free_conctab(ConcTab* conctab) {
+    size_t shards_size = (size_t)1 << conctab->shards_bits;
+    for (size_t i = 0; i < shards_size; ++i) {
+        _buckets* buckets = atomic_load(&conctab->shards[i].buckets);
+        for (size_t j = 0; j < buckets->capacity; ++j) {
+            _node* node = atomic_load(&buckets->heads[j]);
+            while (node != NULL) {
+                _node* next = atomic_load(&node->next);
+                if (conctab->type.key == STRING_TYPE) {
+                    free(node->key.string);
+                }
+                free(node);
+                node = next;
+            }
+        }
+        free(buckets);
+        mtx_destroy(&conctab->shards[i].lock);
+    }
+    _free_retired(conctab, &conctab->orphans, UINT64_MAX);
+    free(conctab->orphans.items);
+    mtx_destroy(&conctab->threads_lock);
+    free(conctab->shards);
+    free(conctab);
+}
+
+extern ConcTabThread* join_conctab(ConcTab* conctab) {
+    ConcTabThread* thread = (ConcTabThread*)malloc(sizeof(ConcTabThread));
+    if (thread == NULL) {
+        return NULL;
+    }
+    thread->conctab = conctab;
+    atomic_init(&thread->epoch, _QUIESCENT);
+    thread->retired.items = NULL;
+    thread->retired.size = 0;
+    thread->retired.capacity = 0;
+    thread->buffer_size = 0;
+    mtx_lock(&conctab->threads_lock);
+    thread->next = conctab->threads;
+    conctab->threads = thread;
+    mtx_unlock(&conctab->threads_lock);
+    return thread;
+}
+
+extern void leave_conctab(ConcTabThread* thread) {
+    ConcTab* conctab = thread->conctab;
+    flush_conctab(thread);
+    mtx_lock(&conctab->threads_lock);
+    for (ConcTabThread** link = &conctab->threads; *link != NULL; link = &(*link)->next) {
+        if (*link == thread) {
+            *link = thread->next;
+            break;
+        }
+    }
+    for (size_t i = 0; i < thread->retired.size; ++i) {
+        _push_retired(&conctab->orphans, thread->retired.items[i]);
+    }
+    mtx_unlock(&conctab->threads_lock);
+    free(thread->retired.items);
+    free(thread);
+}
+
+extern _Bool get_conctab(ConcTabThread* thread, void* key, value_t* value) {
+    ConcTab* conctab = thread->conctab;
+    uint64_t hash = _get_hash(conctab, key);
+    _shard* shard = _shard_of(conctab, hash);
+    _enter_epoch(thread);
+    _node* node = _find(conctab, atomic_load_explicit(&shard->buckets, memory_order_acquire),
+                        _key_of(conctab->type.key, key), hash);
+    if (node != NULL && value != NULL) {
+        uint64_t bits = atomic_load_explicit(&node->value, memory_order_relaxed);
+        memcpy(value, &bits, sizeof(bits));
+    }
+    _exit_epoch(thread);
+    return node != NULL;
+}
+
+extern int8_t set_conctab(ConcTabThread* thread, void* key, void* value) {
+    ConcTab* conctab = thread->conctab;
+    uint64_t hash = _get_hash(conctab, key);
+    _shard* shard = _shard_of(conctab, hash);
+    mtx_lock(&shard->lock);
+    _put(thread, shard, hash, _key_of(conctab->type.key, key), 0,
+         _value_bits(conctab->type.value, value));
+    mtx_unlock(&shard->lock);
+    return 0;
+}
+
+extern void del_conctab(ConcTabThread* thread, void* key) {
+    ConcTab* conctab = thread->conctab;
+    uint64_t hash = _get_hash(conctab, key);
+    _shard* shard = _shard_of(conctab, hash);
+    value_t k = _key_of(conctab->type.key, key);
+
+    mtx_lock(&shard->lock);
+    _buckets* buckets = atomic_load_explicit(&shard->buckets, memory_order_relaxed);
+    _Atomic(_node*)* link = &buckets->heads[hash & (buckets->capacity - 1)];
+    _node* node = atomic_load_explicit(link, memory_order_relaxed);
+    while (node != NULL && (node->hash != hash || !_eq_key(conctab->type.key, node->key, k))) {
+        link = &node->next;
+        node = atomic_load_explicit(link, memory_order_relaxed);
+    }
+    if (node != NULL) {
+        // NOTE: the readers that are standing on the node still find their
+        // way out through its link
+        atomic_store_explicit(link, atomic_load_explicit(&node->next, memory_order_relaxed),
+                              memory_order_release);
+        atomic_fetch_sub_explicit(&shard->size, 1, memory_order_relaxed);
+    }
+    mtx_unlock(&shard->lock);
+
+    if (node != NULL) {
+        _retire(thread, node, _RETIRED_NODE);
+    }
+}
+
+extern _Bool in_conctab(ConcTabThread* thread, void* key) {
+    return get_conctab(thread, key, NULL);
+}
+
+extern void buffer_conctab(ConcTabThread* thread, void* key, void* value) {
+    ConcTab* conctab = thread->conctab;
+    _buffered* entry = &thread->buffer[thread->buffer_size];
+    entry->hash = _get_hash(conctab, key);
+    entry->order = thread->buffer_size;
+    entry->key = _key_of(conctab->type.key, key);
+    if (conctab->type.key == STRING_TYPE) {
+        size_t size = strlen((char*)key);
+        entry->key.string = (char*)malloc(sizeof(char) * size + 1);
+        memcpy(entry->key.string, key, size + 1);
+    }
+    entry->value = _value_bits(conctab->type.value, value);
+    thread->buffer_size += 1;
+    if (thread->buffer_size == _BUFFER_CAPACITY) {
+        flush_conctab(thread);
+    }
+}
+
+extern void flush_conctab(ConcTabThread* thread) {
+    ConcTab* conctab = thread->conctab;
+    // NOTE: the shard is picked by the high bits of the hash, so sorting by
+    // the hash puts the entries of a shard next to each other
+    qsort(thread->buffer, thread->buffer_size, sizeof(thread->buffer[0]), _cmp_buffered);
+    size_t i = 0;
+    while (i < thread->buffer_size) {
+        _shard* shard = _shard_of(conctab, thread->buffer[i].hash);
+        mtx_lock(&shard->lock);
+        for (; i < thread->buffer_size && _shard_of(conctab, thread->buffer[i].hash) == shard; ++i) {
+            _put(thread, shard, thread->buffer[i].hash, thread->buffer[i].key, 1, thread->buffer[i].value);
+        }
+        mtx_unlock(&shard->lock);
+    }
+    thread->buffer_size = 0;
+}
+
+extern size_t size_conctab(ConcTab* conctab) {
+    size_t size = 0;
+    size_t shards_size = (size_t)1 << conctab->shards_bits;
+    for (size_t i = 0; i < shards_size; ++i) {
+        size += atomic_load_explicit(&conctab->shards[i].size, memory_order_relaxed);
+    }
+    return size;
+}
+
+extern size_t sizeof_conctab(void) {
+    return sizeof(ConcTab);
+}
+
+extern vtype_t keytype_conctab(ConcTab* conctab) {
+    return conctab->type.key;
+}
+
+static uint64_t _get_hash(ConcTab* conctab, void* key) {
+    uint64_t hash = 0;
+    switch (conctab->type.key) {
+    case DECIMAL_TYPE:
+        hash = (uint32_t)(int32_t)(intptr_t)key;
+        break;
+    case STRING_TYPE:
+        // FNV-1a
+        hash = 14695981039346656037ULL;
+        for (const unsigned char* s = key; *s != '\0'; ++s) {
+            hash = (hash ^ *s) * 1099511628211ULL;
+        }
+        break;
+    case REAL_TYPE:
+    default:;
+    }
+    return _mix(hash);
+}
+
+static uint64_t _mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t _value_bits(vtype_t tvalue, void* value) {
+    value_t x;
+    memset(&x, 0, sizeof(x));
+    switch (tvalue) {
+    case DECIMAL_TYPE:
+        x.decimal = (int32_t)(intptr_t)value;
+        break;
+    case REAL_TYPE:
+        x.real = as_real(value);
+        break;
+    case STRING_TYPE:
+    default:;
+    }
+    uint64_t bits = 0;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+static value_t _key_of(vtype_t tkey, void* key) {
+    value_t x;
+    if (tkey == STRING_TYPE) {
+        x.string = (char*)key;
+    }
+    else {
+        x.decimal = (int32_t)(intptr_t)key;
+    }
+    return x;
+}
+
+static _Bool _eq_key(vtype_t tkey, value_t x, value_t y) {
+    switch (tkey) {
+    case DECIMAL_TYPE:
+        return x.decimal == y.decimal;
+    case STRING_TYPE:
+        return strcmp(x.string, y.string) == 0;
+    case REAL_TYPE:
+    default:
+        return 0;
+    }
+}
+
+static _shard* _shard_of(ConcTab* conctab, uint64_t hash) {
+    if (conctab->shards_bits == 0) {
+        return &conctab->shards[0];
+    }
+    return &conctab->shards[hash >> (64 - conctab->shards_bits)];
+}
+
+static _buckets* _new_buckets(size_t capacity) {
+    _buckets* buckets = (_buckets*)malloc(sizeof(_buckets) + capacity * sizeof(_Atomic(_node*)));
+    buckets->capacity = capacity;
+    for (size_t i = 0; i < capacity; ++i) {
+        atomic_init(&buckets->heads[i], NULL);
+    }
+    return buckets;
+}
+
+static _node* _find(ConcTab* conctab, _buckets* buckets, value_t key, uint64_t hash) {
+    _node* node = atomic_load_explicit(&buckets->heads[hash & (buckets->capacity - 1)],
+                                       memory_order_acquire);
+    while (node != NULL) {
+        if (node->hash == hash && _eq_key(conctab->type.key, node->key, key)) {
+            return node;
+        }
+        node = atomic_load_explicit(&node->next, memory_order_acquire);
+    }
+    return NULL;
+}
+
+// Sets the key in a locked shard. An owned key is a copy that the map may
+// keep, otherwise the key is copied when a new entry is created.
+static void _put(ConcTabThread* thread, _shard* shard, uint64_t hash, value_t key, _Bool owned, uint64_t value) {
+    ConcTab* conctab = thread->conctab;
+    _buckets* buckets = atomic_load_explicit(&shard->buckets, memory_order_relaxed);
+    _node* node = _find(conctab, buckets, key, hash);
+    if (node != NULL) {
+        atomic_store_explicit(&node->value, value, memory_order_relaxed);
+        if (owned && conctab->type.key == STRING_TYPE) {
+            free(key.string);
+        }
+        return;
+    }
+
+    node = (_node*)malloc(sizeof(_node));
+    node->hash = hash;
+    node->key = key;
+    if (!owned && conctab->type.key == STRING_TYPE) {
+        size_t size = strlen(key.string);
+        node->key.string = (char*)malloc(sizeof(char) * size + 1);
+        memcpy(node->key.string, key.string, size + 1);
+    }
+    atomic_init(&node->value, value);
+    _Atomic(_node*)* head = &buckets->heads[hash & (buckets->capacity - 1)];
+    atomic_init(&node->next, atomic_load_explicit(head, memory_order_relaxed));
+    atomic_store_explicit(head, node, memory_order_release);
+
+    if (atomic_fetch_add_explicit(&shard->size, 1, memory_order_relaxed) + 1 > buckets->capacity) {
+        _resize(thread, shard);
+    }
+}
+
+// NOTE: the readers may still walk the old chains, so the nodes are copied
+// into the new buckets instead of being relinked
+static void _resize(ConcTabThread* thread, _shard* shard) {
+    _buckets* old = atomic_load_explicit(&shard->buckets, memory_order_relaxed);
+    _buckets* buckets = _new_buckets(old->capacity * 2);
+    for (size_t i = 0; i < old->capacity; ++i) {
+        _node* node = atomic_load_explicit(&old->heads[i], memory_order_relaxed);
+        while (node != NULL) {
+            _node* copy = (_node*)malloc(sizeof(_node));
+            copy->hash = node->hash;
+            copy->key = node->key;
+            atomic_init(&copy->value, atomic_load_explicit(&node->value, memory_order_relaxed));
+            _Atomic(_node*)* head = &buckets->heads[node->hash & (buckets->capacity - 1)];
+            atomic_init(&copy->next, atomic_load_explicit(head, memory_order_relaxed));
+            atomic_init(head, copy);
+            node = atomic_load_explicit(&node->next, memory_order_relaxed);
+        }
+    }
+    atomic_store_explicit(&shard->buckets, buckets, memory_order_release);
+
+    // NOTE: nothing is retired before the new buckets are published, the
+    // epoch may move on while retiring and the old nodes must not be freed
+    // while a reader can still get to them
+    for (size_t i = 0; i < old->capacity; ++i) {
+        _node* node = atomic_load_explicit(&old->heads[i], memory_order_relaxed);
+        while (node != NULL) {
+            _node* next = atomic_load_explicit(&node->next, memory_order_relaxed);
+            _retire(thread, node, _RETIRED_NODE_COPIED);
+            node = next;
+        }
+    }
+    _retire(thread, old, _RETIRED_BUCKETS);
+}
+
+static void _enter_epoch(ConcTabThread* thread) {
+    atomic_store_explicit(&thread->epoch,
+                          atomic_load_explicit(&thread->conctab->epoch, memory_order_relaxed),
+                          memory_order_relaxed);
+    // NOTE: the epoch has to be published before anything is read from the map
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void _exit_epoch(ConcTabThread* thread) {
+    atomic_store_explicit(&thread->epoch, _QUIESCENT, memory_order_release);
+}
+
+static void _retire(ConcTabThread* thread, void* ptr, _retired_kind kind) {
+    _retired item = {
+        .ptr = ptr,
+        .epoch = atomic_load(&thread->conctab->epoch),
+        .kind = kind,
+    };
+    _push_retired(&thread->retired, item);
+    if (thread->retired.size % _RETIRE_THRESHOLD == 0) {
+        _collect(thread);
+    }
+}
+
+static void _push_retired(_retired_list* list, _retired item) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity == 0 ? _RETIRE_THRESHOLD : list->capacity * 2;
+        list->items = (_retired*)realloc(list->items, list->capacity * sizeof(_retired));
+    }
+    list->items[list->size++] = item;
+}
+
+// Frees what was retired before `epoch` - 1, nobody can see it anymore
+static void _free_retired(ConcTab* conctab, _retired_list* list, uint64_t epoch) {
+    size_t size = 0;
+    for (size_t i = 0; i < list->size; ++i) {
+        _retired item = list->items[i];
+        if (epoch != UINT64_MAX && item.epoch + 2 > epoch) {
+            list->items[size++] = item;
+            continue;
+        }
+        switch (item.kind) {
+        case _RETIRED_NODE:
+            if (conctab->type.key == STRING_TYPE) {
+                free(((_node*)item.ptr)->key.string);
+            }
+            free(item.ptr);
+            break;
+        case _RETIRED_NODE_COPIED:
+        case _RETIRED_BUCKETS:
+        default:
+            free(item.ptr);
+        }
+    }
+    list->size = size;
+}
+
+// NOTE: the epoch moves on only when every thread that is reading the map
+// has seen the current one, so a thread that is standing on a node retired
+// in the epoch e keeps the epoch below e + 2
+static void _collect(ConcTabThread* thread) {
+    ConcTab* conctab = thread->conctab;
+    mtx_lock(&conctab->threads_lock);
+    uint64_t epoch = atomic_load(&conctab->epoch);
+    _Bool advance = 1;
+    for (ConcTabThread* other = conctab->threads; other != NULL; other = other->next) {
+        uint64_t seen = atomic_load(&other->epoch);
+        if (seen != _QUIESCENT && seen != epoch) {
+            advance = 0;
+            break;
+        }
+    }
+    if (advance) {
+        epoch += 1;
+        atomic_store(&conctab->epoch, epoch);
+    }
+    _free_retired(conctab, &conctab->orphans, epoch);
+    mtx_unlock(&conctab->threads_lock);
+    _free_retired(conctab, &thread->retired, epoch);
+}
+
+static int _cmp_buffered(const void* x, const void* y) {
+    const _buffered* a = x;
+    const _buffered* b = y;
+    if (a->hash != b->hash) {
+        return a->hash < b->hash ? -1 : 1;
+    }
+    return (a->order > b->order) - (a->order < b->order);
+}
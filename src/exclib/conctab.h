@@ -0,0 +1,42 @@
+#ifndef EXTCLIB_CONCTAB_H_
+#define EXTCLIB_CONCTAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "type.h"
+
+// A hash map that is shared between threads. The keys are split between
+// shards that are locked separately by the writers, the readers do not
+// lock at all. The removed entries are freed once no reader can see them
+// anymore (epoch based reclamation), so every thread has to join the map
+// before using it.
+typedef struct ConcTab ConcTab;
+typedef struct ConcTabThread ConcTabThread;
+
+// NOTE: the values are copied out of the map by get_conctab, so only the
+// DECIMAL_TYPE and REAL_TYPE values are supported
+extern ConcTab* new_conctab(size_t shards, vtype_t key, vtype_t value);
+// All the threads have to leave the map before it is freed
+extern void free_conctab(ConcTab* conctab);
+
+extern ConcTabThread* join_conctab(ConcTab* conctab);
+extern void leave_conctab(ConcTabThread* thread);
+
+extern _Bool get_conctab(ConcTabThread* thread, void* key, value_t* value);
+extern int8_t set_conctab(ConcTabThread* thread, void* key, void* value);
+extern void del_conctab(ConcTabThread* thread, void* key);
+extern _Bool in_conctab(ConcTabThread* thread, void* key);
+
+// The sets buffered by a thread become visible to everyone, the thread
+// itself included, when the buffer fills up or is flushed. They are
+// applied one shard at a time, so the lock of a shard is taken only once
+// per flush.
+extern void buffer_conctab(ConcTabThread* thread, void* key, void* value);
+extern void flush_conctab(ConcTabThread* thread);
+
+extern size_t size_conctab(ConcTab* conctab);
+extern size_t sizeof_conctab(void);
+extern vtype_t keytype_conctab(ConcTab* conctab);
+
+#endif /* EXTCLIB_CONCTAB_H_ */
@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "swisstab.h"
+#include "type.h"
+
+#define _GROUP_WIDTH 16
+#define _CTRL_EMPTY ((int8_t)-128)
+#define _CTRL_DELETED ((int8_t)-2)
+// NOTE: slots of the old table moved into the new one by every set/del
+// while resizing, the new table is twice as big so the migration is over
+// long before it fills up
+#define _MIGRATE_STEP 64
+
+typedef struct _slot {
+    uint64_t hash;
+    value_t key;
+    value_t value;
+} _slot;
+
+// ctrl[i] is _CTRL_EMPTY, _CTRL_DELETED or the lower 7 bits of the hash
+// of slots[i]
+typedef struct _table {
+    int8_t* ctrl;
+    _slot* slots;
+    size_t capacity;
+    size_t growth_left;
+} _table;
+
+typedef struct SwissTab {
+    struct {
+        vtype_t key;
+        vtype_t value;
+    } type;
+    size_t size;
+    _table table;
+    // the table that is being migrated, its capacity is 0 when not resizing
+    _table old;
+    size_t cursor;
+} SwissTab;
+
+static uint64_t _get_hash(SwissTab* swisstab, void* key);
+static uint64_t _mix(uint64_t x);
+static uint32_t _match(const int8_t* group, int8_t ctrl);
+static uint32_t _match_free(const int8_t* group);
+static int _next_bit(uint32_t* mask);
+static _Bool _eq_key(vtype_t tkey, value_t x, void* key);
+static _Bool _eq_value(vtype_t tvalue, value_t x, value_t y);
+static size_t _find(const _table* table, vtype_t tkey, void* key, uint64_t hash);
+static size_t _find_free(const _table* table, uint64_t hash);
+static void _init_table(_table* table, size_t capacity);
+static void _insert_table(_table* table, const _slot* slot);
+static void _erase_table(_table* table, size_t i);
+static void _free_slot(SwissTab* swisstab, _slot* slot);
+static void _set_value(vtype_t tvalue, value_t* dst, void* value);
+static void _resize(SwissTab* swisstab, size_t capacity);
+static void _migrate(SwissTab* swisstab, size_t steps);
+static void _print_table(SwissTab* swisstab, const _table* table, const char* sep);
+static void _print_slot(SwissTab* swisstab, const _slot* slot);
+
+extern SwissTab* new_swisstab(size_t size, vtype_t key, vtype_t value) {
+    switch (key) {
+    case DECIMAL_TYPE:
+    case STRING_TYPE:
+        break;
+    case REAL_TYPE:
+    default:
+        fprintf(stderr, "%s\n", "key type not supported");
+        return NULL;
+    }
+    switch (value) {
+    case DECIMAL_TYPE:
+    case REAL_TYPE:
+    case STRING_TYPE:
+        break;
+    default:
+        fprintf(stderr, "%s\n", "value type not supported");
+        return NULL;
+    }
+    SwissTab* swisstab = (SwissTab*)malloc(sizeof(SwissTab));
+    swisstab->type.key = key;
+    swisstab->type.value = value;
+    swisstab->size = 0;
+    swisstab->old.capacity = 0;
+    swisstab->cursor = 0;
+    _init_table(&swisstab->table, _GROUP_WIDTH);
+    reserve_swisstab(swisstab, size);
+    return swisstab;
+}
+
+extern void free_swisstab(SwissTab* swisstab) {
+    _migrate(swisstab, SIZE_MAX);
+    for (size_t i = 0; i < swisstab->table.capacity; ++i) {
+        if (swisstab->table.ctrl[i] >= 0) {
+            _free_slot(swisstab, &swisstab->table.slots[i]);
+        }
+    }
+    free(swisstab->table.ctrl);
+    free(swisstab->table.slots);
+    free(swisstab);
+}
+
+extern value_t get_swisstab(SwissTab* swisstab, void* key) {
+    uint64_t hash = _get_hash(swisstab, key);
+    size_t i = _find(&swisstab->table, swisstab->type.key, key, hash);
+    if (i != SIZE_MAX) {
+        return swisstab->table.slots[i].value;
+    }
+    i = _find(&swisstab->old, swisstab->type.key, key, hash);
+    if (i != SIZE_MAX) {
+        return swisstab->old.slots[i].value;
+    }
+    value_t none = {
+        .decimal = 0,
+    };
+    return none;
+}
+
+extern int8_t set_swisstab(SwissTab* swisstab, void* key, void* value) {
+    _migrate(swisstab, _MIGRATE_STEP);
+
+    uint64_t hash = _get_hash(swisstab, key);
+    size_t i = _find(&swisstab->table, swisstab->type.key, key, hash);
+    if (i != SIZE_MAX) {
+        _set_value(swisstab->type.value, &swisstab->table.slots[i].value, value);
+        return 0;
+    }
+    // NOTE: the entries that were not migrated yet are updated in place
+    i = _find(&swisstab->old, swisstab->type.key, key, hash);
+    if (i != SIZE_MAX) {
+        _set_value(swisstab->type.value, &swisstab->old.slots[i].value, value);
+        return 0;
+    }
+
+    if (swisstab->table.growth_left == 0) {
+        size_t capacity = swisstab->table.capacity;
+        // NOTE: a table full of tombstones is rehashed in place
+        if (swisstab->size >= capacity / 2) {
+            capacity *= 2;
+        }
+        _resize(swisstab, capacity);
+    }
+
+    _slot slot;
+    slot.hash = hash;
+    switch (swisstab->type.key) {
+    case DECIMAL_TYPE:
+        slot.key.decimal = (int32_t)(intptr_t)key;
+        break;
+    case STRING_TYPE: {
+        size_t size = strlen((char*)key);
+        slot.key.string = (char*)malloc(sizeof(char) * size + 1);
+        memcpy(slot.key.string, key, size + 1);
+    }
+                    break;
+    case REAL_TYPE:
+    default:;
+    }
+    if (swisstab->type.value == STRING_TYPE) {
+        slot.value.string = NULL;
+    }
+    _set_value(swisstab->type.value, &slot.value, value);
+    _insert_table(&swisstab->table, &slot);
+    swisstab->size += 1;
+    return 0;
+}
+
+extern void del_swisstab(SwissTab* swisstab, void* key) {
+    _migrate(swisstab, _MIGRATE_STEP);
+
+    uint64_t hash = _get_hash(swisstab, key);
+    _table* table = &swisstab->table;
+    size_t i = _find(table, swisstab->type.key, key, hash);
+    if (i == SIZE_MAX) {
+        table = &swisstab->old;
+        i = _find(table, swisstab->type.key, key, hash);
+        if (i == SIZE_MAX) {
+            return;
+        }
+    }
+    _free_slot(swisstab, &table->slots[i]);
+    _erase_table(table, i);
+    swisstab->size -= 1;
+}
+
+extern _Bool in_swisstab(SwissTab* swisstab, void* key) {
+    uint64_t hash = _get_hash(swisstab, key);
+    return _find(&swisstab->table, swisstab->type.key, key, hash) != SIZE_MAX ||
+           _find(&swisstab->old, swisstab->type.key, key, hash) != SIZE_MAX;
+}
+
+extern void reserve_swisstab(SwissTab* swisstab, size_t size) {
+    size_t capacity = _GROUP_WIDTH;
+    while (capacity - capacity / 8 < size) {
+        capacity *= 2;
+    }
+    if (capacity > swisstab->table.capacity) {
+        _resize(swisstab, capacity);
+    }
+    _migrate(swisstab, SIZE_MAX);
+}
+
+extern _Bool eq_swisstab(SwissTab* x, SwissTab* y) {
+    if (x->type.key != y->type.key) {
+        return 0;
+    }
+    if (x->type.value != y->type.value) {
+        return 0;
+    }
+    if (x->size != y->size) {
+        return 0;
+    }
+    const _table* tables[] = {&x->table, &x->old};
+    for (size_t t = 0; t < 2; ++t) {
+        for (size_t i = 0; i < tables[t]->capacity; ++i) {
+            if (tables[t]->ctrl[i] < 0) {
+                continue;
+            }
+            const _slot* slot = &tables[t]->slots[i];
+            void* key = x->type.key == STRING_TYPE
+                        ? (void*)slot->key.string
+                        : (void*)(intptr_t)slot->key.decimal;
+            if (!in_swisstab(y, key)) {
+                return 0;
+            }
+            if (!_eq_value(x->type.value, slot->value, get_swisstab(y, key))) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+extern size_t size_swisstab(SwissTab* swisstab) {
+    return swisstab->size;
+}
+
+extern size_t sizeof_swisstab(void) {
+    return sizeof(SwissTab);
+}
+
+extern vtype_t keytype_swisstab(SwissTab* swisstab) {
+    return swisstab->type.key;
+}
+
+extern void print_swisstab(SwissTab* swisstab) {
+    printf("#S[ ");
+    _print_table(swisstab, &swisstab->table, "");
+    _print_table(swisstab, &swisstab->old, "");
+    putchar(']');
+}
+
+extern void println_swisstab(SwissTab* swisstab) {
+    print_swisstab(swisstab);
+    putchar('\n');
+}
+
+extern void print_swisstab_format(SwissTab* swisstab) {
+    printf("#S[\n");
+    _print_table(swisstab, &swisstab->table, "\t");
+    _print_table(swisstab, &swisstab->old, "\t");
+    putchar(']');
+}
+
+extern void println_swisstab_format(SwissTab* swisstab) {
+    print_swisstab_format(swisstab);
+    putchar('\n');
+}
+
+static uint64_t _get_hash(SwissTab* swisstab, void* key) {
+    uint64_t hash = 0;
+    switch (swisstab->type.key) {
+    case DECIMAL_TYPE:
+        hash = (uint32_t)(int32_t)(intptr_t)key;
+        break;
+    case STRING_TYPE:
+        // FNV-1a
+        hash = 14695981039346656037ULL;
+        for (const unsigned char* s = key; *s != '\0'; ++s) {
+            hash = (hash ^ *s) * 1099511628211ULL;
+        }
+        break;
+    case REAL_TYPE:
+    default:;
+    }
+    return _mix(hash);
+}
+
+// NOTE: the finalizer of MurmurHash3, both halves of the hash have to be
+// good since the high bits pick the group and the low 7 bits are matched
+// inside of it
+static uint64_t _mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+#ifdef __SSE2__
+static uint32_t _match(const int8_t* group, int8_t ctrl) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+}
+
+static uint32_t _match_free(const int8_t* group) {
+    // NOTE: both _CTRL_EMPTY and _CTRL_DELETED have the sign bit set
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+#else
+static uint32_t _match(const int8_t* group, int8_t ctrl) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < _GROUP_WIDTH; ++i) {
+        mask |= (uint32_t)(group[i] == ctrl) << i;
+    }
+    return mask;
+}
+
+static uint32_t _match_free(const int8_t* group) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < _GROUP_WIDTH; ++i) {
+        mask |= (uint32_t)(group[i] < 0) << i;
+    }
+    return mask;
+}
+#endif
+
+static int _next_bit(uint32_t* mask) {
+#ifdef __GNUC__
+    int i = __builtin_ctz(*mask);
+#else
+    int i = 0;
+    while ((*mask & (1u << i)) == 0) {
+        ++i;
+    }
+#endif
+    *mask &= *mask - 1;
+    return i;
+}
+
+static _Bool _eq_key(vtype_t tkey, value_t x, void* key) {
+    switch (tkey) {
+    case DECIMAL_TYPE:
+        return x.decimal == (int32_t)(intptr_t)key;
+    case STRING_TYPE:
+        return strcmp(x.string, (char*)key) == 0;
+    case REAL_TYPE:
+    default:
+        return 0;
+    }
+}
+
+static _Bool _eq_value(vtype_t tvalue, value_t x, value_t y) {
+    switch (tvalue) {
+    case DECIMAL_TYPE:
+        return x.decimal == y.decimal;
+    case REAL_TYPE:
+        return x.real == y.real;
+    case STRING_TYPE:
+        return strcmp(x.string, y.string) == 0;
+    default:
+        return 0;
+    }
+}
+
+// NOTE: the groups are probed in triangular order which visits every group
+// of a power of two table exactly once
+static size_t _find(const _table* table, vtype_t tkey, void* key, uint64_t hash) {
+    if (table->capacity == 0) {
+        return SIZE_MAX;
+    }
+    const size_t mask = table->capacity - 1;
+    const int8_t h2 = (int8_t)(hash & 0x7F);
+    size_t pos = (size_t)(hash >> 7) & mask & ~(size_t)(_GROUP_WIDTH - 1);
+    for (size_t stride = _GROUP_WIDTH; stride <= table->capacity; stride += _GROUP_WIDTH) {
+        const int8_t* group = &table->ctrl[pos];
+        uint32_t match = _match(group, h2);
+        while (match != 0) {
+            size_t i = pos + (size_t)_next_bit(&match);
+            if (table->slots[i].hash == hash && _eq_key(tkey, table->slots[i].key, key)) {
+                return i;
+            }
+        }
+        if (_match(group, _CTRL_EMPTY) != 0) {
+            return SIZE_MAX;
+        }
+        pos = (pos + stride) & mask;
+    }
+    return SIZE_MAX;
+}
+
+static size_t _find_free(const _table* table, uint64_t hash) {
+    const size_t mask = table->capacity - 1;
+    size_t pos = (size_t)(hash >> 7) & mask & ~(size_t)(_GROUP_WIDTH - 1);
+    for (size_t stride = _GROUP_WIDTH; ; stride += _GROUP_WIDTH) {
+        uint32_t match = _match_free(&table->ctrl[pos]);
+        if (match != 0) {
+            return pos + (size_t)_next_bit(&match);
+        }
+        pos = (pos + stride) & mask;
+    }
+}
+
+static void _init_table(_table* table, size_t capacity) {
+    table->ctrl = (int8_t*)malloc(capacity);
+    memset(table->ctrl, _CTRL_EMPTY, capacity);
+    table->slots = (_slot*)malloc(capacity * sizeof(_slot));
+    table->capacity = capacity;
+    table->growth_left = capacity - capacity / 8;
+}
+
+static void _insert_table(_table* table, const _slot* slot) {
+    size_t i = _find_free(table, slot->hash);
+    if (table->ctrl[i] == _CTRL_EMPTY) {
+        table->growth_left -= 1;
+    }
+    table->ctrl[i] = (int8_t)(slot->hash & 0x7F);
+    table->slots[i] = *slot;
+}
+
+// NOTE: a probe only stops at a group with an empty slot, so a slot may go
+// back to empty only if its group never filled up, otherwise it becomes a
+// tombstone until the next resize
+static void _erase_table(_table* table, size_t i) {
+    const int8_t* group = &table->ctrl[i & ~(size_t)(_GROUP_WIDTH - 1)];
+    if (_match(group, _CTRL_EMPTY) != 0) {
+        table->ctrl[i] = _CTRL_EMPTY;
+        table->growth_left += 1;
+    } else {
+        table->ctrl[i] = _CTRL_DELETED;
+    }
+}
+
+static void _free_slot(SwissTab* swisstab, _slot* slot) {
+    if (swisstab->type.key == STRING_TYPE) {
+        free(slot->key.string);
+    }
+    if (swisstab->type.value == STRING_TYPE) {
+        free(slot->value.string);
+    }
+}
+
+static void _set_value(vtype_t tvalue, value_t* dst, void* value) {
+    switch (tvalue) {
+    case DECIMAL_TYPE:
+        dst->decimal = (int32_t)(intptr_t)value;
+        break;
+    case REAL_TYPE:
+        dst->real = as_real(value);
+        break;
+    case STRING_TYPE: {
+        size_t size = strlen((char*)value);
+        free(dst->string);
+        dst->string = (char*)malloc(sizeof(char) * size + 1);
+        memcpy(dst->string, value, size + 1);
+    }
+                    break;
+    default:;
+    }
+}
+
+static void _resize(SwissTab* swisstab, size_t capacity) {
+    // NOTE: only one migration at a time
+    _migrate(swisstab, SIZE_MAX);
+    swisstab->old = swisstab->table;
+    swisstab->cursor = 0;
+    _init_table(&swisstab->table, capacity);
+}
+
+static void _migrate(SwissTab* swisstab, size_t steps) {
+    _table* old = &swisstab->old;
+    if (old->capacity == 0) {
+        return;
+    }
+    while (steps > 0 && swisstab->cursor < old->capacity) {
+        size_t i = swisstab->cursor++;
+        if (old->ctrl[i] >= 0) {
+            _insert_table(&swisstab->table, &old->slots[i]);
+            old->ctrl[i] = _CTRL_DELETED;
+        }
+        steps -= 1;
+    }
+    if (swisstab->cursor == old->capacity) {
+        free(old->ctrl);
+        free(old->slots);
+        old->capacity = 0;
+    }
+}
+
+static void _print_table(SwissTab* swisstab, const _table* table, const char* sep) {
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->ctrl[i] < 0) {
+            continue;
+        }
+        printf("%s", sep);
+        _print_slot(swisstab, &table->slots[i]);
+        if (*sep != '\0') {
+            putchar('\n');
+        }
+    }
+}
+
+static void _print_slot(SwissTab* swisstab, const _slot* slot) {
+    putchar('{');
+    switch (swisstab->type.key) {
+    case DECIMAL_TYPE:
+        printf("%d", slot->key.decimal);
+        break;
+    case STRING_TYPE:
+        printf("'%s'", slot->key.string);
+        break;
+    case REAL_TYPE:
+    default:;
+    }
+    printf(" => ");
+    switch (swisstab->type.value) {
+    case DECIMAL_TYPE:
+        printf("%d", slot->value.decimal);
+        break;
+    case REAL_TYPE:
+        printf("%lf", slot->value.real);
+        break;
+    case STRING_TYPE:
+        printf("'%s'", slot->value.string);
+        break;
+    default:;
+    }
+    printf("} ");
+}
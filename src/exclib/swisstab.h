@@ -0,0 +1,38 @@
+#ifndef EXTCLIB_SWISSTAB_H_
+#define EXTCLIB_SWISSTAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "type.h"
+
+// Open addressing replacement for HashTab. The slots are probed a group of
+// 16 control bytes at a time, growing moves the entries into the new table
+// a few slots per set/del instead of all at once.
+typedef struct SwissTab SwissTab;
+
+extern SwissTab* new_swisstab(size_t size, vtype_t key, vtype_t value);
+extern void free_swisstab(SwissTab* swisstab);
+
+// NOTE: unlike get_hashtab a missing key is not an error, the zero value is
+// returned and in_swisstab tells the two apart
+extern value_t get_swisstab(SwissTab* swisstab, void* key);
+extern int8_t set_swisstab(SwissTab* swisstab, void* key, void* value);
+extern void del_swisstab(SwissTab* swisstab, void* key);
+extern _Bool in_swisstab(SwissTab* swisstab, void* key);
+
+// Makes room for `size` entries so that many sets never resize
+extern void reserve_swisstab(SwissTab* swisstab, size_t size);
+
+extern _Bool eq_swisstab(SwissTab* x, SwissTab* y);
+extern size_t size_swisstab(SwissTab* swisstab);
+extern size_t sizeof_swisstab(void);
+extern vtype_t keytype_swisstab(SwissTab* swisstab);
+
+extern void print_swisstab(SwissTab* swisstab);
+extern void println_swisstab(SwissTab* swisstab);
+
+extern void print_swisstab_format(SwissTab* swisstab);
+extern void println_swisstab_format(SwissTab* swisstab);
+
+#endif /* EXTCLIB_SWISSTAB_H_ */
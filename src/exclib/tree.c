@@ -5,15 +5,21 @@
 #include "tree.h"
 #include "type.h"
 
+// NOTE: an AVL tree of 2^32 nodes is less than 47 levels deep
+#define _MAX_HEIGHT 64
+#define _POOL_INITIAL_CAPACITY 16
+
+// The nodes live in the pool of the tree and refer to each other by the
+// index in it, the index 0 is the null node. The freed nodes are linked
+// through `left` and have the height 0.
 typedef struct tree_node {
     struct {
         value_t key;
         value_t value;
     } data;
-    _Bool exist;
-    struct tree_node* left;
-    struct tree_node* right;
-    struct tree_node* parent;
+    uint32_t left;
+    uint32_t right;
+    int32_t height;
 } tree_node;
 
 typedef struct Tree {
@@ -22,32 +28,45 @@ typedef struct Tree {
         vtype_t value;
     } type;
     size_t size;
-    struct tree_node* node;
+    uint32_t root;
+    uint32_t free;
+    tree_node* pool;
+    uint32_t pool_size;
+    uint32_t pool_capacity;
 } Tree;
 
-static tree_node* _new_node(vtype_t tkey, vtype_t tvalue, void* key, void* value);
-static void _set_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue, void* key, void* value);
-static void _set_key(tree_node* node, vtype_t tkey, void* key);
-static void _set_value(tree_node* node, vtype_t tvalue, void* value);
-static void _free_tree(Tree* tree, tree_node* node);
+typedef struct TreeCursor {
+    Tree* tree;
+    size_t depth;
+    uint32_t path[_MAX_HEIGHT];
+} TreeCursor;
+
+static uint32_t _new_node(Tree* tree);
+static void _reserve_pool(Tree* tree, uint32_t capacity);
+static void _set_key(vtype_t tkey, value_t* dst, void* key);
+static void _set_value(vtype_t tvalue, value_t* dst, void* value);
 static void _free_key_tree(vtype_t type, tree_node* node);
 static void _free_value_tree(vtype_t type, tree_node* node);
-static void _print_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue);
-static void _print_branches_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue);
-static void _print_node_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue);
-static tree_node* _get_tree(tree_node* node, vtype_t tkey, void* key);
-static int8_t _cmp_tkey_tree(tree_node* node, vtype_t tkey, void* key);
-static int8_t _cmp_int32(int32_t x, int32_t y);
-static tree_node* _del1_tree(Tree* tree, vtype_t tkey, void* key);
-static void _del2_tree(Tree* tree, tree_node* node);
-static void _del3_tree(Tree* tree, tree_node* node);
-static _Bool _eq_tree(vtype_t tkey, vtype_t tvalue, tree_node* x, tree_node* y);
+static int _cmp_tkey_tree(Tree* tree, uint32_t node, void* key);
+static int _cmp_key_tree(vtype_t tkey, value_t x, value_t y);
+static int32_t _height(Tree* tree, uint32_t node);
+static void _update_height(Tree* tree, uint32_t node);
+static uint32_t _rotate_left(Tree* tree, uint32_t node);
+static uint32_t _rotate_right(Tree* tree, uint32_t node);
+static uint32_t _balance(Tree* tree, uint32_t node);
+static void _rebalance_path(Tree* tree, uint32_t* path, size_t depth);
+static uint32_t _get_tree(Tree* tree, void* key);
+static void _push_left(TreeCursor* cursor, uint32_t node);
+static uint32_t _next_node(TreeCursor* cursor);
+static _Bool _eq_value_tree(vtype_t tvalue, value_t x, value_t y);
+static void _print_node_tree(Tree* tree, tree_node* node);
 
 extern Tree* new_tree(vtype_t key, vtype_t value) {
     switch (key) {
     case DECIMAL_TYPE:
     case STRING_TYPE:
         break;
+    case REAL_TYPE:
     default:
         fprintf(stderr, "%s\n", "key type not supported");
         return NULL;
@@ -64,53 +83,245 @@ extern Tree* new_tree(vtype_t key, vtype_t value) {
     Tree* tree = (Tree*)malloc(sizeof(Tree));
     tree->type.key = key;
     tree->type.value = value;
-    tree->node = NULL;
     tree->size = 0;
+    tree->root = 0;
+    tree->free = 0;
+    tree->pool = NULL;
+    tree->pool_size = 1;
+    tree->pool_capacity = 0;
     return tree;
 }
 
 extern void free_tree(Tree* tree) {
-    _free_tree(tree, tree->node);
+    for (uint32_t i = 1; i < tree->pool_size; ++i) {
+        if (tree->pool[i].height > 0) {
+            _free_key_tree(tree->type.key, &tree->pool[i]);
+            _free_value_tree(tree->type.value, &tree->pool[i]);
+        }
+    }
+    free(tree->pool);
     free(tree);
 }
 
 extern _Bool in_tree(Tree* tree, void* key) {
-    return _get_tree(tree->node, tree->type.key, key) != NULL;
+    return _get_tree(tree, key) != 0;
 }
 
 extern value_t get_tree(Tree* tree, void* key) {
-    tree_node* node = _get_tree(tree->node, tree->type.key, key);
-    if (node == NULL) {
+    uint32_t node = _get_tree(tree, key);
+    if (node == 0) {
         fprintf(stderr, "%s\n", "value undefined");
         value_t none = {
             .decimal = 0,
         };
         return none;
     }
-    return node->data.value;
+    return tree->pool[node].data.value;
 }
 
 extern int8_t set_tree(Tree* tree, void* key, void* value) {
-    if (tree->node == NULL) {
-        tree->node = _new_node(tree->type.key, tree->type.value, key, value);
-        tree->size += 1;
+    uint32_t path[_MAX_HEIGHT];
+    size_t depth = 0;
+    int cond = 0;
+    for (uint32_t node = tree->root; node != 0; ) {
+        cond = _cmp_tkey_tree(tree, node, key);
+        if (cond == 0) {
+            _set_value(tree->type.value, &tree->pool[node].data.value, value);
+            return 0;
+        }
+        path[depth++] = node;
+        node = cond < 0 ? tree->pool[node].left : tree->pool[node].right;
+    }
+
+    uint32_t node = _new_node(tree);
+    _set_key(tree->type.key, &tree->pool[node].data.key, key);
+    tree->pool[node].data.value.string = NULL;
+    _set_value(tree->type.value, &tree->pool[node].data.value, value);
+    tree->size += 1;
+
+    if (depth == 0) {
+        tree->root = node;
         return 0;
     }
-    _set_tree(tree, tree->node, tree->type.key, tree->type.value, key, value);
+    if (cond < 0) {
+        tree->pool[path[depth - 1]].left = node;
+    }
+    else {
+        tree->pool[path[depth - 1]].right = node;
+    }
+    _rebalance_path(tree, path, depth);
     return 0;
 }
 
 extern void del_tree(Tree* tree, void* key) {
-    tree_node* node = _del1_tree(tree, tree->type.key, key);
-    if (node == NULL) {
-        return;
+    uint32_t path[_MAX_HEIGHT];
+    size_t depth = 0;
+    uint32_t node = tree->root;
+    while (node != 0) {
+        int cond = _cmp_tkey_tree(tree, node, key);
+        if (cond == 0) {
+            break;
+        }
+        path[depth++] = node;
+        node = cond < 0 ? tree->pool[node].left : tree->pool[node].right;
     }
-    if (node->left != NULL && node->right != NULL) {
-        _del3_tree(tree, node);
+    if (node == 0) {
         return;
     }
-    _del2_tree(tree, node);
-    return;
+
+    _free_key_tree(tree->type.key, &tree->pool[node]);
+    _free_value_tree(tree->type.value, &tree->pool[node]);
+
+    // NOTE: a node with two children takes the data of its successor, and
+    // the successor is unlinked instead
+    uint32_t removed = node;
+    uint32_t child = 0;
+    if (tree->pool[node].left != 0 && tree->pool[node].right != 0) {
+        path[depth++] = node;
+        removed = tree->pool[node].right;
+        while (tree->pool[removed].left != 0) {
+            path[depth++] = removed;
+            removed = tree->pool[removed].left;
+        }
+        tree->pool[node].data = tree->pool[removed].data;
+        child = tree->pool[removed].right;
+    }
+    else {
+        child = tree->pool[node].left != 0 ? tree->pool[node].left : tree->pool[node].right;
+    }
+
+    if (depth == 0) {
+        tree->root = child;
+    }
+    else if (tree->pool[path[depth - 1]].left == removed) {
+        tree->pool[path[depth - 1]].left = child;
+    }
+    else {
+        tree->pool[path[depth - 1]].right = child;
+    }
+
+    tree->pool[removed].height = 0;
+    tree->pool[removed].left = tree->free;
+    tree->free = removed;
+    tree->size -= 1;
+
+    _rebalance_path(tree, path, depth);
+}
+
+extern int8_t load_tree(Tree* tree, void** keys, void** values, size_t size) {
+    if (tree->size != 0 || size >= UINT32_MAX) {
+        return -1;
+    }
+    for (size_t i = 1; i < size; ++i) {
+        value_t x;
+        value_t y;
+        if (tree->type.key == STRING_TYPE) {
+            x.string = (char*)keys[i - 1];
+            y.string = (char*)keys[i];
+        }
+        else {
+            x.decimal = (int32_t)(intptr_t)keys[i - 1];
+            y.decimal = (int32_t)(intptr_t)keys[i];
+        }
+        if (_cmp_key_tree(tree->type.key, x, y) >= 0) {
+            return -1;
+        }
+    }
+
+    // NOTE: the nodes are taken from the pool in the order of the keys, so
+    // a scan over a loaded tree walks the pool from the start to the end
+    tree->free = 0;
+    tree->pool_size = 1;
+    _reserve_pool(tree, (uint32_t)size + 1);
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t node = _new_node(tree);
+        _set_key(tree->type.key, &tree->pool[node].data.key, keys[i]);
+        tree->pool[node].data.value.string = NULL;
+        _set_value(tree->type.value, &tree->pool[node].data.value, values[i]);
+    }
+    tree->size = size;
+
+    // NOTE: the middle of every range becomes the root of its subtree, and
+    // the height of a subtree of n nodes built like that is the bit length
+    // of n, so the tree is built top down without recursion
+    struct {
+        size_t lo;
+        size_t hi;
+        uint32_t* link;
+    } stack[2 * _MAX_HEIGHT];
+    size_t stack_size = 0;
+    tree->root = 0;
+    stack[stack_size].lo = 0;
+    stack[stack_size].hi = size;
+    stack[stack_size].link = &tree->root;
+    stack_size += 1;
+    while (stack_size > 0) {
+        stack_size -= 1;
+        size_t lo = stack[stack_size].lo;
+        size_t hi = stack[stack_size].hi;
+        uint32_t* link = stack[stack_size].link;
+        if (lo == hi) {
+            *link = 0;
+            continue;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t node = (uint32_t)mid + 1;
+        int32_t height = 0;
+        for (size_t n = hi - lo; n > 0; n >>= 1) {
+            height += 1;
+        }
+        tree->pool[node].height = height;
+        *link = node;
+        stack[stack_size].lo = lo;
+        stack[stack_size].hi = mid;
+        stack[stack_size].link = &tree->pool[node].left;
+        stack_size += 1;
+        stack[stack_size].lo = mid + 1;
+        stack[stack_size].hi = hi;
+        stack[stack_size].link = &tree->pool[node].right;
+        stack_size += 1;
+    }
+    return 0;
+}
+
+extern TreeCursor* new_tree_cursor(Tree* tree) {
+    TreeCursor* cursor = (TreeCursor*)malloc(sizeof(TreeCursor));
+    cursor->tree = tree;
+    cursor->depth = 0;
+    _push_left(cursor, tree->root);
+    return cursor;
+}
+
+extern void free_tree_cursor(TreeCursor* cursor) {
+    free(cursor);
+}
+
+extern void seek_tree_cursor(TreeCursor* cursor, void* key) {
+    Tree* tree = cursor->tree;
+    cursor->depth = 0;
+    for (uint32_t node = tree->root; node != 0; ) {
+        if (_cmp_tkey_tree(tree, node, key) <= 0) {
+            cursor->path[cursor->depth++] = node;
+            node = tree->pool[node].left;
+        }
+        else {
+            node = tree->pool[node].right;
+        }
+    }
+}
+
+extern _Bool next_tree_cursor(TreeCursor* cursor, value_t* key, value_t* value) {
+    uint32_t node = _next_node(cursor);
+    if (node == 0) {
+        return 0;
+    }
+    if (key != NULL) {
+        *key = cursor->tree->pool[node].data.key;
+    }
+    if (value != NULL) {
+        *value = cursor->tree->pool[node].data.value;
+    }
+    return 1;
 }
 
 extern _Bool eq_tree(Tree* x, Tree* y) {
@@ -123,40 +334,21 @@ extern _Bool eq_tree(Tree* x, Tree* y) {
     if (x->size != y->size) {
         return 0;
     }
-    return _eq_tree(x->type.key, x->type.value, x->node, y->node);
-}
-
-static _Bool _eq_tree(vtype_t tkey, vtype_t tvalue, tree_node* x, tree_node* y) {
-    if (x == NULL && y == NULL) {
-        return 1;
-    }
-    if (x != NULL && y != NULL) {
-        _Bool fkey = 0;
-        _Bool fval = 0;
-        switch (tkey) {
-        case DECIMAL_TYPE:
-            fkey = x->data.key.decimal == y->data.key.decimal;
-            break;
-        case STRING_TYPE:
-            fkey = strcmp((char*)x->data.key.string, (char*)y->data.key.string) == 0;
-            break;
-        default:;
+    TreeCursor cx = {.tree = x, .depth = 0};
+    TreeCursor cy = {.tree = y, .depth = 0};
+    _push_left(&cx, x->root);
+    _push_left(&cy, y->root);
+    for (uint32_t nx = _next_node(&cx), ny = _next_node(&cy);
+         nx != 0 && ny != 0;
+         nx = _next_node(&cx), ny = _next_node(&cy)) {
+        if (_cmp_key_tree(x->type.key, x->pool[nx].data.key, y->pool[ny].data.key) != 0) {
+            return 0;
         }
-        switch (tvalue) {
-        case DECIMAL_TYPE:
-            fval = x->data.value.decimal == y->data.value.decimal;
-            break;
-        case REAL_TYPE:
-            fval = x->data.value.real == y->data.value.real;
-            break;
-        case STRING_TYPE:
-            fval = strcmp((char*)x->data.value.string, (char*)y->data.value.string) == 0;
-            break;
-        default:;
+        if (!_eq_value_tree(x->type.value, x->pool[nx].data.value, y->pool[ny].data.value)) {
+            return 0;
         }
-        return fkey && fval && _eq_tree(tkey, tvalue, x->left, y->left) && _eq_tree(tkey, tvalue, x->right, y->right);
     }
-    return 0;
+    return 1;
 }
 
 extern size_t size_tree(Tree* tree) {
@@ -169,7 +361,11 @@ extern size_t sizeof_tree(void) {
 
 extern void print_tree(Tree* tree) {
     printf("#T[ ");
-    _print_tree(tree, tree->node, tree->type.key, tree->type.value);
+    TreeCursor cursor = {.tree = tree, .depth = 0};
+    _push_left(&cursor, tree->root);
+    for (uint32_t node = _next_node(&cursor); node != 0; node = _next_node(&cursor)) {
+        _print_node_tree(tree, &tree->pool[node]);
+    }
     putchar(']');
 }
 
@@ -179,216 +375,276 @@ extern void println_tree(Tree* tree) {
 }
 
 extern void print_tree_branches(Tree* tree) {
-    _print_branches_tree(tree, tree->node, tree->type.key, tree->type.value);
+    // NOTE: every node is visited three times: before its left subtree,
+    // between the subtrees and after its right subtree
+    struct {
+        uint32_t node;
+        uint8_t visit;
+    } stack[_MAX_HEIGHT + 1];
+    size_t depth = 0;
+    stack[depth].node = tree->root;
+    stack[depth].visit = 0;
+    depth += 1;
+    while (depth > 0) {
+        uint32_t node = stack[depth - 1].node;
+        if (node == 0) {
+            printf("null");
+            depth -= 1;
+            continue;
+        }
+        switch (stack[depth - 1].visit++) {
+        case 0:
+            putchar('(');
+            stack[depth].node = tree->pool[node].left;
+            stack[depth].visit = 0;
+            depth += 1;
+            break;
+        case 1:
+            putchar(' ');
+            _print_node_tree(tree, &tree->pool[node]);
+            stack[depth].node = tree->pool[node].right;
+            stack[depth].visit = 0;
+            depth += 1;
+            break;
+        default:
+            putchar(')');
+            depth -= 1;
+        }
+    }
 }
 
 extern void println_tree_branches(Tree* tree) {
-    _print_branches_tree(tree, tree->node, tree->type.key, tree->type.value);
+    print_tree_branches(tree);
     putchar('\n');
 }
 
-static tree_node* _new_node(vtype_t tkey, vtype_t tvalue, void* key, void* value) {
-    tree_node* node = (tree_node*)malloc(sizeof(tree_node));
-    node->exist = 0;
-    _set_key(node, tkey, key);
-    _set_value(node, tvalue, value);
-    node->left = NULL;
-    node->right = NULL;
-    node->parent = NULL;
+static uint32_t _new_node(Tree* tree) {
+    uint32_t node = tree->free;
+    if (node != 0) {
+        tree->free = tree->pool[node].left;
+    }
+    else {
+        if (tree->pool_size >= tree->pool_capacity) {
+            _reserve_pool(tree, tree->pool_capacity == 0 ? _POOL_INITIAL_CAPACITY : tree->pool_capacity * 2);
+        }
+        node = tree->pool_size++;
+    }
+    tree->pool[node].left = 0;
+    tree->pool[node].right = 0;
+    tree->pool[node].height = 1;
     return node;
 }
 
-static void _set_key(tree_node* node, vtype_t tkey, void* key) {
-    if (node->exist) {
-        _free_key_tree(tkey, node);
+static void _reserve_pool(Tree* tree, uint32_t capacity) {
+    if (capacity <= tree->pool_capacity) {
+        return;
     }
+    tree->pool = (tree_node*)realloc(tree->pool, capacity * sizeof(tree_node));
+    tree->pool_capacity = capacity;
+}
+
+static void _set_key(vtype_t tkey, value_t* dst, void* key) {
     switch (tkey) {
     case DECIMAL_TYPE:
-        node->data.key.decimal = (int32_t)(intptr_t)key;
+        dst->decimal = (int32_t)(intptr_t)key;
         break;
     case STRING_TYPE: {
         size_t size = strlen((char*)key);
-        node->data.key.string = (char*)malloc(sizeof(char) * size + 1);
-        strcpy(node->data.key.string, (char*)key);
+        dst->string = (char*)malloc(sizeof(char) * size + 1);
+        strcpy(dst->string, (char*)key);
     }
                     break;
+    case REAL_TYPE:
     default:;
     }
 }
 
-static void _set_value(tree_node* node, vtype_t tvalue, void* value) {
-    if (node->exist) {
-        _free_value_tree(tvalue, node);
-    }
+static void _set_value(vtype_t tvalue, value_t* dst, void* value) {
     switch (tvalue) {
     case DECIMAL_TYPE:
-        node->data.value.decimal = (int32_t)(intptr_t)value;
+        dst->decimal = (int32_t)(intptr_t)value;
         break;
     case REAL_TYPE:
-        node->data.value.real = *(double*)value;
-        free((double*)value);
+        dst->real = as_real(value);
         break;
     case STRING_TYPE: {
         size_t size = strlen((char*)value);
-        node->data.value.string = (char*)malloc(sizeof(char) * size + 1);
-        strcpy(node->data.value.string, (char*)value);
+        free(dst->string);
+        dst->string = (char*)malloc(sizeof(char) * size + 1);
+        strcpy(dst->string, (char*)value);
     }
                     break;
     default:;
     }
-    node->exist = 1;
 }
 
-static void _set_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue, void* key, void* value) {
-    int8_t cond = _cmp_tkey_tree(node, tkey, key);
-    if (cond > 0) {
-        if (node->right == NULL) {
-            node->right = _new_node(tkey, tvalue, key, value);
-            node->right->parent = node;
-            tree->size += 1;
-        }
-        else {
-            _set_tree(tree, node->right, tkey, tvalue, key, value);
-        }
-    }
-    else if (cond < 0) {
-        if (node->left == NULL) {
-            node->left = _new_node(tkey, tvalue, key, value);
-            node->left->parent = node;
-            tree->size += 1;
-        }
-        else {
-            _set_tree(tree, node->left, tkey, tvalue, key, value);
-        }
-    }
-    else {
-        _set_key(node, tkey, key);
-        _set_value(node, tvalue, value);
+static void _free_key_tree(vtype_t type, tree_node* node) {
+    switch (type) {
+    case STRING_TYPE:
+        free(node->data.key.string);
+        break;
+    case DECIMAL_TYPE:
+    case REAL_TYPE:
+    default:;
     }
 }
 
-static tree_node* _get_tree(tree_node* node, vtype_t tkey, void* key) {
-    if (node == NULL) {
-        return NULL;
+static void _free_value_tree(vtype_t type, tree_node* node) {
+    switch (type) {
+    case STRING_TYPE:
+        free(node->data.value.string);
+        break;
+    case DECIMAL_TYPE:
+    case REAL_TYPE:
+    default:;
     }
-    int8_t cond = _cmp_tkey_tree(node, tkey, key);
-    if (cond > 0) {
-        return _get_tree(node->right, tkey, key);
+}
+
+static int _cmp_tkey_tree(Tree* tree, uint32_t node, void* key) {
+    value_t x;
+    if (tree->type.key == STRING_TYPE) {
+        x.string = (char*)key;
     }
-    else if (cond < 0) {
-        return _get_tree(node->left, tkey, key);
+    else {
+        x.decimal = (int32_t)(intptr_t)key;
     }
-    return node;
+    return _cmp_key_tree(tree->type.key, x, tree->pool[node].data.key);
 }
 
-static int8_t _cmp_tkey_tree(tree_node* node, vtype_t tkey, void* key) {
-    int8_t cond = 0;
+static int _cmp_key_tree(vtype_t tkey, value_t x, value_t y) {
     switch (tkey) {
     case DECIMAL_TYPE:
-        cond = _cmp_int32((int32_t)(intptr_t)key, node->data.key.decimal);
-        break;
+        return (x.decimal > y.decimal) - (x.decimal < y.decimal);
     case STRING_TYPE:
-        cond = strcmp((char*)key, node->data.key.string);
-        break;
-    default:;
+        return strcmp(x.string, y.string);
+    case REAL_TYPE:
+    default:
+        return 0;
     }
-    return cond;
 }
 
-static int8_t _cmp_int32(int32_t x, int32_t y) {
-    if (x > y) {
-        return 1;
-    }
-    else if (x < y) {
-        return -1;
-    }
-    return 0;
+static int32_t _height(Tree* tree, uint32_t node) {
+    return node == 0 ? 0 : tree->pool[node].height;
 }
 
-static tree_node* _del1_tree(Tree* tree, vtype_t tkey, void* key) {
-    tree_node* node = tree->node;
-    node = _get_tree(node, tkey, key);
-    if (node == NULL) {
-        return NULL;
-    }
-    if (node->left != NULL || node->right != NULL) {
-        return node;
-    }
-    tree_node* parent = node->parent;
-    if (parent == NULL) {
-        tree->node = NULL;
-    }
-    else if (parent->left == node) {
-        parent->left = NULL;
-    }
-    else {
-        parent->right = NULL;
-    }
-    tree->size -= 1;
-    _free_key_tree(tree->type.key, node);
-    _free_value_tree(tree->type.value, node);
-    free(node);
-    return NULL;
+static void _update_height(Tree* tree, uint32_t node) {
+    int32_t left = _height(tree, tree->pool[node].left);
+    int32_t right = _height(tree, tree->pool[node].right);
+    tree->pool[node].height = (left > right ? left : right) + 1;
 }
 
-static void _del2_tree(Tree* tree, tree_node* node) {
-    tree_node* parent = node->parent;
-    tree_node* temp;
-    if (node->right != NULL) {
-        temp = node->right;
-    }
-    else {
-        temp = node->left;
+static uint32_t _rotate_left(Tree* tree, uint32_t node) {
+    uint32_t right = tree->pool[node].right;
+    tree->pool[node].right = tree->pool[right].left;
+    tree->pool[right].left = node;
+    _update_height(tree, node);
+    _update_height(tree, right);
+    return right;
+}
+
+static uint32_t _rotate_right(Tree* tree, uint32_t node) {
+    uint32_t left = tree->pool[node].left;
+    tree->pool[node].left = tree->pool[left].right;
+    tree->pool[left].right = node;
+    _update_height(tree, node);
+    _update_height(tree, left);
+    return left;
+}
+
+static uint32_t _balance(Tree* tree, uint32_t node) {
+    _update_height(tree, node);
+    uint32_t left = tree->pool[node].left;
+    uint32_t right = tree->pool[node].right;
+    int32_t factor = _height(tree, left) - _height(tree, right);
+    if (factor > 1) {
+        if (_height(tree, tree->pool[left].left) < _height(tree, tree->pool[left].right)) {
+            tree->pool[node].left = _rotate_left(tree, left);
+        }
+        return _rotate_right(tree, node);
     }
-    if (parent == NULL) {
-        tree->node = temp;
+    if (factor < -1) {
+        if (_height(tree, tree->pool[right].right) < _height(tree, tree->pool[right].left)) {
+            tree->pool[node].right = _rotate_right(tree, right);
+        }
+        return _rotate_left(tree, node);
     }
-    else if (parent->left == node) {
-        parent->left = temp;
+    return node;
+}
+
+// Rebalances the nodes of the path from the bottom up, the path starts at
+// the root
+static void _rebalance_path(Tree* tree, uint32_t* path, size_t depth) {
+    while (depth > 0) {
+        depth -= 1;
+        uint32_t node = path[depth];
+        uint32_t balanced = _balance(tree, node);
+        if (depth == 0) {
+            tree->root = balanced;
+        }
+        else if (tree->pool[path[depth - 1]].left == node) {
+            tree->pool[path[depth - 1]].left = balanced;
+        }
+        else {
+            tree->pool[path[depth - 1]].right = balanced;
+        }
     }
-    else {
-        parent->right = temp;
+}
+
+static uint32_t _get_tree(Tree* tree, void* key) {
+    uint32_t node = tree->root;
+    while (node != 0) {
+        int cond = _cmp_tkey_tree(tree, node, key);
+        if (cond == 0) {
+            break;
+        }
+        node = cond < 0 ? tree->pool[node].left : tree->pool[node].right;
     }
-    tree->size -= 1;
-    temp->parent = parent;
-    _free_key_tree(tree->type.key, node);
-    _free_value_tree(tree->type.value, node);
-    free(node);
+    return node;
 }
 
-static void _del3_tree(Tree* tree, tree_node* node) {
-    tree_node* ptr = node->right;
-    while (ptr->left != NULL) {
-        ptr = ptr->left;
+static void _push_left(TreeCursor* cursor, uint32_t node) {
+    while (node != 0) {
+        cursor->path[cursor->depth++] = node;
+        node = cursor->tree->pool[node].left;
     }
-    node->data.key = ptr->data.key;
-    node->data.value = ptr->data.value;
-    tree_node* parent = ptr->parent;
-    if (parent->left == ptr) {
-        parent->left = NULL;
+}
+
+static uint32_t _next_node(TreeCursor* cursor) {
+    if (cursor->depth == 0) {
+        return 0;
     }
-    else {
-        parent->right = NULL;
+    uint32_t node = cursor->path[--cursor->depth];
+    _push_left(cursor, cursor->tree->pool[node].right);
+    return node;
+}
+
+static _Bool _eq_value_tree(vtype_t tvalue, value_t x, value_t y) {
+    switch (tvalue) {
+    case DECIMAL_TYPE:
+        return x.decimal == y.decimal;
+    case REAL_TYPE:
+        return x.real == y.real;
+    case STRING_TYPE:
+        return strcmp(x.string, y.string) == 0;
+    default:
+        return 0;
     }
-    tree->size -= 1;
-    // _free_key_tree(tree->type.key, node);
-    // _free_value_tree(tree->type.value, ptr);
-    free(ptr);
 }
 
-static void _print_node_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue) {
+static void _print_node_tree(Tree* tree, tree_node* node) {
     putchar('{');
-    switch (tkey) {
+    switch (tree->type.key) {
     case DECIMAL_TYPE:
         printf("%d", node->data.key.decimal);
         break;
     case STRING_TYPE:
         printf("'%s'", node->data.key.string);
         break;
+    case REAL_TYPE:
     default:;
     }
     printf(" => ");
-    switch (tvalue) {
+    switch (tree->type.value) {
     case DECIMAL_TYPE:
         printf("%d", node->data.value.decimal);
         break;
@@ -402,54 +658,3 @@ static void _print_node_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t
     }
     printf("} ");
 }
-
-static void _print_branches_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue) {
-    if (node == NULL) {
-        printf("null");
-        return;
-    }
-    putchar('(');
-    _print_branches_tree(tree, node->left, tkey, tvalue);
-    putchar(' ');
-    _print_node_tree(tree, node, tkey, tvalue);
-    _print_branches_tree(tree, node->right, tkey, tvalue);
-    putchar(')');
-}
-
-static void _print_tree(Tree* tree, tree_node* node, vtype_t tkey, vtype_t tvalue) {
-    if (node == NULL) {
-        return;
-    }
-    _print_tree(tree, node->left, tkey, tvalue);
-    _print_node_tree(tree, node, tkey, tvalue);
-    _print_tree(tree, node->right, tkey, tvalue);
-}
-
-static void _free_tree(Tree* tree, tree_node* node) {
-    if (node == NULL) {
-        return;
-    }
-    _free_tree(tree, node->left);
-    _free_tree(tree, node->right);
-    _free_key_tree(tree->type.key, node);
-    _free_value_tree(tree->type.value, node);
-    free(node);
-}
-
-static void _free_key_tree(vtype_t type, tree_node* node) {
-    switch (type) {
-    case STRING_TYPE:
-        free(node->data.key.string);
-        break;
-    default:;
-    }
-}
-
-static void _free_value_tree(vtype_t type, tree_node* node) {
-    switch (type) {
-    case STRING_TYPE:
-        free(node->data.value.string);
-        break;
-    default:;
-    }
-}
\ No newline at end of file
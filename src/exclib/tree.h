@@ -7,6 +7,7 @@
 #include "type.h"
 
 typedef struct Tree Tree;
+typedef struct TreeCursor TreeCursor;
 
 extern Tree* new_tree(vtype_t key, vtype_t value);
 extern void free_tree(Tree* tree);
@@ -16,6 +17,19 @@ extern int8_t set_tree(Tree* tree, void* key, void* value);
 extern void del_tree(Tree* tree, void* key);
 extern _Bool in_tree(Tree* tree, void* key);
 
+// Builds an empty tree out of `size` keys in ascending order without any
+// rebalancing, -1 is returned when the tree is not empty or the keys are
+// not sorted
+extern int8_t load_tree(Tree* tree, void** keys, void** values, size_t size);
+
+// A cursor walks the keys in ascending order starting with the smallest one
+// or the first one that is not less than the key it was seeked to. Any
+// set/del invalidates it.
+extern TreeCursor* new_tree_cursor(Tree* tree);
+extern void free_tree_cursor(TreeCursor* cursor);
+extern void seek_tree_cursor(TreeCursor* cursor, void* key);
+extern _Bool next_tree_cursor(TreeCursor* cursor, value_t* key, value_t* value);
+
 extern _Bool eq_tree(Tree* x, Tree* y);
 extern size_t size_tree(Tree* tree);
 extern size_t sizeof_tree(void);
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "type.h"
 
@@ -11,8 +12,18 @@ extern void* string(char* x) {
     return (void*)x;
 }
 
+// NOTE: the bits of the double are carried in the pointer itself, the same
+// way decimal() carries its integer, so storing one does not allocate
+_Static_assert(sizeof(void*) >= sizeof(double), "a double does not fit into a pointer");
+
 extern void* real(double x) {
-    double* f = (double*)malloc(sizeof(double));
-    *f = x;
-    return (void*)f;
+    void* f = NULL;
+    memcpy(&f, &x, sizeof(x));
+    return f;
+}
+
+extern double as_real(void* x) {
+    double f = 0.0;
+    memcpy(&f, &x, sizeof(f));
+    return f;
 }
\ No newline at end of file
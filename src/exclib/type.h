@@ -17,6 +17,12 @@ typedef union value_t {
 
 extern void* decimal(int32_t x);
 extern void* string(char* x);
+// NOTE: real() carries the bits of the double in the pointer itself, the
+// same way decimal() carries its integer. It used to return a malloc'ed
+// double*, the callers that dereference or free the result have to read
+// it with as_real() instead and must not free it.
 extern void* real(double x);
 
+extern double as_real(void* x);
+
 #endif /* EXTCLIB_TYPE_H_ */
\ No newline at end of file
@@ -0,0 +1,244 @@
+#define BM_IMPLEMENTATION
+#define BM_CACHE
+#include "./bm.h"
+
+Bm *libbm_create(void)
+{
+    // NOTE: aligned_alloc() wants the size to be a multiple of the alignment
+    const size_t size = (sizeof(Bm) + _Alignof(Bm) - 1) / _Alignof(Bm) * _Alignof(Bm);
+    Bm *bm = aligned_alloc(_Alignof(Bm), size);
+    if (bm == NULL) {
+        return NULL;
+    }
+    memset(bm, 0, sizeof(*bm));
+
+    if (bm_memory_init(bm) != ERR_OK) {
+        free(bm);
+        return NULL;
+    }
+    bm_output_init(bm, BM_OUTPUT_STDOUT, bm_output_is_terminal(BM_OUTPUT_STDOUT));
+
+    return bm;
+}
+
+void libbm_destroy(Bm *bm)
+{
+    if (bm == NULL) {
+        return;
+    }
+
+    bm_output_flush(bm);
+    bm_release(bm);
+    free(bm);
+}
+
+Err libbm_load_buffer(Bm *bm, const void *data, size_t size)
+{
+    return bm_load_program_from_memory(bm, data, size);
+}
+
+Err libbm_load_file(Bm *bm, const char *file_path)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        return ERR_INPUT;
+    }
+
+    size_t capacity = 4096;
+    size_t size = 0;
+    uint8_t *data = malloc(capacity);
+
+    while (data != NULL) {
+        size += fread(data + size, 1, capacity - size, f);
+        if (size < capacity) {
+            break;
+        }
+
+        capacity *= 2;
+        uint8_t *grown = realloc(data, capacity);
+        if (grown == NULL) {
+            free(data);
+        }
+        data = grown;
+    }
+
+    Err err = ERR_OK;
+    if (data == NULL) {
+        err = ERR_OUT_OF_MEMORY;
+    } else if (ferror(f)) {
+        err = ERR_INPUT;
+    } else {
+        err = bm_load_program_from_memory(bm, data, size);
+    }
+
+    free(data);
+    fclose(f);
+
+    return err;
+}
+
+Err libbm_push_native(Bm *bm, Bm_Native native)
+{
+    if (bm->natives_size >= BM_NATIVES_CAPACITY) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    bm_push_native(bm, native);
+
+    return ERR_OK;
+}
+
+Err libbm_execute(Bm *bm, int64_t budget)
+{
+    uint64_t left = budget < 0 ? UINT64_MAX : (uint64_t) budget;
+    Err err = bm_execute_budget(bm, &left);
+
+    // NOTE: the host gets the output of a finished program right away
+    if (err != ERR_OK || bm->halt) {
+        const Err flushed = bm_output_flush(bm);
+        if (err == ERR_OK) {
+            err = flushed;
+        }
+    }
+
+    return err;
+}
+
+Err libbm_write(Bm *bm, const void *data, size_t size)
+{
+    return bm_output_write(bm, data, size);
+}
+
+Err libbm_flush(Bm *bm)
+{
+    return bm_output_flush(bm);
+}
+
+Err libbm_set_output(Bm *bm, int fd, bool unbuffered)
+{
+    Err err = bm_output_flush(bm);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    bm_output_init(bm, fd, unbuffered);
+
+    return ERR_OK;
+}
+
+Err libbm_snapshot_save(Bm *bm, const char *file_path)
+{
+    return bm_snapshot_save(bm, file_path);
+}
+
+Err libbm_snapshot_restore(Bm *bm, const char *file_path)
+{
+    return bm_snapshot_restore(bm, file_path);
+}
+
+bool libbm_halted(const Bm *bm)
+{
+    return bm->halt;
+}
+
+uint64_t libbm_ip(const Bm *bm)
+{
+    return bm->ip;
+}
+
+Err libbm_inline_cache(const Bm *bm, uint64_t ip, uint64_t *target,
+                       uint64_t *hits, uint64_t *misses)
+{
+    if (ip >= bm->program_size ||
+        (bm->program[ip].type != INST_CALL_INDIRECT && bm->program[ip].type != INST_JMP_TABLE)) {
+        return ERR_ILLEGAL_OPERAND;
+    }
+
+    *target = bm->caches[ip].target;
+    *hits = bm->caches[ip].hits;
+    *misses = bm->caches[ip].misses;
+
+    return ERR_OK;
+}
+
+size_t libbm_stack_size(const Bm *bm)
+{
+    return bm->stack_size;
+}
+
+Err libbm_stack_peek(const Bm *bm, size_t depth, uint64_t *value)
+{
+    if (depth >= bm->stack_size) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    *value = bm->stack[bm->stack_size - 1 - depth].as_u64;
+
+    return ERR_OK;
+}
+
+Err libbm_stack_push(Bm *bm, uint64_t value)
+{
+    if (bm->stack_size >= BM_STACK_CAPACITY) {
+        return ERR_STACK_OVERFLOW;
+    }
+
+    bm->stack[bm->stack_size++].as_u64 = value;
+
+    return ERR_OK;
+}
+
+Err libbm_stack_pop(Bm *bm, uint64_t *value)
+{
+    if (bm->stack_size == 0) {
+        return ERR_STACK_UNDERFLOW;
+    }
+
+    *value = bm->stack[--bm->stack_size].as_u64;
+
+    return ERR_OK;
+}
+
+uint8_t *libbm_memory(Bm *bm)
+{
+    return bm->memory;
+}
+
+size_t libbm_memory_capacity(void)
+{
+    return BM_MEMORY_CAPACITY;
+}
+
+Libbm_Cache *libbm_cache_create(void)
+{
+    return new_conctab(0, STRING_TYPE, REAL_TYPE);
+}
+
+void libbm_cache_destroy(Libbm_Cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    free_conctab(cache);
+}
+
+Err libbm_cache_join(Bm *bm, Libbm_Cache *cache)
+{
+    return bm_cache_join(bm, cache);
+}
+
+Err libbm_cache_get(Bm *bm)
+{
+    return bm_cache_get(bm);
+}
+
+Err libbm_cache_set(Bm *bm)
+{
+    return bm_cache_set(bm);
+}
+
+Err libbm_cache_del(Bm *bm)
+{
+    return bm_cache_del(bm);
+}
@@ -0,0 +1,112 @@
+#ifndef LIBBM_H_
+#define LIBBM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The embeddable part of bm. A Bm is an opaque handle here, every VM is
+// independent of the others and may run on its own thread. Nothing in
+// here exits the process, every failure comes back as an Err.
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define LIBBM_API __attribute__((visibility("default")))
+#else
+#  define LIBBM_API
+#endif
+
+// NOTE: the values of the errors are a part of the API, the new ones go
+// to the end only
+typedef enum {
+    ERR_OK = 0,
+    ERR_STACK_OVERFLOW,
+    ERR_STACK_UNDERFLOW,
+    ERR_ILLEGAL_INST,
+    ERR_ILLEGAL_INST_ACCESS,
+    ERR_ILLEGAL_OPERAND,
+    ERR_ILLEGAL_MEMORY_ACCESS,
+    ERR_DIV_BY_ZERO,
+    ERR_OUT_OF_MEMORY,
+    ERR_OUTPUT,
+    ERR_INPUT,
+    ERR_INVALID_FILE,
+} Err;
+
+// NOTE: "ERR_UNKNOWN" for the values that are not an Err
+LIBBM_API const char *err_as_cstr(Err err);
+
+typedef struct Bm Bm;
+
+typedef Err (*Bm_Native)(Bm*);
+
+// NOTE: returns NULL when there is no memory for the VM
+LIBBM_API Bm *libbm_create(void);
+LIBBM_API void libbm_destroy(Bm *bm);
+
+// NOTE: loads a .bm file that is already in the memory, the data is not
+// used after the call. The VM starts over: the stack, the memory, the
+// heap and the ip are reset, the natives stay.
+LIBBM_API Err libbm_load_buffer(Bm *bm, const void *data, size_t size);
+LIBBM_API Err libbm_load_file(Bm *bm, const char *file_path);
+
+// NOTE: the native gets the next free index, the first one is 0
+LIBBM_API Err libbm_push_native(Bm *bm, Bm_Native native);
+
+// NOTE: executes at most `budget` instructions, a negative budget is no
+// limit. Running out of the budget is not an error, libbm_halted() tells
+// whether the program is done. The output is flushed once the program
+// halts or fails.
+LIBBM_API Err libbm_execute(Bm *bm, int64_t budget);
+
+// NOTE: the natives of a VM print into a buffer of its own that goes to
+// the standard output by default. The loads flush it and keep the fd.
+LIBBM_API Err libbm_write(Bm *bm, const void *data, size_t size);
+LIBBM_API Err libbm_flush(Bm *bm);
+// NOTE: flushes what is buffered and sends the rest of the output to
+// `fd`, the VM does not own it. `unbuffered` flushes after every print.
+LIBBM_API Err libbm_set_output(Bm *bm, int fd, bool unbuffered);
+
+LIBBM_API bool libbm_halted(const Bm *bm);
+LIBBM_API uint64_t libbm_ip(const Bm *bm);
+// NOTE: where the `call_indirect` or `jmp_table` at `ip` went the last
+// time, how many times it went to the same target as the time before and
+// how many times it did not. For the engines that speculate on the
+// indirect targets. ERR_ILLEGAL_OPERAND if there is no such instruction
+// at `ip`.
+LIBBM_API Err libbm_inline_cache(const Bm *bm, uint64_t ip, uint64_t *target,
+                                 uint64_t *hits, uint64_t *misses);
+
+LIBBM_API size_t libbm_stack_size(const Bm *bm);
+// NOTE: `depth` 0 is the top of the stack
+LIBBM_API Err libbm_stack_peek(const Bm *bm, size_t depth, uint64_t *value);
+LIBBM_API Err libbm_stack_push(Bm *bm, uint64_t value);
+LIBBM_API Err libbm_stack_pop(Bm *bm, uint64_t *value);
+
+// NOTE: the whole state of the VM but the host memory of the natives. A
+// snapshot is restored by mapping its memory pages, the same natives have
+// to be pushed before that.
+LIBBM_API Err libbm_snapshot_save(Bm *bm, const char *file_path);
+LIBBM_API Err libbm_snapshot_restore(Bm *bm, const char *file_path);
+
+LIBBM_API uint8_t *libbm_memory(Bm *bm);
+LIBBM_API size_t libbm_memory_capacity(void);
+
+// NOTE: the key/value cache of the cache_get, cache_set and cache_del
+// natives of bme. It is shared by every VM that joins it, the VMs may run
+// on different threads. A VM leaves the cache in libbm_destroy(), so the
+// cache has to outlive the VMs that joined it.
+typedef struct ConcTab Libbm_Cache;
+
+// NOTE: returns NULL when there is no memory for the cache
+LIBBM_API Libbm_Cache *libbm_cache_create(void);
+LIBBM_API void libbm_cache_destroy(Libbm_Cache *cache);
+LIBBM_API Err libbm_cache_join(Bm *bm, Libbm_Cache *cache);
+
+// NOTE: the natives themselves, pushed with libbm_push_native() at the
+// indices the programs bind them to. ERR_ILLEGAL_OPERAND until the VM joins
+// a cache.
+LIBBM_API Err libbm_cache_get(Bm *bm);
+LIBBM_API Err libbm_cache_set(Bm *bm);
+LIBBM_API Err libbm_cache_del(Bm *bm);
+
+#endif // LIBBM_H_